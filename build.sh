@@ -26,9 +26,11 @@ print_status "Building pipeline"
 
 mkdir -p output
 
-for plugin_name in logger uppercaser rotator flipper expander typewriter; do 
+plugins="logger uppercaser rotator flipper expander typewriter ratelimiter"
+
+for plugin_name in $plugins; do 
     print_status "Building plugin: $plugin_name" 
-    gcc -fPIC -shared -o output/${plugin_name}.so plugins/${plugin_name}.c plugins/plugin_common.c plugins/sync/monitor.c plugins/sync/consumer_producer.c -ldl -lpthread || { 
+    gcc -fPIC -shared -o output/${plugin_name}.so plugins/${plugin_name}.c plugins/plugin_common.c plugins/sync/monitor.c plugins/sync/eventcount.c plugins/sync/consumer_producer.c plugins/sync/message.c plugins/sync/scheduler.c plugins/sync/timer_wheel.c plugins/sync/topology.c -ldl -lpthread || { 
         print_error "Failed to build $plugin_name" 
         exit 1 
     }    
@@ -36,7 +38,29 @@ done
 
 
 
-gcc -ldl main.c -o output/analyzer
+# -rdynamic exports the message pool and the scheduler, so the plugins allocate from the analyzer's and run on its workers
+if [ "$1" = "static" ]; then
+    # ./build.sh static: the plugins above (plugins/plugin_registry.c lists the same ones) are compiled into the
+    # analyzer and optimized with it as one image; any other plugin still loads from output/<name>.so. Only the
+    # message pool, the scheduler and the timer wheel are exported, so a loaded .so keeps its own copy of the rest
+    # of the runtime
+    print_status "Building analyzer with built-in plugins"
+    mkdir -p output/static
+    static_objects=""
+    for plugin_name in $plugins; do
+        gcc -O2 -flto -fvisibility=hidden -DPLUGIN_STATIC_NAME=${plugin_name} -c plugins/${plugin_name}.c -o output/static/${plugin_name}.o || {
+            print_error "Failed to build $plugin_name"
+            exit 1
+        }
+        static_objects="$static_objects output/static/${plugin_name}.o"
+    done
+    gcc -O2 -flto -c plugins/sync/message.c -o output/static/message.o
+    gcc -O2 -flto -c plugins/sync/scheduler.c -o output/static/scheduler.o
+    gcc -O2 -flto -c plugins/sync/timer_wheel.c -o output/static/timer_wheel.o
+    gcc -O2 -flto -rdynamic -fvisibility=hidden -DPLUGIN_STATIC_BUILD main.c pipeline_config.c plugins/plugin_common.c plugins/plugin_registry.c plugins/sync/monitor.c plugins/sync/eventcount.c plugins/sync/consumer_producer.c plugins/sync/topology.c output/static/message.o output/static/scheduler.o output/static/timer_wheel.o $static_objects -o output/analyzer -ldl -lpthread
+else
+    gcc -rdynamic main.c pipeline_config.c plugins/sync/message.c plugins/sync/scheduler.c plugins/sync/timer_wheel.c plugins/sync/eventcount.c plugins/sync/topology.c -o output/analyzer -ldl -lpthread
+fi
 
 print_status "Pipeline built successfully"
 
@@ -2,9 +2,18 @@
 #include <stdio.h>
 #include <dlfcn.h>
 #include <string.h>
+#include <unistd.h>
 #include "plugins/plugin_common.h"
+#include "plugins/sync/scheduler.h"
+#include "plugins/sync/timer_wheel.h"
+#include "plugins/sync/topology.h"
+#ifdef PLUGIN_STATIC_BUILD
+#include "plugins/plugin_registry.h"
+#endif
+#include "pipeline_config.h"
 
 #define MAX_WORD_LENGTH 1026
+#define AUTO_REPLICAS_MAX 8 // Most workers replicas=auto gives a stage
 
 // Function Defenition
 typedef const char *(*plugin_init_func_t)(int queue_size);
@@ -12,6 +21,14 @@ typedef const char *(*plugin_fini_func_t)(void);
 typedef const char *(*plugin_place_work_func_t)(const char *work);
 typedef void (*plugin_attach_func_t)(const char *(*next_place_work)(const char *));
 typedef const char *(*plugin_wait_finished_func_t)(void);
+typedef const char *(*plugin_place_work_owned_func_t)(char *str);
+typedef void (*plugin_attach_owned_func_t)(plugin_place_work_owned_func_t next_place_work_owned);
+typedef const char *(*plugin_place_work_batch_func_t)(char *const *items, int count);
+typedef void (*plugin_attach_batch_func_t)(plugin_place_work_batch_func_t next_place_work_batch);
+typedef const char *(*plugin_set_option_func_t)(const char *key, const char *value);
+typedef const char *(*plugin_get_stats_func_t)(consumer_producer_stats_t *stats);
+typedef const plugin_instance_api_t *(*plugin_instance_api_func_t)(void);
+typedef const plugin_capabilities_t *(*plugin_capabilities_func_t)(void);
 
 // The struct as advised in the guideline
 typedef struct
@@ -21,97 +38,724 @@ typedef struct
     plugin_place_work_func_t place_work;
     plugin_attach_func_t attach;
     plugin_wait_finished_func_t wait_finished;
+    plugin_place_work_owned_func_t place_work_owned; // Optional, NULL if not exported
+    plugin_attach_owned_func_t attach_owned;         // Optional, NULL if not exported
+    plugin_place_work_batch_func_t place_work_batch; // Optional, NULL if not exported
+    plugin_attach_batch_func_t attach_batch;         // Optional, NULL if not exported
+    plugin_set_option_func_t set_option;             // Optional, NULL if not exported
+    plugin_get_stats_func_t get_stats;               // Optional, NULL if not exported
+    const plugin_instance_api_t *api;                // How the stage is driven, legacy_api for plugins without instances
+    void *instance;                                  // The stage's instance, the handle itself under legacy_api
+    plugin_transforms_t transforms;                  // Optional, lets the stage be fused into the previous one
+    const plugin_capabilities_t *capabilities;       // Optional, NULL if not exported
+    int fused_into;                                  // Stage whose thread runs our transform, -1 if we have our own
+    int fused_index;                                 // Our transform's index in that stage's transform stats
+    int fused_count;                                 // Stages fused into this one
     char *name;
-    void *handle;
+    void *handle; // dlopen handle, NULL for a plugin built into the analyzer
 } plugin_handle_t;
 
 static plugin_handle_t *plugin_handles = NULL;
 static int g_pluginCount = 0;
 
+/*
+ * Plugins without plugin_instance_api() have a single default instance per
+ * .so, driven by the legacy exports. These adapters give them the instance
+ * interface, with the plugin_handle_t as instance, so the rest of main drives
+ * every stage the same way. A legacy plugin can only feed another legacy
+ * stage; pipeline_init makes every stage after a legacy one legacy too.
+ */
+
+static const char *legacy_fini(void *instance)
+{
+    return ((plugin_handle_t *)instance)->fini();
+}
+
+static const char *legacy_place_work(void *instance, const char *str)
+{
+    return ((plugin_handle_t *)instance)->place_work(str);
+}
+
+static const char *legacy_place_work_owned(void *instance, char *str)
+{
+    return ((plugin_handle_t *)instance)->place_work_owned(str);
+}
+
+static const char *legacy_place_work_batch(void *instance, char *const *items, int count)
+{
+    return ((plugin_handle_t *)instance)->place_work_batch(items, count);
+}
+
+static const char *legacy_attach(void *instance, const plugin_sink_t *next)
+{
+    plugin_handle_t *handle = instance;
+    plugin_handle_t *next_handle = next->instance;
+
+    handle->attach(next_handle->place_work);
+    // Hand strings over without copying between plugins that both support it
+    if (handle->attach_owned && next_handle->place_work_owned)
+    {
+        handle->attach_owned(next_handle->place_work_owned);
+    }
+    // Forward whole batches between plugins that both support it
+    if (handle->attach_batch && next_handle->place_work_batch)
+    {
+        handle->attach_batch(next_handle->place_work_batch);
+    }
+    return NULL;
+}
+
+static const char *legacy_wait_finished(void *instance)
+{
+    return ((plugin_handle_t *)instance)->wait_finished();
+}
+
+static const char *legacy_set_option(void *instance, const char *key, const char *value)
+{
+    plugin_handle_t *handle = instance;
+    return handle->set_option ? handle->set_option(key, value) : "Plugin doesn't support options";
+}
+
+static const char *legacy_get_stats(void *instance, consumer_producer_stats_t *stats)
+{
+    plugin_handle_t *handle = instance;
+    return handle->get_stats ? handle->get_stats(stats) : "Plugin doesn't provide stats";
+}
+
+static const plugin_instance_api_t legacy_api = {
+    NULL, // plugin_init is called directly, see stage_init
+    legacy_fini,
+    legacy_place_work,
+    legacy_place_work_owned,
+    legacy_place_work_batch,
+    legacy_attach,
+    legacy_wait_finished,
+    legacy_set_option,
+    legacy_get_stats,
+    NULL, // Legacy stages can't run other stages' transforms
+    NULL,
+    NULL, // and take strings only,
+    NULL, // with <END> as the only control message
+    NULL,
+};
+
+// Creates the stage's instance (or initializes the plugin's default one)
+static const char *stage_init(plugin_handle_t *stage, int queue_size, int replicas)
+{
+    if (stage->api == &legacy_api)
+    {
+        if (replicas > 1)
+        {
+            return "Plugin doesn't support replicas";
+        }
+        stage->instance = stage;
+        return stage->init(queue_size);
+    }
+    return stage->api->init(queue_size, replicas, &stage->instance);
+}
+
+// The entry points other stages send work to
+static plugin_sink_t stage_sink(plugin_handle_t *stage)
+{
+    plugin_sink_t sink = {stage->instance, stage->api->place_work, stage->api->place_work_owned,
+                          stage->api->place_work_batch, stage->api->place_messages, stage->api->place_control};
+    if (stage->api == &legacy_api)
+    {
+        // Only offer what the plugin exports
+        sink.place_work_owned = stage->place_work_owned ? legacy_place_work_owned : NULL;
+        sink.place_work_batch = stage->place_work_batch ? legacy_place_work_batch : NULL;
+    }
+    return sink;
+}
+
+#ifdef PLUGIN_STATIC_BUILD
+// Sets up a stage of a plugin built into the analyzer, which only has the instance API
+static void stage_from_registry(plugin_handle_t *stage, const plugin_registry_entry_t *entry)
+{
+    memset(stage, 0, sizeof(*stage));
+    stage->name = malloc(strlen(entry->name) + 1);
+    strcpy(stage->name, entry->name);
+    stage->api = &entry->api;
+    stage->transforms = *entry->transforms;
+    stage->capabilities = entry->capabilities ? entry->capabilities() : NULL;
+    stage->fused_into = -1;
+}
+#endif
+
 // Helper functions:
 
 int pipeline_destroy(void);
 int verifyInteger(const char *str);
-int pipeline_init(char *pluginNamesRaw[], int queueSize);
+int pipeline_init(const pipeline_config_t *config);
+int pipeline_configure(const pipeline_config_t *config, int pooled);
+int pipeline_place(const pipeline_config_t *config, int pooled, int printStats);
+int pipeline_plan_fusion(const pipeline_config_t *config, int autoFuse);
+int pipeline_plan_replicas(pipeline_config_t *config);
+void pipeline_print_stats(void);
+int pipeline_barrier(unsigned long barrier, int printStats);
+
+// Whether the plugin declared it can run on several threads at once
+static int stage_replicable(const plugin_handle_t *stage)
+{
+    unsigned int needed = PLUGIN_CAP_STATELESS | PLUGIN_CAP_THREAD_SAFE;
+    return stage->capabilities && (stage->capabilities->flags & needed) == needed;
+}
+
+// Whether the plugin exports a paced transform, which waits on the timer wheel instead of sleeping
+static int stage_paced(const plugin_handle_t *stage)
+{
+    return stage->transforms.paced != NULL;
+}
+
+// Whether the plugin declared it is better off on a thread of its own
+static int stage_wants_thread(const plugin_handle_t *stage)
+{
+    return stage->capabilities && ((stage->capabilities->flags & PLUGIN_CAP_BLOCKING) ||
+                                   stage->capabilities->cost == PLUGIN_COST_EXPENSIVE);
+}
+
+// Whether the stage holds the thread it runs on while it waits. A paced
+// stage doesn't: it waits on the timer wheel, one thread or task for any number of lines
+static int stage_sleeps(const plugin_handle_t *stage)
+{
+    return stage_wants_thread(stage) && !stage_paced(stage);
+}
+
+// Checks replicas > 1 against what the plugins declare and resolves
+// replicas=auto: a stage that is expensive or blocking and may be
+// replicated gets a worker per CPU (at least 2), any other stage one; a
+// paced one overlaps its lines on its own instead.
+// Returns 0 on success.
+int pipeline_plan_replicas(pipeline_config_t *config)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus < 2 ? 2 : cpus > AUTO_REPLICAS_MAX ? AUTO_REPLICAS_MAX : (int)cpus;
+    for (int i = 0; i < g_pluginCount; i++)
+    {
+        pipeline_stage_t *stage = &config->stages[i];
+        const plugin_handle_t *handle = &plugin_handles[i];
+        if (stage->replicas == 0)
+        {
+            int replicate = handle->api != &legacy_api && stage_replicable(handle) && stage_sleeps(handle);
+            stage->replicas = replicate ? workers : 1;
+        }
+        else if (stage->replicas > 1 && handle->capabilities && !stage_replicable(handle))
+        {
+            fprintf(stderr, "Error: [%s] replicas=%d: Plugin isn't stateless and thread safe\n", handle->name,
+                    stage->replicas);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Why stage i can't run on the previous stage's thread, NULL if it can
+static const char *fusion_blocker(const pipeline_config_t *config, int i, int head)
+{
+    if (plugin_handles[i].api == &legacy_api || plugin_handles[head].api->fuse == NULL)
+    {
+        return "Plugin doesn't support instances";
+    }
+    if (plugin_handles[i].transforms.transform == NULL)
+    {
+        return "Plugin doesn't export plugin_transform";
+    }
+    if (stage_paced(&plugin_handles[i]))
+    {
+        return "A paced stage needs a stage of its own";
+    }
+    if (config->stages[i].replicas > 1 || config->stages[i].option_count > 0)
+    {
+        return "A fused stage can't have replicas or options";
+    }
+    if (plugin_handles[head].fused_count == PLUGIN_FUSE_MAX)
+    {
+        return "Too many stages fused into one";
+    }
+    return NULL;
+}
+
+// Decides which stages run on the thread of an earlier one: those with
+// fuse=yes, and under --fuse every stage that can and didn't say fuse=no,
+// unless it or the stage it would join declares itself blocking or
+// expensive. Returns 0 on success.
+int pipeline_plan_fusion(const pipeline_config_t *config, int autoFuse)
+{
+    for (int i = 0; i < g_pluginCount; i++)
+    {
+        plugin_handles[i].fused_into = -1;
+        plugin_handles[i].fused_count = 0;
+    }
+    if (config->stages[0].fuse == 1)
+    {
+        fprintf(stderr, "Error: [%s] The first stage has nothing to be fused into\n", plugin_handles[0].name);
+        return -1;
+    }
+    for (int i = 1; i < g_pluginCount; i++)
+    {
+        int fuse = config->stages[i].fuse;
+        if (fuse == 0 || (fuse == -1 && !autoFuse))
+        {
+            continue;
+        }
+        int head = plugin_handles[i - 1].fused_into >= 0 ? plugin_handles[i - 1].fused_into : i - 1;
+        if (fuse == -1 && (stage_wants_thread(&plugin_handles[i]) || stage_wants_thread(&plugin_handles[head])))
+        {
+            continue;
+        }
+        const char *blocker = fusion_blocker(config, i, head);
+        if (blocker)
+        {
+            if (fuse == 1)
+            {
+                fprintf(stderr, "Error: [%s] fuse=yes: %s\n", plugin_handles[i].name, blocker);
+                return -1;
+            }
+            continue;
+        }
+        plugin_handles[i].fused_into = head;
+        plugin_handles[i].fused_index = ++plugin_handles[head].fused_count;
+    }
+    return 0;
+}
+
+// Value of a stage's option in the config, NULL if it isn't given
+static const char *stage_option(const pipeline_stage_t *stage, const char *key)
+{
+    for (int j = 0; j < stage->option_count; j++)
+    {
+        if (strcmp(stage->options[j].key, key) == 0)
+        {
+            return stage->options[j].value;
+        }
+    }
+    return NULL;
+}
+
+// Hands every stage's options from the config to its plugin, returns 0 on success
+int pipeline_configure(const pipeline_config_t *config, int pooled)
+{
+    for (int i = 0; i < g_pluginCount; i++)
+    {
+        const pipeline_stage_t *stage = &config->stages[i];
+        // A stage that sleeps or takes long would hold a pool worker, it keeps a thread unless told otherwise
+        int sched_given = 0;
+        for (int j = 0; j < stage->option_count; j++)
+        {
+            sched_given |= strcmp(stage->options[j].key, "sched") == 0;
+        }
+        if (pooled && !sched_given && plugin_handles[i].instance && stage->replicas == 1 &&
+            stage_sleeps(&plugin_handles[i]))
+        {
+            const char *error = plugin_handles[i].api->set_option(plugin_handles[i].instance, "sched", "thread");
+            if (error)
+            {
+                fprintf(stderr, "Error: [%s] sched=thread: %s\n", plugin_handles[i].name, error);
+                return -1;
+            }
+        }
+        // A paced stage whose plugin may run on several lines at once overlaps as many as it can
+        if (plugin_handles[i].instance && stage->replicas == 1 && stage_paced(&plugin_handles[i]) &&
+            stage_replicable(&plugin_handles[i]) && !stage_option(stage, "inflight"))
+        {
+            char inflight[16];
+            snprintf(inflight, sizeof(inflight), "%d", PLUGIN_INFLIGHT_MAX);
+            const char *error = plugin_handles[i].api->set_option(plugin_handles[i].instance, "inflight", inflight);
+            if (error)
+            {
+                fprintf(stderr, "Error: [%s] inflight=%s: %s\n", plugin_handles[i].name, inflight, error);
+                return -1;
+            }
+        }
+        for (int j = 0; j < stage->option_count; j++)
+        {
+            const char *error = plugin_handles[i].api->set_option(plugin_handles[i].instance, stage->options[j].key,
+                                                                  stage->options[j].value);
+            if (error)
+            {
+                fprintf(stderr, "Error: [%s] %s=%s: %s\n", plugin_handles[i].name,
+                        stage->options[j].key, stage->options[j].value, error);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Pins every stage thread to a CPU (analyzer --place). Stages take CPUs in
+// pipeline order from topology_cpu_order, so neighbouring stages land on
+// sibling threads of a core, then cores of a package, then one NUMA node;
+// with more threads than CPUs the order starts over. A stage's cpu option
+// also moves its queue to that node. Stages given cpu= keep it, fused and
+// pooled stages have no thread of their own. Returns 0 on success.
+int pipeline_place(const pipeline_config_t *config, int pooled, int printStats)
+{
+    int *cpus = malloc(TOPOLOGY_MAX_CPUS * sizeof(int));
+    if (!cpus)
+    {
+        fprintf(stderr, "Error: Out of memory\n");
+        return -1;
+    }
+    int cpu_count = topology_cpu_order(cpus, TOPOLOGY_MAX_CPUS);
+    int next = 0;
+    for (int i = 0; i < g_pluginCount; i++)
+    {
+        const pipeline_stage_t *stage = &config->stages[i];
+        const char *sched = stage_option(stage, "sched");
+        int threaded = !pooled || stage->replicas > 1 ||
+                       (sched ? strcmp(sched, "thread") == 0 : stage_sleeps(&plugin_handles[i]));
+        if (plugin_handles[i].fused_into >= 0 || !threaded || stage_option(stage, "cpu"))
+        {
+            continue;
+        }
+
+        // A replicated stage's workers share the CPUs that follow
+        char list[PIPELINE_CONFIG_LINE_LENGTH] = "";
+        size_t used = 0;
+        for (int r = 0; r < stage->replicas && r < cpu_count && used + 16 < sizeof(list); r++)
+        {
+            used += snprintf(list + used, sizeof(list) - used, r ? ",%d" : "%d", cpus[next++ % cpu_count]);
+        }
+        const char *error = plugin_handles[i].api->set_option(plugin_handles[i].instance, "cpu", list);
+        if (error)
+        {
+            // Placement is a hint, the stage still runs
+            fprintf(stderr, "Warning: [%s] cpu=%s: %s\n", plugin_handles[i].name, list, error);
+        }
+        else if (printStats)
+        {
+            fprintf(stderr, "Placement: %-12s cpu=%s node=%d\n", plugin_handles[i].name, list,
+                    topology_cpu_node(atoi(list)));
+        }
+    }
+    free(cpus);
+    return 0;
+}
+
+static void print_queue_stats(const char *name, const consumer_producer_stats_t *stats)
+{
+    fprintf(stderr, "  %-12s in=%lu out=%lu depth=%lu high_water=%lu "
+                    "full_wait=%.3fms empty_wait=%.3fms dropped=%lu/%lu\n",
+            name, stats->total_put, stats->total_got, stats->depth, stats->high_water,
+            stats->producer_blocked_ns / 1e6, stats->consumer_blocked_ns / 1e6,
+            stats->dropped_oldest, stats->dropped_newest);
+}
+
+// Prints each stage's input queue counters to stderr. A stage whose upstream
+// spent long blocked on a full queue is the bottleneck.
+void pipeline_print_stats(void)
+{
+    fprintf(stderr, "Stage stats (input queue of each stage):\n");
+    for (int i = 0; i < g_pluginCount; i++)
+    {
+        plugin_transform_stats_t transform;
+        if (plugin_handles[i].fused_into >= 0)
+        {
+            plugin_handle_t *head = &plugin_handles[plugin_handles[i].fused_into];
+            if (head->api->get_transform_stats(head->instance, plugin_handles[i].fused_index, &transform) == NULL)
+            {
+                fprintf(stderr, "  %-12s fused into %s calls=%lu time=%.3fms\n", plugin_handles[i].name,
+                        head->name, transform.calls, transform.time_ns / 1e6);
+            }
+            continue;
+        }
+
+        consumer_producer_stats_t stats;
+        if (plugin_handles[i].api->get_stats(plugin_handles[i].instance, &stats) != NULL)
+        {
+            fprintf(stderr, "  %-12s no stats\n", plugin_handles[i].name);
+            continue;
+        }
+        print_queue_stats(plugin_handles[i].name, &stats);
+        if (plugin_handles[i].fused_count > 0 &&
+            plugin_handles[i].api->get_transform_stats(plugin_handles[i].instance, 0, &transform) == NULL)
+        {
+            fprintf(stderr, "  %-12s calls=%lu time=%.3fms\n", "", transform.calls, transform.time_ns / 1e6);
+        }
+    }
+
+    // Once the pipeline runs, items should come from buffers the pool has already seen
+    message_pool_stats_t pool;
+    message_pool_stats(&pool);
+    fprintf(stderr, "Message pool: malloc=%lu free=%lu\n", pool.mallocs, pool.frees);
+
+    if (scheduler_running())
+    {
+        scheduler_stats_t scheduler;
+        scheduler_stats(&scheduler);
+        fprintf(stderr, "Scheduler: workers=%d threads=%d runs=%lu steals=%lu\n", scheduler.workers,
+                scheduler.threads, scheduler.runs, scheduler.steals);
+    }
+}
+
+// Waits until the barrier numbered barrier (counting from 1) passed every
+// stage with a thread of its own. Each stage's counters as the barrier went
+// through are consistent with each other: every item ahead of it is counted
+// by every stage, nothing behind it by any. Returns 0 on success.
+int pipeline_barrier(unsigned long barrier, int printStats)
+{
+    if (printStats)
+    {
+        fprintf(stderr, "Barrier %lu:\n", barrier);
+    }
+    for (int i = 0; i < g_pluginCount; i++)
+    {
+        if (plugin_handles[i].fused_into >= 0 || plugin_handles[i].api->wait_barrier == NULL)
+        {
+            continue;
+        }
+        consumer_producer_stats_t stats;
+        const char *error = plugin_handles[i].api->wait_barrier(plugin_handles[i].instance, barrier, &stats);
+        if (error)
+        {
+            fprintf(stderr, "Warning: [%s] %s\n", plugin_handles[i].name, error);
+            return -1;
+        }
+        if (printStats)
+        {
+            print_queue_stats(plugin_handles[i].name, &stats);
+        }
+    }
+    return 0;
+}
+
 char **transformPluginName(char **pluginNames, int count);
 void print_Usage(const char *execLocation);
 
 int main(int argc, char *argv[])
 {
-    // Verify the argument count is valid
-    if (argc < 3)
+    pipeline_config_t config;
+
+    // --stats, --fuse, --pool and --place may come first; drop them so the rest of the parsing stays the same
+    int printStats = 0;
+    int autoFuse = 0;
+    int pooled = 0;
+    int place = 0;
+    while (argc >= 2 && (strcmp(argv[1], "--stats") == 0 || strcmp(argv[1], "--fuse") == 0 ||
+                         strcmp(argv[1], "--pool") == 0 || strcmp(argv[1], "--place") == 0))
     {
-        fprintf(stderr, "Error: Too few arguments \n");
-        print_Usage(argv[0]);
-        exit(1);
+        if (strcmp(argv[1], "--stats") == 0)
+        {
+            printStats = 1;
+        }
+        else if (strcmp(argv[1], "--fuse") == 0)
+        {
+            autoFuse = 1;
+        }
+        else if (strcmp(argv[1], "--pool") == 0)
+        {
+            pooled = 1;
+        }
+        else
+        {
+            place = 1;
+        }
+        argv[1] = argv[0];
+        argv++;
+        argc--;
     }
-    // Verify first argument is a valid positive number
-    int queueSize = verifyInteger(argv[1]);
-    if (queueSize <= 0)
+
+    if (argc >= 2 && strcmp(argv[1], "--config") == 0)
     {
-        fprintf(stderr, "Error: <queue_size> must be a positive integer \n");
-        print_Usage(argv[0]);
-        exit(1);
+        if (argc != 3)
+        {
+            fprintf(stderr, "Error: --config takes exactly one file and no plugin names\n");
+            print_Usage(argv[0]);
+            exit(1);
+        }
+        int error_line = 0;
+        const char *error = pipeline_config_load(&config, argv[2], &error_line);
+        if (error)
+        {
+            if (error_line > 0)
+            {
+                fprintf(stderr, "Error: %s:%d: %s\n", argv[2], error_line, error);
+            }
+            else
+            {
+                fprintf(stderr, "Error: %s: %s\n", argv[2], error);
+            }
+            exit(1);
+        }
+    }
+    else
+    {
+        // Verify the argument count is valid
+        if (argc < 3)
+        {
+            fprintf(stderr, "Error: Too few arguments \n");
+            print_Usage(argv[0]);
+            exit(1);
+        }
+        // Verify first argument is a valid positive number
+        int queueSize = verifyInteger(argv[1]);
+        if (queueSize <= 0)
+        {
+            fprintf(stderr, "Error: <queue_size> must be a positive integer \n");
+            print_Usage(argv[0]);
+            exit(1);
+        }
+        if (pipeline_config_from_args(&config, &argv[2], argc - 2, queueSize) != NULL)
+        {
+            fprintf(stderr, "Error: Pipeline initialization failed\n");
+            exit(1);
+        }
     }
-    g_pluginCount = argc - 2;
-    int init_result = pipeline_init(&argv[2], queueSize);
+
+    g_pluginCount = config.stage_count;
+    int init_result = pipeline_init(&config);
 
     if (init_result == 1)
     {
         fprintf(stderr, "Error: Failed to load plugin shared objects\n");
         print_Usage(argv[0]);
+        pipeline_config_free(&config);
         exit(1);
     }
     else if (init_result != 0)
     {
         fprintf(stderr, "Error: Pipeline initialization failed\n");
         print_Usage(argv[0]);
+        pipeline_config_free(&config);
+        exit(1);
+    }
+
+    if (pipeline_plan_replicas(&config) != 0 || pipeline_plan_fusion(&config, autoFuse) != 0)
+    {
+        pipeline_destroy();
+        pipeline_config_free(&config);
+        exit(1);
+    }
+
+    // Stages created from now on are tasks on the workers instead of threads of their own
+    if (pooled && scheduler_start(0) != 0)
+    {
+        fprintf(stderr, "Error: Starting the scheduler failed\n");
+        pipeline_destroy();
+        pipeline_config_free(&config);
         exit(1);
     }
 
     for (int i = 0; i < g_pluginCount; i++)
     {
-        const char *error = plugin_handles[i].init(queueSize);
+        const char *error;
+        if (plugin_handles[i].fused_into >= 0)
+        {
+            // Runs on the thread of the stage it is fused into, its own instance is never created
+            plugin_handle_t *head = &plugin_handles[plugin_handles[i].fused_into];
+            error = head->api->fuse(head->instance, &plugin_handles[i].transforms);
+        }
+        else
+        {
+            error = stage_init(&plugin_handles[i], config.stages[i].queue_size, config.stages[i].replicas);
+        }
         if (error)
         {
             fprintf(stderr, "Error: [%s] %s\n", plugin_handles[i].name, error);
             pipeline_destroy();
+            pipeline_config_free(&config);
             exit(2);
         }
     }
-    // Set up the pipeline by attaching each plugin to the next
+    if (pipeline_configure(&config, pooled) != 0 || (place && pipeline_place(&config, pooled, printStats) != 0))
+    {
+        // The consumer threads are running, let them drain and exit before unloading
+        for (int i = 0; i < g_pluginCount; i++)
+        {
+            if (!plugin_handles[i].instance)
+            {
+                continue;
+            }
+            plugin_handles[i].api->place_work(plugin_handles[i].instance, "<END>");
+            plugin_handles[i].api->wait_finished(plugin_handles[i].instance);
+            plugin_handles[i].api->fini(plugin_handles[i].instance);
+        }
+        pipeline_destroy();
+        pipeline_config_free(&config);
+        exit(2);
+    }
+    pipeline_config_free(&config);
+    // Set up the pipeline by attaching each plugin to the next one that has its own thread
     for (int i = 0; i < g_pluginCount - 1; i++)
     {
-        plugin_handles[i].attach(plugin_handles[i + 1].place_work);
+        int j = i + 1;
+        while (j < g_pluginCount && plugin_handles[j].fused_into >= 0)
+        {
+            j++;
+        }
+        if (plugin_handles[i].fused_into >= 0 || j == g_pluginCount)
+        {
+            continue;
+        }
+        plugin_sink_t next = stage_sink(&plugin_handles[j]);
+        const char *error = plugin_handles[i].api->attach(plugin_handles[i].instance, &next);
+        if (error)
+        {
+            fprintf(stderr, "Error: [%s] %s\n", plugin_handles[i].name, error);
+        }
     }
-    // Main input loop, read from stdin
+    // Main input loop, read from stdin. The lines <END>, <FLUSH> and <BARRIER>
+    // are the host's commands; they enter the pipeline as control messages,
+    // so the text of a line a plugin produces never is one.
     char readBuffer[MAX_WORD_LENGTH];
-    while (fgets(readBuffer, sizeof(readBuffer), stdin))
+    unsigned long barriers = 0;
+    int ended = 0;
+    while (!ended && fgets(readBuffer, sizeof(readBuffer), stdin))
     {
         long sizeOfBuffer = strlen(readBuffer);
 
         if (sizeOfBuffer > 0 && readBuffer[sizeOfBuffer - 1] == '\n')
         {
-            readBuffer[sizeOfBuffer - 1] = '\0';
+            readBuffer[--sizeOfBuffer] = '\0';
         }
 
-        const char *error = plugin_handles[0].place_work(readBuffer);
+        unsigned int control = strcmp(readBuffer, "<END>") == 0       ? MESSAGE_END
+                               : strcmp(readBuffer, "<FLUSH>") == 0   ? MESSAGE_FLUSH
+                               : strcmp(readBuffer, "<BARRIER>") == 0 ? MESSAGE_BARRIER
+                                                                      : 0;
+        const char *error;
+        message_t message;
+        if (control && plugin_handles[0].api->place_control)
+        {
+            error = plugin_handles[0].api->place_control(plugin_handles[0].instance, control);
+        }
+        else if (control & (MESSAGE_FLUSH | MESSAGE_BARRIER))
+        {
+            continue; // A legacy first stage has nothing to do with them
+        }
+        else if (plugin_handles[0].api->place_messages && !control)
+        {
+            // We already know the length, hand it over with the line
+            if (message_copy(&message, readBuffer, (size_t)sizeOfBuffer) != 0)
+            {
+                error = "Out of memory";
+            }
+            else
+            {
+                error = plugin_handles[0].api->place_messages(plugin_handles[0].instance, &message, 1);
+            }
+        }
+        else
+        {
+            error = plugin_handles[0].api->place_work(plugin_handles[0].instance, readBuffer);
+        }
         if (error != NULL)
         {
             fprintf(stderr, "Error: Failed to place work in pipeline: %s\n", error);
             break;
         }
 
-        if (strcmp(readBuffer, "<END>") == 0)
+        ended = control == MESSAGE_END;
+        if (control == MESSAGE_BARRIER)
         {
-            break;
+            pipeline_barrier(++barriers, printStats);
         }
     }
     for (int i = 0; i < g_pluginCount; i++)
     {
-        if (plugin_handles[i].wait_finished)
+        if (plugin_handles[i].instance)
         {
-            const char *wait_error = plugin_handles[i].wait_finished();
+            const char *wait_error = plugin_handles[i].api->wait_finished(plugin_handles[i].instance);
             if (wait_error != NULL)
             {
                 fprintf(stderr, "Warning: Plugin '%s' wait_finished failed: %s\n",
@@ -120,11 +764,17 @@ int main(int argc, char *argv[])
         }
     }
 
+    // The queues go away in fini, read them before
+    if (printStats)
+    {
+        pipeline_print_stats();
+    }
+
     for (int i = 0; i < g_pluginCount; i++)
     {
-        if (plugin_handles[i].fini)
+        if (plugin_handles[i].instance)
         {
-            const char *fini_error = plugin_handles[i].fini();
+            const char *fini_error = plugin_handles[i].api->fini(plugin_handles[i].instance);
             if (fini_error != NULL)
             {
                 fprintf(stderr, "Error: Plugin '%s' cleanup failed: %s\n",
@@ -133,6 +783,8 @@ int main(int argc, char *argv[])
         }
     }
     pipeline_destroy();
+    scheduler_stop();
+    timer_wheel_stop();
 
     printf("Pipeline shutdown complete\n");
     exit(0);
@@ -156,7 +808,7 @@ int verifyInteger(const char *str)
     return val;
 }
 
-int pipeline_init(char *pluginNamesRaw[], int queueSize)
+int pipeline_init(const pipeline_config_t *config)
 {
     if (g_pluginCount <= 0)
     {
@@ -164,6 +816,12 @@ int pipeline_init(char *pluginNamesRaw[], int queueSize)
         return -1;
     }
 
+    char *pluginNamesRaw[g_pluginCount];
+    for (int i = 0; i < g_pluginCount; i++)
+    {
+        pluginNamesRaw[i] = config->stages[i].plugin;
+    }
+
     plugin_handles = malloc(g_pluginCount * sizeof(plugin_handle_t));
     if (!plugin_handles)
     {
@@ -175,13 +833,24 @@ int pipeline_init(char *pluginNamesRaw[], int queueSize)
 
     for (int i = 0; i < g_pluginCount; i++)
     {
+#ifdef PLUGIN_STATIC_BUILD
+        const plugin_registry_entry_t *builtin = plugin_registry_find(pluginNamesRaw[i]);
+        if (builtin)
+        {
+            stage_from_registry(&plugin_handles[i], builtin);
+            continue;
+        }
+#endif
         plugin_handles[i].handle = dlopen(pluginNames[i], RTLD_NOW | RTLD_LOCAL);
         if (!plugin_handles[i].handle)
         {
             fprintf(stderr, "Error: Failed to load plugin %s: %s\n", pluginNames[i], dlerror());
             for (int j = 0; j < i; j++)
             {
-                dlclose(plugin_handles[j].handle);
+                if (plugin_handles[j].handle)
+                {
+                    dlclose(plugin_handles[j].handle);
+                }
                 free(plugin_handles[j].name);
             }
 
@@ -205,6 +874,24 @@ int pipeline_init(char *pluginNamesRaw[], int queueSize)
         plugin_handles[i].place_work = dlsym(plugin_handles[i].handle, "plugin_place_work");
         plugin_handles[i].attach = dlsym(plugin_handles[i].handle, "plugin_attach");
         plugin_handles[i].wait_finished = dlsym(plugin_handles[i].handle, "plugin_wait_finished");
+        plugin_handles[i].place_work_owned = dlsym(plugin_handles[i].handle, "plugin_place_work_owned");
+        plugin_handles[i].attach_owned = dlsym(plugin_handles[i].handle, "plugin_attach_owned");
+        plugin_handles[i].place_work_batch = dlsym(plugin_handles[i].handle, "plugin_place_work_batch");
+        plugin_handles[i].attach_batch = dlsym(plugin_handles[i].handle, "plugin_attach_batch");
+        plugin_handles[i].set_option = dlsym(plugin_handles[i].handle, "plugin_set_option");
+        plugin_handles[i].get_stats = dlsym(plugin_handles[i].handle, "plugin_get_stats");
+        plugin_handles[i].transforms.transform = dlsym(plugin_handles[i].handle, "plugin_transform");
+        plugin_handles[i].transforms.inplace = dlsym(plugin_handles[i].handle, "plugin_transform_inplace");
+        plugin_handles[i].transforms.message = dlsym(plugin_handles[i].handle, "plugin_transform_message");
+        plugin_handles[i].transforms.batch = dlsym(plugin_handles[i].handle, "plugin_transform_batch");
+        plugin_handles[i].transforms.paced = dlsym(plugin_handles[i].handle, "plugin_transform_paced");
+        plugin_capabilities_func_t capabilities = dlsym(plugin_handles[i].handle, "plugin_capabilities");
+        plugin_handles[i].capabilities = capabilities ? capabilities() : NULL;
+        plugin_handles[i].fused_into = -1;
+        plugin_handles[i].fused_count = 0;
+        plugin_instance_api_func_t instance_api = dlsym(plugin_handles[i].handle, "plugin_instance_api");
+        plugin_handles[i].api = instance_api ? instance_api() : &legacy_api;
+        plugin_handles[i].instance = NULL;
 
         if (!plugin_handles[i].init || !plugin_handles[i].fini || !plugin_handles[i].place_work || !plugin_handles[i].attach || !plugin_handles[i].wait_finished)
         {
@@ -213,7 +900,10 @@ int pipeline_init(char *pluginNamesRaw[], int queueSize)
             free(plugin_handles[i].name);
             for (int j = 0; j < i; j++)
             {
-                dlclose(plugin_handles[j].handle);
+                if (plugin_handles[j].handle)
+                {
+                    dlclose(plugin_handles[j].handle);
+                }
                 free(plugin_handles[j].name);
             }
             for (int j = 0; j < g_pluginCount; j++)
@@ -232,6 +922,36 @@ int pipeline_init(char *pluginNamesRaw[], int queueSize)
     }
     free(pluginNames);
 
+    // A legacy stage can only call the next plugin's default instance, which a built-in plugin doesn't have
+    for (int i = 1; i < g_pluginCount; i++)
+    {
+        if (plugin_handles[i - 1].api == &legacy_api)
+        {
+            if (!plugin_handles[i].handle)
+            {
+                fprintf(stderr, "Error: Built-in plugin %s can't follow %s, which doesn't support instances\n",
+                        plugin_handles[i].name, plugin_handles[i - 1].name);
+                pipeline_destroy();
+                return -1;
+            }
+            plugin_handles[i].api = &legacy_api;
+        }
+    }
+    // and a default instance can only be used once, dlopen hands out the same .so for every copy
+    for (int i = 0; i < g_pluginCount; i++)
+    {
+        for (int j = 0; j < i && plugin_handles[i].api == &legacy_api; j++)
+        {
+            if (plugin_handles[j].api == &legacy_api && plugin_handles[j].handle == plugin_handles[i].handle)
+            {
+                fprintf(stderr, "Error: Plugin %s appears more than once but doesn't support instances\n",
+                        plugin_handles[i].name);
+                pipeline_destroy();
+                return -1;
+            }
+        }
+    }
+
     return 0;
 }
 
@@ -294,10 +1014,23 @@ int pipeline_destroy(void)
 
 void print_Usage(const char *execLocation)
 {
-    printf("Usage: %s <queue_size> <plugin1> <plugin2> ... <pluginN>\n", execLocation);
+    printf("Usage: %s [--stats] [--fuse] [--pool] [--place] <queue_size> <plugin1> <plugin2> ... <pluginN>\n",
+           execLocation);
+    printf("       %s [--stats] [--fuse] [--pool] [--place] --config <file>\n", execLocation);
     printf("Arguments:\n");
+    printf("  --stats     Print every stage's queue counters to stderr at shutdown and at each <BARRIER>\n");
+    printf("  --fuse      Run each stage that can on the previous stage's thread, without a queue in between\n");
+    printf("  --pool      Run the stages as tasks on one worker thread per CPU instead of a thread each\n");
+    printf("  --place     Pin each stage thread to a CPU, neighbouring stages on neighbouring cores of one node\n");
     printf("  queue_size  Maximum number of items in each plugin's queue\n");
     printf("  plugin1..N  Names of plugins to load (without .so extension)\n");
+    printf("  --config    Pipeline description file, one stage per line:\n");
+    printf("                <plugin> queue=<size> [replicas=<n>|auto] [fuse=yes|no] [<option>=<value> ...]\n");
+    printf("              options: wait=block|spin|adaptive|poll spin=<rounds>\n");
+    printf("                       overflow=block|drop_oldest|drop_newest|sample sample=<n>\n");
+    printf("                       batch=<1..64> cpu=<cpu>[,<cpu>...] inline=<bytes>\n");
+    printf("                       sched=pool|thread (under --pool) inflight=<1..4096> (paced plugins)\n");
+    printf("              with replicas: order=ordered|unordered window=<items>\n");
     printf("\n");
     printf("Available plugins:\n");
     printf("  logger      - Logs all strings that pass through\n");
@@ -306,9 +1039,14 @@ void print_Usage(const char *execLocation)
     printf("  rotator     - Move every character to the right. Last character moves to the beginning.\n");
     printf("  flipper     - Reverses the order of characters\n");
     printf("  expander    - Expands each character with spaces\n");
+    printf("  ratelimiter - Passes lines on within a budget: rate=<lines/s> bytes=<bytes/s> burst=<lines>\n");
+    printf("                burst_bytes=<bytes> mode=block|drop|delay (in --config)\n");
     printf("\n");
     printf("Example:\n");
     printf("  %s 20 uppercaser rotator logger\n", execLocation);
     printf("  echo 'hello' | %s 20 uppercaser rotator logger\n", execLocation);
     printf("  echo '<END>' | %s 20 uppercaser rotator logger\n", execLocation);
+    printf("\n");
+    printf("Input lines <END>, <FLUSH> and <BARRIER> end the stream, push held back output out\n");
+    printf("and wait for every stage to take a consistent snapshot of its counters.\n");
 }
\ No newline at end of file
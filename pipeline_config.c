@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pipeline_config.h"
+
+// Parses a positive integer, returns -1 if value isn't one
+static int parse_positive(const char *value)
+{
+    char *end;
+    long parsed = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || parsed <= 0 || parsed > 0x7fffffff)
+    {
+        return -1;
+    }
+    return (int)parsed;
+}
+
+static void free_stage(pipeline_stage_t *stage)
+{
+    free(stage->plugin);
+    for (int i = 0; i < stage->option_count; i++)
+    {
+        free(stage->options[i].key);
+        free(stage->options[i].value);
+    }
+    stage->plugin = NULL;
+    stage->option_count = 0;
+}
+
+// Adds a zeroed stage at the end of the config, returns NULL if out of memory
+static pipeline_stage_t *add_stage(pipeline_config_t *config, const char *plugin)
+{
+    pipeline_stage_t *stages = realloc(config->stages, (config->stage_count + 1) * sizeof(pipeline_stage_t));
+    if (!stages)
+    {
+        return NULL;
+    }
+    config->stages = stages;
+
+    pipeline_stage_t *stage = &stages[config->stage_count];
+    memset(stage, 0, sizeof(*stage));
+    stage->plugin = strdup(plugin);
+    if (!stage->plugin)
+    {
+        return NULL;
+    }
+    stage->replicas = 1;
+    stage->fuse = -1;
+    config->stage_count++;
+    return stage;
+}
+
+// Applies one key=value word of a stage line
+static const char *parse_setting(pipeline_stage_t *stage, char *word)
+{
+    char *equals = strchr(word, '=');
+    if (!equals || equals == word || equals[1] == '\0')
+    {
+        return "Expected key=value";
+    }
+    *equals = '\0';
+    const char *key = word;
+    const char *value = equals + 1;
+
+    if (strcmp(key, "queue") == 0)
+    {
+        stage->queue_size = parse_positive(value);
+        return stage->queue_size > 0 ? NULL : "queue must be a positive integer";
+    }
+    if (strcmp(key, "replicas") == 0)
+    {
+        stage->replicas = strcmp(value, "auto") == 0 ? 0 : parse_positive(value);
+        return stage->replicas >= 0 ? NULL : "replicas must be a positive integer or auto";
+    }
+    if (strcmp(key, "fuse") == 0)
+    {
+        stage->fuse = strcmp(value, "yes") == 0 ? 1 : strcmp(value, "no") == 0 ? 0 : -2;
+        return stage->fuse != -2 ? NULL : "fuse must be yes or no";
+    }
+
+    // Anything else is a plugin option
+    if (stage->option_count >= PIPELINE_CONFIG_MAX_OPTIONS)
+    {
+        return "Too many options for one stage";
+    }
+    pipeline_option_t *option = &stage->options[stage->option_count];
+    option->key = strdup(key);
+    option->value = strdup(value);
+    if (!option->key || !option->value)
+    {
+        free(option->key);
+        free(option->value);
+        return "Memory allocation failed";
+    }
+    stage->option_count++;
+    return NULL;
+}
+
+// Parses one line, blank and comment lines add nothing
+static const char *parse_line(pipeline_config_t *config, char *line)
+{
+    char *comment = strchr(line, '#');
+    if (comment)
+    {
+        *comment = '\0';
+    }
+
+    char *save = NULL;
+    char *word = strtok_r(line, " \t\r\n", &save);
+    if (!word)
+    {
+        return NULL;
+    }
+    if (strchr(word, '='))
+    {
+        return "Line must start with a plugin name";
+    }
+
+    pipeline_stage_t *stage = add_stage(config, word);
+    if (!stage)
+    {
+        return "Memory allocation failed";
+    }
+
+    while ((word = strtok_r(NULL, " \t\r\n", &save)) != NULL)
+    {
+        const char *error = parse_setting(stage, word);
+        if (error)
+        {
+            return error;
+        }
+    }
+
+    if (stage->queue_size <= 0)
+    {
+        return "Stage is missing queue=<size>";
+    }
+    return NULL;
+}
+
+const char *pipeline_config_load(pipeline_config_t *config, const char *path, int *error_line)
+{
+    if (!config || !path || !error_line)
+    {
+        return "NULL argument";
+    }
+    config->stages = NULL;
+    config->stage_count = 0;
+    *error_line = 0;
+
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        return "Can't open config file";
+    }
+
+    char line[PIPELINE_CONFIG_LINE_LENGTH];
+    int line_number = 0;
+    const char *error = NULL;
+    while (!error && fgets(line, sizeof(line), file))
+    {
+        line_number++;
+        if (strchr(line, '\n') == NULL && !feof(file))
+        {
+            error = "Line too long";
+            break;
+        }
+        error = parse_line(config, line);
+    }
+    fclose(file);
+
+    if (error)
+    {
+        *error_line = line_number;
+    }
+    else if (config->stage_count == 0)
+    {
+        error = "No stages in config file";
+    }
+    if (error)
+    {
+        pipeline_config_free(config);
+    }
+    return error;
+}
+
+const char *pipeline_config_from_args(pipeline_config_t *config, char *plugin_names[], int count, int queue_size)
+{
+    if (!config || !plugin_names || count <= 0 || queue_size <= 0)
+    {
+        return "Invalid arguments";
+    }
+    config->stages = NULL;
+    config->stage_count = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        pipeline_stage_t *stage = add_stage(config, plugin_names[i]);
+        if (!stage)
+        {
+            pipeline_config_free(config);
+            return "Memory allocation failed";
+        }
+        stage->queue_size = queue_size;
+    }
+    return NULL;
+}
+
+void pipeline_config_free(pipeline_config_t *config)
+{
+    if (!config)
+    {
+        return;
+    }
+    for (int i = 0; i < config->stage_count; i++)
+    {
+        free_stage(&config->stages[i]);
+    }
+    free(config->stages);
+    config->stages = NULL;
+    config->stage_count = 0;
+}
@@ -0,0 +1,81 @@
+#ifndef PIPELINE_CONFIG_H_
+#define PIPELINE_CONFIG_H_
+
+#define PIPELINE_CONFIG_MAX_OPTIONS 16 /* Plugin options per stage */
+#define PIPELINE_CONFIG_LINE_LENGTH 1024
+
+/*
+ * Pipeline description file, loaded by analyzer --config. One stage per
+ * line, in pipeline order:
+ *
+ *   # comment
+ *   uppercaser queue=64 wait=spin batch=32 cpu=2 inline=64
+ *   flipper    queue=64 replicas=4
+ *   rotator    queue=64 fuse=yes
+ *   typewriter queue=4096 overflow=drop_oldest
+ *   logger     queue=256
+ *
+ * The first word names the plugin (without .so). queue (required),
+ * replicas and fuse are read by the host; every other key=value is handed to the
+ * plugin's plugin_set_option, which rejects keys it doesn't know. A stage
+ * with replicas > 1 runs that many worker threads and still hands its
+ * outputs on in input order unless it is given order=unordered;
+ * replicas=auto lets the host choose from the plugin's capabilities. fuse=yes
+ * runs the stage's transform on the previous stage's thread instead of
+ * behind its own queue, fuse=no keeps it apart even under analyzer --fuse.
+ */
+
+/**
+ * A key=value pair passed to plugin_set_option
+ */
+typedef struct
+{
+    char *key;
+    char *value;
+} pipeline_option_t;
+
+/**
+ * One stage of the pipeline
+ */
+typedef struct
+{
+    char *plugin;   /* Plugin name, without the .so extension */
+    int queue_size; /* Capacity of the stage's input queue */
+    int replicas;   /* Copies of the stage working in parallel, 0 for auto */
+    int fuse;       /* 1 or 0 as set by fuse=yes|no, -1 leaves it to analyzer --fuse */
+    pipeline_option_t options[PIPELINE_CONFIG_MAX_OPTIONS];
+    int option_count;
+} pipeline_stage_t;
+
+typedef struct
+{
+    pipeline_stage_t *stages; /* In pipeline order */
+    int stage_count;
+} pipeline_config_t;
+
+/**
+ * Load a pipeline description file
+ * @param config Filled in on success, release with pipeline_config_free
+ * @param path Path of the file
+ * @param error_line Set to the offending line number on a parse error, 0 otherwise
+ * @return NULL on success, error message on failure
+ */
+const char *pipeline_config_load(pipeline_config_t *config, const char *path, int *error_line);
+
+/**
+ * Describe the classic command line pipeline: every stage gets the same queue size
+ * @param config Filled in on success, release with pipeline_config_free
+ * @param plugin_names Plugin names in pipeline order
+ * @param count Number of plugins
+ * @param queue_size Queue size of every stage
+ * @return NULL on success, error message on failure
+ */
+const char *pipeline_config_from_args(pipeline_config_t *config, char *plugin_names[], int count, int queue_size);
+
+/**
+ * Free everything a pipeline_config_t owns
+ * @param config Pointer to config structure
+ */
+void pipeline_config_free(pipeline_config_t *config);
+
+#endif
@@ -4,36 +4,62 @@
 #include <stdlib.h>
 #include <string.h>
 
-const char *plugin_transform(const char *input)
+// Writes input with a space between every two characters into output, which holds 2 * length bytes
+static size_t expand(const char *input, size_t length, char *output)
 {
-    int length = strlen(input);
-    if (length == 0)
+    size_t j = 0;
+    for (size_t i = 0; i < length; i++)
     {
-        char *output = malloc(1);
-        if (output)
-            output[0] = '\0';
-        return output;
+        output[j++] = input[i];
+        if (i != length - 1)
+        {
+            output[j++] = ' ';
+        }
     }
+    output[j] = '\0';
+    return j;
+}
 
-    int output_size = length + (length - 1) + 1;
-    char *output = malloc(output_size);
+int plugin_transform_message(message_t *message)
+{
+    if (message->len == 0)
+    {
+        return 0;
+    }
+    size_t cap;
+    char *output = message_buffer_alloc(2 * message->len, &cap);
+    if (!output)
+        return -1;
 
+    message_replace_buffer(message, output, expand(message->data, message->len, output), cap);
+    return 0;
+}
+
+const char *plugin_transform(const char *input)
+{
+    size_t length = strlen(input);
+    char *output = malloc(length == 0 ? 1 : 2 * length);
     if (!output)
         return NULL;
 
-    int j = 0;
-    for (int i = 0; i < length; i++)
+    if (length == 0)
     {
-        output[j++] = input[i];
-        if (i != length - 1)
-        {
-            output[j++] = ' ';
-        }
+        output[0] = '\0';
+        return output;
     }
-    output[j] = '\0';
+    expand(input, length, output);
     return output;
 }
 
+const plugin_capabilities_t *plugin_capabilities(void)
+{
+    static const plugin_capabilities_t capabilities = {
+        PLUGIN_CAP_STATELESS | PLUGIN_CAP_THREAD_SAFE,
+        PLUGIN_COST_CHEAP,
+    };
+    return &capabilities;
+}
+
 __attribute__((visibility("default")))
 const char *
 plugin_init(int queue_size)
@@ -3,24 +3,37 @@
 #include <stdio.h>
 #include <string.h>
 
+int plugin_transform_inplace(char *buf, size_t len)
+{
+    char temp;
+    for (size_t i = 0; i < len / 2; i++)
+    {
+        temp = buf[i];
+        buf[i] = buf[len - 1 - i];
+        buf[len - 1 - i] = temp;
+    }
+    return 0;
+}
+
 const char *plugin_transform(const char *input)
 {
     char *output = strdup(input);
     if (!output)
         return NULL;
 
-    int length = strlen(output);
-    char temp;
-    for (int i = 0; i < length / 2; i++)
-    {
-        temp = output[i];
-        output[i] = output[length - 1 - i];
-        output[length - 1 - i] = temp;
-    }
-
+    plugin_transform_inplace(output, strlen(output));
     return output;
 }
 
+const plugin_capabilities_t *plugin_capabilities(void)
+{
+    static const plugin_capabilities_t capabilities = {
+        PLUGIN_CAP_STATELESS | PLUGIN_CAP_THREAD_SAFE | PLUGIN_CAP_LENGTH_PRESERVING | PLUGIN_CAP_INPLACE,
+        PLUGIN_COST_CHEAP,
+    };
+    return &capabilities;
+}
+
 __attribute__((visibility("default")))
 const char *
 plugin_init(int queue_size)
@@ -3,6 +3,15 @@
 #include <stdio.h>
 #include <string.h>
 
+int plugin_transform_message(message_t *message)
+{
+    // The length is known, so the line is written without scanning it again
+    fputs("[logger] ", stdout);
+    fwrite(message->data, 1, message->len, stdout);
+    putchar('\n');
+    return 0;
+}
+
 const char *plugin_transform(const char *input)
 {
     char *output = strdup(input);
@@ -12,6 +21,17 @@ const char *plugin_transform(const char *input)
 
     return output;
 }
+
+const plugin_capabilities_t *plugin_capabilities(void)
+{
+    // Its lines would interleave if it printed from several threads
+    static const plugin_capabilities_t capabilities = {
+        PLUGIN_CAP_STATELESS | PLUGIN_CAP_LENGTH_PRESERVING | PLUGIN_CAP_OBSERVER,
+        PLUGIN_COST_CHEAP,
+    };
+    return &capabilities;
+}
+
 __attribute__((visibility("default")))
 const char *
 plugin_init(int queue_size)
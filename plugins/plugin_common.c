@@ -1,81 +1,1739 @@
+#define _GNU_SOURCE // pthread_setaffinity_np, dladdr
 #include "plugin_common.h"
 
+#include "plugin_sdk.h"
+#include "sync/topology.h"
+
+#include <dlfcn.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <stddef.h>
 #include <string.h>
+#include <time.h>
 
+// The instance the legacy plugin_* exports work on
 static plugin_context_t plugin_context;
 
-void *plugin_consumer_thread(void *arg)
+// Instance that common_plugin_init fills, set while plugin_init runs for the instance API
+static __thread plugin_context_t *init_target = NULL;
+// Transforms of a plugin built into the host, which can't be found by symbol name
+static __thread const plugin_transforms_t *init_transforms = NULL;
+// Its state and option exports, likewise
+static __thread const plugin_hooks_t *init_hooks = NULL;
+
+// Hands a batch of transformed messages to the next plugin. They are moved
+// downstream when it accepts ownership, otherwise copied there and released.
+static void forward_outputs(plugin_context_t *context, message_t *outputs, int count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    const plugin_sink_t *next = &context->next;
+    if (next->place_messages != NULL)
+    {
+        const char *error = next->place_messages(next->instance, outputs, count);
+        if (error != NULL)
+        {
+            log_error(context, error);
+        }
+        return;
+    }
+    if (next->place_work_batch != NULL)
+    {
+        char *strings[PLUGIN_BATCH_MAX];
+        for (int i = 0; i < count; i++)
+        {
+            strings[i] = outputs[i].data;
+        }
+        const char *error = next->place_work_batch(next->instance, strings, count);
+        if (error != NULL)
+        {
+            log_error(context, error);
+        }
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const char *error = NULL;
+        if (next->place_work_owned != NULL)
+        {
+            error = next->place_work_owned(next->instance, outputs[i].data);
+        }
+        else
+        {
+            if (next->place_work != NULL)
+            {
+                error = next->place_work(next->instance, outputs[i].data);
+            }
+            message_release(&outputs[i]);
+        }
+        if (error != NULL)
+        {
+            log_error(context, error);
+        }
+    }
+}
+
+static unsigned long clock_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)now.tv_sec * 1000000000UL + (unsigned long)now.tv_nsec;
+}
+
+// Runs one transform on a message, through whichever signature the plugin offers
+static int apply_transform(const plugin_transforms_t *transforms, message_t *message)
+{
+    if (transforms->message != NULL)
+    {
+        return transforms->message(message);
+    }
+    if (transforms->inplace != NULL)
+    {
+        return transforms->inplace(message->data, message->len);
+    }
+
+    // A plain string transform: the length of its output is unknown
+    char *output = (char *)transforms->transform(message->data); // Transforms return heap strings we now own
+    if (output == NULL)
+    {
+        return -1;
+    }
+    message_replace(message, output, strlen(output));
+    return 0;
+}
+
+// Buffers a stage thread packs a round into for batch transforms, grown as needed
+typedef struct batch_arena
+{
+    char *input;
+    size_t input_cap;
+    char *output;
+    size_t output_cap;
+    size_t offsets[PLUGIN_BATCH_MAX + 1];
+    size_t output_offsets[PLUGIN_BATCH_MAX + 1];
+} batch_arena_t;
+
+// Makes *buffer hold at least size bytes, returns -1 if out of memory
+static int reserve(char **buffer, size_t *cap, size_t size)
+{
+    if (size <= *cap)
+    {
+        return 0;
+    }
+    size_t grown = *cap ? *cap : 4096;
+    while (grown < size)
+    {
+        grown *= 2;
+    }
+    char *resized = realloc(*buffer, grown);
+    if (!resized)
+    {
+        return -1;
+    }
+    *buffer = resized;
+    *cap = grown;
+    return 0;
+}
+
+// A message that still has data to transform
+static int message_live(const message_t *message)
+{
+    return !(message->flags & MESSAGE_CONTROL) && message->data != NULL;
+}
+
+// Runs a batch transform over the live messages: their data is packed into
+// the arena, transformed in one call and copied back, into the message's
+// own buffer when it fits. Returns -1 if the transform failed.
+static int apply_batch(plugin_transform_batch_t batch, batch_arena_t *arena, message_t *messages, int count)
+{
+    int live[PLUGIN_BATCH_MAX];
+    int n = 0;
+    size_t total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (message_live(&messages[i]))
+        {
+            live[n++] = i;
+            total += messages[i].len;
+        }
+    }
+    if (n == 0)
+    {
+        return 0;
+    }
+    if (reserve(&arena->input, &arena->input_cap, total) != 0 ||
+        reserve(&arena->output, &arena->output_cap, total) != 0)
+    {
+        return -1;
+    }
+
+    arena->offsets[0] = 0;
+    for (int k = 0; k < n; k++)
+    {
+        const message_t *message = &messages[live[k]];
+        memcpy(arena->input + arena->offsets[k], message->data, message->len);
+        arena->offsets[k + 1] = arena->offsets[k] + message->len;
+    }
+
+    long needed = batch(arena->input, arena->offsets, n, arena->output, arena->output_cap, arena->output_offsets);
+    if (needed > (long)arena->output_cap)
+    {
+        // The outputs are longer than the inputs, run again with room for them
+        if (reserve(&arena->output, &arena->output_cap, (size_t)needed) != 0)
+        {
+            return -1;
+        }
+        needed = batch(arena->input, arena->offsets, n, arena->output, arena->output_cap, arena->output_offsets);
+    }
+    if (needed < 0 || needed > (long)arena->output_cap)
+    {
+        return -1;
+    }
+
+    for (int k = 0; k < n; k++)
+    {
+        message_t *message = &messages[live[k]];
+        size_t len = arena->output_offsets[k + 1] - arena->output_offsets[k];
+        char *data = message->data;
+        size_t cap = message->cap;
+        if (len + 1 > cap)
+        {
+            data = message_buffer_alloc(len + 1, &cap);
+            if (!data)
+            {
+                return -1;
+            }
+        }
+        memcpy(data, arena->output + arena->output_offsets[k], len);
+        data[len] = '\0';
+        message_replace_buffer(message, data, len, cap);
+    }
+    return 0;
+}
+
+// Runs the stage's transforms from first on (0 is its own, the ones fused
+// after it follow) over a round of messages we own, leaving control
+// messages alone. A message whose transform fails is released, so its data
+// is NULL afterwards. Each transform is timed while anything is fused.
+static void run_transforms(plugin_context_t *context, batch_arena_t *arena, message_t *messages, int count, int first)
+{
+    for (int t = first; t <= context->fused_count; t++)
+    {
+        const plugin_transforms_t *transforms = &context->transforms[t];
+        unsigned long start = context->fused_count > 0 ? clock_ns() : 0;
+        unsigned long calls = 0;
+
+        // A transform that rewrites each message where it is beats packing the round into the arena and back
+        if (transforms->batch != NULL && transforms->message == NULL && transforms->inplace == NULL)
+        {
+            calls = 1;
+            if (apply_batch(transforms->batch, arena, messages, count) != 0)
+            {
+                for (int i = 0; i < count; i++)
+                {
+                    if (message_live(&messages[i]))
+                    {
+                        message_release(&messages[i]);
+                        log_error(context, "Transformation of input failed");
+                    }
+                }
+            }
+        }
+        else
+        {
+            for (int i = 0; i < count; i++)
+            {
+                if (!message_live(&messages[i]))
+                {
+                    continue;
+                }
+                calls++;
+                if (apply_transform(transforms, &messages[i]) != 0)
+                {
+                    message_release(&messages[i]);
+                    log_error(context, "Transformation of input failed");
+                }
+            }
+        }
+
+        if (context->fused_count > 0)
+        {
+            atomic_fetch_add_explicit(&context->transform_ns[t], clock_ns() - start, memory_order_relaxed);
+            atomic_fetch_add_explicit(&context->transform_calls[t], calls, memory_order_relaxed);
+        }
+    }
+}
+
+static const char *context_get_stats(plugin_context_t *context, consumer_producer_stats_t *stats);
+
+// Acts on a control message and hands it downstream, once everything that
+// came before it went out. BARRIER records the stage's counters for
+// wait_barrier, FLUSH pushes the last stage's output out of stdio's buffer.
+static void pass_control(plugin_context_t *context, unsigned int flags)
+{
+    if (flags & (MESSAGE_BARRIER | MESSAGE_END))
+    {
+        pthread_mutex_lock(&context->barrier_lock);
+        if (flags & MESSAGE_BARRIER)
+        {
+            context_get_stats(context, &context->barrier_stats);
+            context->barriers++;
+        }
+        if (flags & MESSAGE_END)
+        {
+            context->stream_ended = 1;
+        }
+        pthread_cond_broadcast(&context->barrier_passed);
+        pthread_mutex_unlock(&context->barrier_lock);
+    }
+    if ((flags & MESSAGE_FLUSH) && context->next.place_work == NULL)
+    {
+        fflush(stdout);
+    }
+
+    const plugin_sink_t *next = &context->next;
+    const char *error = NULL;
+    if (next->place_control != NULL)
+    {
+        error = next->place_control(next->instance, flags);
+    }
+    else if ((flags & MESSAGE_END) && next->place_work != NULL)
+    {
+        error = next->place_work(next->instance, "<END>"); // A sink that only takes strings only learns of the end
+    }
+    if (error != NULL)
+    {
+        log_error(context, error);
+    }
+}
+
+// An optional export of the plugin, looked up in the .so that process_function lives in
+static void *find_plugin_symbol(const char *(*process_function)(const char *), const char *symbol)
+{
+    Dl_info info;
+    if (dladdr((void *)process_function, &info) == 0 || info.dli_fname == NULL)
+    {
+        return NULL;
+    }
+    void *handle = dlopen(info.dli_fname, RTLD_LAZY | RTLD_NOLOAD);
+    if (!handle)
+    {
+        return NULL;
+    }
+    void *address = dlsym(handle, symbol);
+    dlclose(handle); // Only drops the reference NOLOAD took, the .so stays loaded
+    return address;
+}
+
+// Transforms a round of inputs taken from the queue and hands the outputs
+// and control messages on in order. Returns 1 if the round ended the stream
+static int process_round(plugin_context_t *context, batch_arena_t *arena, message_t *inputs, int count)
+{
+    message_t outputs[PLUGIN_BATCH_MAX];
+
+    // Nothing is processed after <END>
+    int end_reached = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (end_reached)
+        {
+            message_release(&inputs[i]);
+        }
+        else if (inputs[i].flags & MESSAGE_END)
+        {
+            end_reached = 1;
+            count = i + 1;
+        }
+    }
+
+    run_transforms(context, arena, inputs, count, 0);
+
+    int produced = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (inputs[i].flags & MESSAGE_CONTROL)
+        {
+            // Whatever came before it goes out first
+            unsigned int flags = inputs[i].flags & MESSAGE_CONTROL;
+            message_release(&inputs[i]);
+            forward_outputs(context, outputs, produced);
+            produced = 0;
+            pass_control(context, flags);
+            continue;
+        }
+        if (inputs[i].data != NULL) // Its transform failed otherwise
+        {
+            outputs[produced++] = inputs[i];
+        }
+    }
+
+    forward_outputs(context, outputs, produced);
+
+    if (end_reached)
+    {
+        consumer_producer_signal_finished(context->queue);
+        context->finished = 1;
+    }
+    return end_reached;
+}
+
+/*
+ * Paced stages. A plugin that exports plugin_transform_paced says how long
+ * to wait before each step of a message instead of sleeping, so the stage
+ * holds up to inflight messages at once, each waiting for its next step.
+ */
+
+// A message a paced stage holds between its steps
+typedef struct paced_slot
+{
+    message_t message;
+    unsigned long due_ns; // When its next step is due
+    unsigned int step;    // Steps taken so far
+    int done;             // No step left, it waits for the ones ahead of it
+} paced_slot_t;
+
+static void paced_step(plugin_context_t *context, paced_slot_t *slot, unsigned long now)
+{
+    long delay = context->transforms[0].paced(context->state, &slot->message, slot->step++);
+    if (context->fused_count > 0)
+    {
+        atomic_fetch_add_explicit(&context->transform_ns[0], clock_ns() - now, memory_order_relaxed);
+        atomic_fetch_add_explicit(&context->transform_calls[0], 1, memory_order_relaxed);
+    }
+    if (delay > 0)
+    {
+        slot->due_ns = now + (unsigned long)delay * 1000UL;
+        return;
+    }
+    if (delay < 0)
+    {
+        message_release(&slot->message);
+        log_error(context, "Transformation of input failed");
+    }
+    slot->done = 1;
+}
+
+// Takes in inputs the ring has room for, running each one's first step.
+// Control messages keep their place in line; nothing after <END> is taken
+static void paced_admit(plugin_context_t *context, message_t *inputs, int count)
+{
+    int inflight = atomic_load(&context->inflight);
+    unsigned long now = clock_ns();
+    for (int i = 0; i < count; i++)
+    {
+        if (context->paced_ended)
+        {
+            message_release(&inputs[i]);
+            continue;
+        }
+        paced_slot_t *slot = &context->paced[(context->paced_head + context->paced_count++) % inflight];
+        slot->message = inputs[i];
+        slot->step = 0;
+        slot->done = (inputs[i].flags & MESSAGE_CONTROL) != 0;
+        context->paced_ended = (inputs[i].flags & MESSAGE_END) != 0;
+        if (!slot->done)
+        {
+            paced_step(context, slot, now);
+        }
+    }
+}
+
+// Takes every step that is due, then forwards the done messages at the
+// front of the ring. Returns when the next step is due, 0 if none waits
+static unsigned long paced_advance(plugin_context_t *context, batch_arena_t *arena)
+{
+    int inflight = atomic_load(&context->inflight);
+    unsigned long now = clock_ns();
+    unsigned long next_due = 0;
+    for (int i = 0; i < context->paced_count; i++)
+    {
+        paced_slot_t *slot = &context->paced[(context->paced_head + i) % inflight];
+        if (!slot->done && slot->due_ns <= now)
+        {
+            paced_step(context, slot, now);
+        }
+        if (!slot->done && (next_due == 0 || slot->due_ns < next_due))
+        {
+            next_due = slot->due_ns;
+        }
+    }
+
+    message_t outputs[PLUGIN_BATCH_MAX];
+    int produced = 0;
+    while (context->paced_count > 0 && context->paced[context->paced_head].done)
+    {
+        message_t message = context->paced[context->paced_head].message;
+        context->paced_head = (context->paced_head + 1) % inflight;
+        context->paced_count--;
+        if (message.flags & MESSAGE_CONTROL)
+        {
+            // Whatever came before it goes out first
+            unsigned int flags = message.flags & MESSAGE_CONTROL;
+            message_release(&message);
+            forward_outputs(context, outputs, produced);
+            produced = 0;
+            pass_control(context, flags);
+            if (flags & MESSAGE_END)
+            {
+                consumer_producer_signal_finished(context->queue);
+                context->finished = 1;
+            }
+            continue;
+        }
+        if (message.data != NULL && context->fused_count > 0)
+        {
+            run_transforms(context, arena, &message, 1, 1); // The stages fused after ours run once it is done
+        }
+        if (message.data == NULL)
+        {
+            continue; // Its transform failed or dropped it
+        }
+        outputs[produced++] = message;
+        if (produced == PLUGIN_BATCH_MAX)
+        {
+            forward_outputs(context, outputs, produced);
+            produced = 0;
+        }
+    }
+    forward_outputs(context, outputs, produced);
+    return next_due;
+}
+
+// Consumer thread of a paced stage: takes inputs while the ring has room,
+// waiting for them no longer than until the next step is due
+static void paced_consumer_loop(plugin_context_t *context, batch_arena_t *arena)
+{
+    message_t inputs[PLUGIN_BATCH_MAX];
+    while (!context->finished)
+    {
+        unsigned long due = paced_advance(context, arena);
+        if (context->finished)
+        {
+            break;
+        }
+        struct timespec deadline = {(time_t)(due / 1000000000UL), (long)(due % 1000000000UL)};
+        int room = atomic_load(&context->inflight) - context->paced_count;
+        if (context->paced_ended || room == 0)
+        {
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL); // Something waits for a step
+            continue;
+        }
+        int batch = atomic_load(&context->batch_size);
+        int count = consumer_producer_get_messages_until(context->queue, inputs, room < batch ? room : batch,
+                                                         due ? &deadline : NULL);
+        if (count < 0)
+        {
+            context->finished = 1;
+            break;
+        }
+        paced_admit(context, inputs, count);
+    }
+}
+
+// A paced stage run by the scheduler arms paced_timer for its next step and returns
+static int paced_stage_task(plugin_context_t *context)
+{
+    message_t inputs[PLUGIN_BATCH_MAX];
+    if (context->finished)
+    {
+        return 0;
+    }
+    unsigned long due = paced_advance(context, context->task_arena);
+    int room = atomic_load(&context->inflight) - context->paced_count;
+    if (!context->finished && !context->paced_ended && room > 0)
+    {
+        int batch = atomic_load(&context->batch_size);
+        int count = consumer_producer_try_get_messages(context->queue, inputs, room < batch ? room : batch);
+        if (count > 0)
+        {
+            paced_admit(context, inputs, count);
+            return 1; // Run again for the steps that are due and the inputs that wait
+        }
+    }
+    // A stage being finalized without <END> isn't woken any more
+    if (!context->finished && due != 0 && !atomic_load(&context->queue->finished))
+    {
+        timer_wheel_schedule(&context->paced_timer, due);
+    }
+    return 0;
+}
+
+static void paced_timer_fire(timer_wheel_timer_t *timer)
+{
+    plugin_context_t *context = (plugin_context_t *)((char *)timer - offsetof(plugin_context_t, paced_timer));
+    scheduler_wake(&context->task);
+}
+
+// Releases what a paced stage still holds and its ring
+static void free_paced(plugin_context_t *context)
+{
+    int inflight = atomic_load(&context->inflight);
+    for (int i = 0; i < context->paced_count; i++)
+    {
+        message_release(&context->paced[(context->paced_head + i) % inflight].message);
+    }
+    free(context->paced);
+    context->paced = NULL;
+    context->paced_count = 0;
+}
+
+void *plugin_consumer_thread(void *arg)
+{
+
+    plugin_context_t *context = (plugin_context_t *)arg;
+    context->initialized = 1;
+
+    if (!context || !context->queue || !context->transforms[0].transform)
+    {
+        return NULL;
+    }
+
+    message_t inputs[PLUGIN_BATCH_MAX];
+    batch_arena_t arena = {0};
+
+    if (context->transforms[0].paced)
+    {
+        paced_consumer_loop(context, &arena);
+    }
+    while (!context->finished)
+    {
+        // Drain everything queued so far in one round; waits if the queue is empty
+        int count = consumer_producer_get_messages(context->queue, inputs, atomic_load(&context->batch_size));
+
+        if (count == 0)
+        {
+            context->finished = 1;
+            break; // Consumer_producer_get_batch will return 0 only when finished signal was recived
+        }
+
+        process_round(context, &arena, inputs, count);
+    }
+
+    free(arena.input);
+    free(arena.output);
+    return NULL;
+}
+
+// A stage on the scheduler's workers (analyzer --pool): woken by every put
+// into its queue, it runs what is queued and returns instead of waiting.
+// After PLUGIN_TASK_ROUNDS rounds it lets the worker run the stages its
+// outputs went to, and is run again after them.
+static int plugin_stage_task(scheduler_task_t *task)
+{
+    plugin_context_t *context = (plugin_context_t *)((char *)task - offsetof(plugin_context_t, task));
+    message_t inputs[PLUGIN_BATCH_MAX];
+
+    if (context->transforms[0].paced)
+    {
+        return paced_stage_task(context);
+    }
+    for (int round = 0; round < PLUGIN_TASK_ROUNDS; round++)
+    {
+        if (context->finished)
+        {
+            return 0;
+        }
+        int count = consumer_producer_try_get_messages(context->queue, inputs, atomic_load(&context->batch_size));
+        if (count <= 0)
+        {
+            return 0; // Woken again by the next put
+        }
+        if (process_round(context, context->task_arena, inputs, count))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void free_task_arena(plugin_context_t *context)
+{
+    free(context->task_arena->input);
+    free(context->task_arena->output);
+    free(context->task_arena);
+    context->task_arena = NULL;
+}
+
+/*
+ * Replicated stages. Items are dealt round-robin to the workers, so worker w
+ * sees items w, w + replicas, w + 2 * replicas, ... and knows every item's
+ * sequence number without it being stored anywhere. Workers put their
+ * outputs into the reorder buffer, and whoever fills the slot of next_emit
+ * forwards the run of ready outputs that starts there. Reorder slots are
+ * messages, marked with the flags below.
+ */
+
+#define SLOT_FILLED 0x100u // The worker for this sequence number is done with it
+#define SLOT_SKIP 0x200u   // Its transform failed, nothing goes downstream
+
+// One replica of a stage: its input queue and thread
+typedef struct plugin_worker
+{
+    plugin_context_t *context;
+    consumer_producer_t *queue;
+    pthread_t thread;
+    int index;
+} plugin_worker_t;
+
+// Sends <END> downstream once everything before it went out. Called with emit_lock held
+static void forward_end(plugin_context_t *context)
+{
+    pass_control(context, MESSAGE_END);
+    context->finished = 1;
+    monitor_signal(&context->done);
+}
+
+// Forwards the outputs that are ready, starting at next_emit. Called with emit_lock held
+static void drain_reorder(plugin_context_t *context)
+{
+    message_t ready[PLUGIN_BATCH_MAX];
+    int count = 0;
+    unsigned long start = context->next_emit;
+    message_t *slot;
+
+    while ((slot = &context->reorder[context->next_emit % context->window])->flags & SLOT_FILLED)
+    {
+        message_t output = *slot;
+        slot->flags = 0;
+        context->next_emit++;
+
+        if (output.flags & SLOT_SKIP)
+        {
+            continue;
+        }
+        if (output.flags & MESSAGE_CONTROL)
+        {
+            forward_outputs(context, ready, count);
+            count = 0;
+            if (output.flags & MESSAGE_END)
+            {
+                forward_end(context);
+            }
+            else
+            {
+                pass_control(context, output.flags & MESSAGE_CONTROL);
+            }
+            continue;
+        }
+        output.flags &= ~SLOT_FILLED;
+        ready[count++] = output;
+        if (count == PLUGIN_BATCH_MAX)
+        {
+            forward_outputs(context, ready, count);
+            count = 0;
+        }
+    }
+    forward_outputs(context, ready, count);
+
+    if (context->next_emit != start)
+    {
+        pthread_cond_broadcast(&context->window_open);
+    }
+}
+
+// Hands over a worker's outputs for the items seq, seq + replicas, ...
+static void emit_outputs(plugin_context_t *context, message_t *outputs, int count, unsigned long seq)
+{
+    pthread_mutex_lock(&context->emit_lock);
+
+    if (!context->ordered)
+    {
+        // <END> is sent by the last worker to exit. Any other control message
+        // only follows what its own worker did before it
+        int ready = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (outputs[i].flags & (MESSAGE_FLUSH | MESSAGE_BARRIER))
+            {
+                forward_outputs(context, outputs, ready);
+                ready = 0;
+                pass_control(context, outputs[i].flags & MESSAGE_CONTROL);
+            }
+            else if (!(outputs[i].flags & (MESSAGE_END | SLOT_SKIP)))
+            {
+                outputs[ready++] = outputs[i];
+            }
+        }
+        forward_outputs(context, outputs, ready);
+        pthread_mutex_unlock(&context->emit_lock);
+        return;
+    }
+
+    for (int i = 0; i < count; i++, seq += context->replicas)
+    {
+        // A worker a whole window ahead of the slowest one waits for it
+        while (seq >= context->next_emit + context->window)
+        {
+            pthread_cond_wait(&context->window_open, &context->emit_lock);
+        }
+        context->reorder[seq % context->window] = outputs[i];
+        context->reorder[seq % context->window].flags |= SLOT_FILLED;
+        if (seq == context->next_emit)
+        {
+            drain_reorder(context);
+        }
+    }
+
+    pthread_mutex_unlock(&context->emit_lock);
+}
+
+static void *plugin_worker_thread(void *arg)
+{
+    plugin_worker_t *worker = (plugin_worker_t *)arg;
+    plugin_context_t *context = worker->context;
+    message_t items[PLUGIN_BATCH_MAX];
+    batch_arena_t arena = {0};
+    unsigned long seq = worker->index;
+    int count;
+
+    // Returns 0 once <END> was dispatched (which finishes every worker queue) and ours is drained
+    while ((count = consumer_producer_get_messages(worker->queue, items, atomic_load(&context->batch_size))) > 0)
+    {
+        run_transforms(context, &arena, items, count, 0);
+        for (int i = 0; i < count; i++)
+        {
+            if (items[i].flags & MESSAGE_CONTROL)
+            {
+                // Only the kind travels on through the reorder buffer
+                unsigned int flags = items[i].flags & MESSAGE_CONTROL;
+                message_release(&items[i]);
+                items[i].flags = flags;
+            }
+            else if (items[i].data == NULL)
+            {
+                items[i].flags = SLOT_SKIP; // Its transform failed
+            }
+        }
+        emit_outputs(context, items, count, seq);
+        seq += (unsigned long)count * context->replicas;
+    }
+
+    free(arena.input);
+    free(arena.output);
+    if (atomic_fetch_sub(&context->live_workers, 1) == 1 && !context->ordered)
+    {
+        pthread_mutex_lock(&context->emit_lock);
+        forward_end(context);
+        pthread_mutex_unlock(&context->emit_lock);
+    }
+    return NULL;
+}
+
+// Finishes every worker queue, joins the first started workers and frees the replicas
+static void stop_workers(plugin_context_t *context, int started)
+{
+    for (int i = 0; i < context->replicas; i++)
+    {
+        if (context->workers[i].queue)
+        {
+            consumer_producer_signal_finished(context->workers[i].queue);
+        }
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(context->workers[i].thread, NULL);
+    }
+    for (int i = 0; i < context->replicas; i++)
+    {
+        if (context->workers[i].queue)
+        {
+            consumer_producer_destroy(context->workers[i].queue);
+            free(context->workers[i].queue);
+        }
+    }
+    free(context->workers);
+    free(context->reorder);
+    context->workers = NULL;
+    context->reorder = NULL;
+    context->queue = NULL;
+    pthread_cond_destroy(&context->window_open);
+    pthread_mutex_destroy(&context->emit_lock);
+    monitor_destroy(&context->done);
+}
+
+static const char *start_workers(plugin_context_t *context, int queue_size)
+{
+    context->next_dispatch = 0;
+    context->next_emit = 0;
+    context->ordered = 1;
+    context->window = (unsigned long)PLUGIN_REORDER_WINDOW * context->replicas;
+    atomic_store(&context->live_workers, context->replicas);
+
+    context->workers = calloc(context->replicas, sizeof(plugin_worker_t));
+    context->reorder = calloc(context->window, sizeof(message_t));
+    if (!context->workers || !context->reorder)
+    {
+        free(context->workers);
+        free(context->reorder);
+        return "Memory allocation for workers failed";
+    }
+    if (monitor_init(&context->done) != 0)
+    {
+        free(context->workers);
+        free(context->reorder);
+        return "Creating the finished monitor failed";
+    }
+    pthread_mutex_init(&context->emit_lock, NULL);
+    pthread_cond_init(&context->window_open, NULL);
+
+    // Every worker queue gets the stage's queue size and has one producer (whoever places work) and one consumer
+    for (int i = 0; i < context->replicas; i++)
+    {
+        plugin_worker_t *worker = &context->workers[i];
+        worker->context = context;
+        worker->index = i;
+        worker->queue = topology_alloc_pages(sizeof(consumer_producer_t));
+        if (!worker->queue)
+        {
+            stop_workers(context, 0);
+            return "Memory allocation for queue failed";
+        }
+        const char *error = consumer_producer_init_mode(worker->queue, queue_size, CONSUMER_PRODUCER_SPSC);
+        if (error)
+        {
+            free(worker->queue);
+            worker->queue = NULL;
+            stop_workers(context, 0);
+            return error;
+        }
+    }
+    context->queue = context->workers[0].queue;
+
+    for (int i = 0; i < context->replicas; i++)
+    {
+        if (pthread_create(&context->workers[i].thread, NULL, plugin_worker_thread, &context->workers[i]) != 0)
+        {
+            stop_workers(context, i);
+            return "Creating the worker threads failed";
+        }
+    }
+    return NULL;
+}
+
+// Queue of the worker that gets the next item. Only the single producer of the stage calls it
+static consumer_producer_t *next_worker_queue(plugin_context_t *context)
+{
+    return context->workers[context->next_dispatch++ % context->replicas].queue;
+}
+
+// The input queues of a stage: one, or one per worker
+static int stage_queue_count(plugin_context_t *context)
+{
+    return context->replicas > 1 ? context->replicas : 1;
+}
+
+static consumer_producer_t *stage_queue(plugin_context_t *context, int i)
+{
+    return context->replicas > 1 ? context->workers[i].queue : context->queue;
+}
+
+void log_error(plugin_context_t *context, const char *message)
+{
+    fprintf(stderr, "[%s] %s\n", context->name, message);
+}
+
+void log_info(plugin_context_t *context, const char *message)
+{
+    printf("[%s] %s\n", context->name, message);
+}
+
+static void destroy_barrier(plugin_context_t *context)
+{
+    pthread_cond_destroy(&context->barrier_passed);
+    pthread_mutex_destroy(&context->barrier_lock);
+}
+
+static void destroy_state(plugin_context_t *context)
+{
+    if (context->state)
+    {
+        context->hooks.state_destroy(context->state);
+        context->state = NULL;
+    }
+}
+
+const char *common_plugin_init(const char *(*process_function)(const char *), const char *name, int queue_size)
+{
+
+    // Input validation
+    if (!process_function)
+    {
+        return "Process_function can't be NULL";
+    }
+    if (!name)
+    {
+        return "Plugin name cannot be NULL";
+    }
+
+    if (queue_size <= 0)
+    {
+        return "Queue size must be positive";
+    }
+
+    plugin_context_t *context = init_target ? init_target : &plugin_context;
+
+    // Initialize the fields of the plugin
+    context->name = name;
+    if (init_transforms)
+    {
+        context->transforms[0] = *init_transforms;
+        context->hooks = *init_hooks;
+    }
+    else
+    {
+        context->transforms[0].transform = process_function;
+        context->transforms[0].inplace = find_plugin_symbol(process_function, "plugin_transform_inplace");
+        context->transforms[0].message = find_plugin_symbol(process_function, "plugin_transform_message");
+        context->transforms[0].batch = find_plugin_symbol(process_function, "plugin_transform_batch");
+        context->transforms[0].paced = find_plugin_symbol(process_function, "plugin_transform_paced");
+        context->hooks.state_create = find_plugin_symbol(process_function, "plugin_state_create");
+        context->hooks.state_destroy = find_plugin_symbol(process_function, "plugin_state_destroy");
+        context->hooks.option = find_plugin_symbol(process_function, "plugin_option");
+    }
+    if (context->hooks.state_create && !context->hooks.state_destroy)
+    {
+        return "Plugin exports plugin_state_create without plugin_state_destroy";
+    }
+    // Replicas run the transforms that don't take the state
+    if (context->hooks.state_create && context->replicas > 1)
+    {
+        return "A plugin with a state per stage can't have replicas";
+    }
+    memset(&context->next, 0, sizeof(context->next));
+    context->legacy_next_place_work = NULL;
+    context->legacy_next_place_work_owned = NULL;
+    context->legacy_next_place_work_batch = NULL;
+    atomic_store(&context->batch_size, PLUGIN_BATCH_MAX);
+    context->initialized = 0;
+    context->finished = 0;
+    context->barriers = 0;
+    context->stream_ended = 0;
+    pthread_mutex_init(&context->barrier_lock, NULL);
+    pthread_cond_init(&context->barrier_passed, NULL);
+    context->paced = NULL; // Replicas run the plugin's other transforms
+    context->state = context->hooks.state_create ? context->hooks.state_create() : NULL;
+    if (context->hooks.state_create && !context->state)
+    {
+        destroy_barrier(context);
+        return "Creating the plugin's state failed";
+    }
+
+    if (context->replicas > 1)
+    {
+        const char *error = start_workers(context, queue_size);
+        if (error)
+        {
+            destroy_barrier(context);
+            destroy_state(context);
+        }
+        return error;
+    }
+    context->replicas = 1;
+
+    // A paced stage starts with one message in flight, see the inflight option
+    context->paced_head = 0;
+    context->paced_count = 0;
+    context->paced_ended = 0;
+    atomic_store(&context->inflight, 1);
+    if (context->transforms[0].paced)
+    {
+        context->paced = calloc(1, sizeof(paced_slot_t));
+        if (!context->paced)
+        {
+            destroy_barrier(context);
+            destroy_state(context);
+            return "Memory allocation for the paced slots failed";
+        }
+        timer_wheel_timer_init(&context->paced_timer, paced_timer_fire);
+    }
+
+    // Initialize a pointer for the plugins queue:
+    // The queue keeps its ring indices on separate cache lines, so honour its alignment. It
+    // has pages of its own, which the cpu option can move next to the consumer
+    context->queue = topology_alloc_pages(sizeof(consumer_producer_t));
+    if (!context->queue)
+    {
+        free_paced(context);
+        destroy_barrier(context);
+        destroy_state(context);
+        return "Memory allocation for queue failed";
+    }
+
+    // Every stage queue has exactly one producer (the upstream stage's consumer
+    // thread, or the host for the first stage) and one consumer (our thread)
+    const char *error = consumer_producer_init_mode(context->queue, queue_size, CONSUMER_PRODUCER_SPSC);
+    if (error)
+    {
+        free(context->queue);
+        context->queue = NULL;
+        free_paced(context);
+        destroy_barrier(context);
+        destroy_state(context);
+        return error;
+    }
+
+    // With the scheduler running the stage is a task on its workers, see the sched option
+    context->scheduled = 0;
+    if (scheduler_running())
+    {
+        context->task_arena = calloc(1, sizeof(batch_arena_t));
+        if (!context->task_arena)
+        {
+            consumer_producer_destroy(context->queue);
+            free(context->queue);
+            context->queue = NULL;
+            free_paced(context);
+            destroy_barrier(context);
+            destroy_state(context);
+            return "Memory allocation for the stage task failed";
+        }
+        scheduler_task_init(&context->task, plugin_stage_task);
+        context->initialized = 1;
+        context->scheduled = 1;
+        return NULL;
+    }
+
+    // Create the consumer thread
+    int thread_output = pthread_create(&context->consumer_thread, NULL, plugin_consumer_thread, context);
+    if (thread_output != 0)
+    { // Thread wasn't created properly, output of the function is 0
+        consumer_producer_destroy(context->queue);
+        free(context->queue);
+        context->queue = NULL;
+        free_paced(context);
+        destroy_barrier(context);
+        destroy_state(context);
+        return "Creating the consumer thread failed";
+    }
+
+    // If we reached here - success
+    return NULL;
+}
+
+/*
+ * Instance operations. Every entry point, legacy or instance based, lands in
+ * one of these with the context it works on.
+ */
+
+static const char *context_fini(plugin_context_t *context)
+{
+    if (!context->queue)
+    {
+        return "Plugin not initialized yet";
+    }
+    if (context->replicas > 1)
+    {
+        stop_workers(context, context->replicas);
+        destroy_barrier(context);
+        destroy_state(context);
+        return NULL;
+    }
+    // Destroy and free all resources
+    if (context->scheduled)
+    {
+        // Like a thread that wasn't given <END>, a task stops taking work once the queue is finished
+        consumer_producer_signal_finished(context->queue);
+        scheduler_wake(&context->task);
+        scheduler_task_quiesce(&context->task);
+        if (context->paced)
+        {
+            // A fire already under way wakes the task once more
+            timer_wheel_cancel(&context->paced_timer);
+            scheduler_task_quiesce(&context->task);
+        }
+        free_task_arena(context);
+    }
+    else
+    {
+        pthread_join(context->consumer_thread, NULL);
+    }
+    free_paced(context);
+    consumer_producer_destroy(context->queue);
+    free(context->queue);
+    context->queue = NULL;
+    destroy_barrier(context);
+    destroy_state(context);
+    return NULL;
+}
+
+// Queues messages we own; a replicated stage deals item i to worker (next_dispatch + i) % replicas
+static const char *context_place_messages(plugin_context_t *context, message_t *messages, int count)
+{
+    if (!messages)
+    {
+        return "Can't insert NULL to queue";
+    }
+    if (!context->queue)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            message_release(&messages[i]);
+        }
+        return "Plugin not initialized yet";
+    }
+    if (context->replicas == 1 && !context->scheduled)
+    {
+        return consumer_producer_put_messages(context->queue, messages, count);
+    }
+    if (context->replicas == 1)
+    {
+        // A put that waits for room must find the task woken: at most a queueful goes in per wake
+        const char *error = NULL;
+        for (int done = 0; done < count;)
+        {
+            int n = count - done < context->queue->capacity ? count - done : context->queue->capacity;
+            const char *put_error = consumer_producer_put_messages(context->queue, messages + done, n);
+            error = error ? error : put_error;
+            scheduler_wake(&context->task);
+            done += n;
+        }
+        return error;
+    }
+
+    // Each worker gets its share in one call
+    const char *error = NULL;
+    for (int w = 0; w < context->replicas; w++)
+    {
+        message_t share[PLUGIN_BATCH_MAX];
+        int n = 0;
+        int first = (int)((w + context->replicas - context->next_dispatch % context->replicas) % context->replicas);
+        for (int i = first; i < count; i += context->replicas)
+        {
+            share[n++] = messages[i];
+            if (n == PLUGIN_BATCH_MAX || i + context->replicas >= count)
+            {
+                const char *put_error = consumer_producer_put_messages(context->workers[w].queue, share, n);
+                error = error ? error : put_error;
+                n = 0;
+            }
+        }
+    }
+    context->next_dispatch += count;
+    return error;
+}
+
+static const char *context_place_control(plugin_context_t *context, unsigned int flags)
+{
+    if (!context->queue)
+    {
+        return "Plugin not initialized yet";
+    }
+    if (flags != MESSAGE_END && flags != MESSAGE_FLUSH && flags != MESSAGE_BARRIER)
+    {
+        return "Unknown control message";
+    }
+
+    // Control messages must get through even when the overflow policy drops items
+    message_t message;
+    if (message_control(&message, flags) != 0)
+    {
+        return "Error: Memory allocation for string failed";
+    }
+    consumer_producer_t *queue = context->replicas > 1 ? next_worker_queue(context) : context->queue;
+    if (consumer_producer_put_message_until(queue, &message, NULL) != 0)
+    {
+        return "Failed to queue control message";
+    }
+    if (context->scheduled)
+    {
+        scheduler_wake(&context->task);
+    }
+    if (context->replicas > 1 && flags == MESSAGE_END)
+    {
+        // Nothing follows <END>: the workers drain their queues and exit
+        for (int i = 0; i < context->replicas; i++)
+        {
+            consumer_producer_signal_finished(context->workers[i].queue);
+        }
+    }
+    return NULL;
+}
+
+static const char *context_place_work(plugin_context_t *context, const char *str)
+{
+    if (!context->queue)
+    {
+        return "Plugin not initialized yet";
+    }
+    if (!str)
+    {
+        return "Can't insert NULL to queue";
+    }
+
+    // Callers that only speak strings still end the stream with the marker text
+    if (strcmp(str, "<END>") == 0)
+    {
+        return context_place_control(context, MESSAGE_END);
+    }
+    message_t message;
+    if (message_copy(&message, str, strlen(str)) != 0)
+    {
+        return "Error: Memory allocation for string failed";
+    }
+    return context_place_messages(context, &message, 1);
+}
+
+static const char *context_place_work_owned(plugin_context_t *context, char *str)
+{
+    if (!str)
+    {
+        return "Can't insert NULL to queue";
+    }
+    message_t message;
+    message_adopt(&message, str);
+    return context_place_messages(context, &message, 1);
+}
+
+static const char *context_place_work_batch(plugin_context_t *context, char *const *items, int count)
+{
+    if (!items)
+    {
+        return "Can't insert NULL to queue";
+    }
+
+    // Strings from a plugin that doesn't send messages, measured once here
+    const char *error = NULL;
+    for (int done = 0; done < count; done += PLUGIN_BATCH_MAX)
+    {
+        message_t messages[PLUGIN_BATCH_MAX];
+        int n = count - done < PLUGIN_BATCH_MAX ? count - done : PLUGIN_BATCH_MAX;
+        for (int i = 0; i < n; i++)
+        {
+            message_adopt(&messages[i], items[done + i]);
+        }
+        const char *put_error = context_place_messages(context, messages, n);
+        error = error ? error : put_error;
+    }
+    return error;
+}
+
+static const char *context_wait_finished(plugin_context_t *context)
+{
+    if (!context->queue)
+    {
+        return "Plugin not initialized yet";
+    }
+    int result = context->replicas > 1 ? monitor_wait(&context->done)
+                                       : consumer_producer_wait_finished(context->queue);
+
+    if (result != 0)
+    {
+        return "Failed to wait for consumer-producer to finish";
+    }
+
+    return NULL; // Success
+}
+
+static const char *context_wait_barrier(plugin_context_t *context, unsigned long count,
+                                        consumer_producer_stats_t *stats)
+{
+    if (!context->queue)
+    {
+        return "Plugin not initialized yet";
+    }
+    pthread_mutex_lock(&context->barrier_lock);
+    while (context->barriers < count && !context->stream_ended)
+    {
+        pthread_cond_wait(&context->barrier_passed, &context->barrier_lock);
+    }
+    int passed = context->barriers >= count;
+    if (passed && stats)
+    {
+        *stats = context->barrier_stats;
+    }
+    pthread_mutex_unlock(&context->barrier_lock);
+    return passed ? NULL : "Stream ended before the barrier";
+}
+
+static void add_wait_counts(consumer_producer_wait_counts_t *sum, const consumer_producer_wait_counts_t *counts)
+{
+    sum->immediate += counts->immediate;
+    sum->spin += counts->spin;
+    sum->yield += counts->yield;
+    sum->park += counts->park;
+}
+
+static const char *context_get_stats(plugin_context_t *context, consumer_producer_stats_t *stats)
+{
+    if (!context->queue)
+    {
+        return "Plugin not initialized yet";
+    }
+    if (!stats)
+    {
+        return "Stats pointer can't be NULL";
+    }
+    consumer_producer_stats(stage_queue(context, 0), stats);
+
+    // A replicated stage reports the sum over its worker queues, and the highest high-water mark
+    for (int i = 1; i < stage_queue_count(context); i++)
+    {
+        consumer_producer_stats_t worker;
+        consumer_producer_stats(stage_queue(context, i), &worker);
+        stats->depth += worker.depth;
+        stats->high_water = worker.high_water > stats->high_water ? worker.high_water : stats->high_water;
+        stats->total_put += worker.total_put;
+        stats->total_got += worker.total_got;
+        stats->producer_blocked_ns += worker.producer_blocked_ns;
+        stats->consumer_blocked_ns += worker.consumer_blocked_ns;
+        add_wait_counts(&stats->producer_waits, &worker.producer_waits);
+        add_wait_counts(&stats->consumer_waits, &worker.consumer_waits);
+        stats->dropped_oldest += worker.dropped_oldest;
+        stats->dropped_newest += worker.dropped_newest;
+    }
+    return NULL;
+}
+
+// Parses a positive integer option value, returns -1 if it isn't one
+static int parse_positive(const char *value)
+{
+    char *end;
+    long parsed = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || parsed <= 0 || parsed > 1000000000L)
+    {
+        return -1;
+    }
+    return (int)parsed;
+}
+
+// Parses a comma separated CPU list such as "2" or "0,2,4", returns -1 if it isn't one
+static int parse_cpu_list(const char *value, cpu_set_t *cpus)
+{
+    CPU_ZERO(cpus);
+    const char *cursor = value;
+    for (;;)
+    {
+        char *end;
+        long cpu = strtol(cursor, &end, 10);
+        if (end == cursor || cpu < 0 || cpu >= CPU_SETSIZE)
+        {
+            return -1;
+        }
+        CPU_SET((int)cpu, cpus);
+        if (*end == '\0')
+        {
+            return 0;
+        }
+        if (*end != ',')
+        {
+            return -1;
+        }
+        cursor = end + 1;
+    }
+}
+
+// NUMA node all of the CPUs are on, -1 if they span nodes or it is unknown
+static int cpu_list_node(const cpu_set_t *cpus)
+{
+    int node = -1;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, cpus))
+        {
+            continue;
+        }
+        int cpu_node = topology_cpu_node(cpu);
+        if (cpu_node < 0 || (node >= 0 && cpu_node != node))
+        {
+            return -1;
+        }
+        node = cpu_node;
+    }
+    return node;
+}
+
+static const char *context_set_option(plugin_context_t *context, const char *key, const char *value)
 {
+    if (!context->queue)
+    {
+        return "Plugin not initialized yet";
+    }
+    if (!key || !value)
+    {
+        return "Option key and value can't be NULL";
+    }
 
-    plugin_context_t *context = (plugin_context_t *)arg;
-    context->initialized = 1;
+    consumer_producer_t *queue = context->queue;
+    int queues = stage_queue_count(context);
 
-    if (!context || !context->queue || !context->process_function)
+    if (strcmp(key, "wait") == 0)
     {
-        return NULL;
+        static const char *names[] = {"block", "spin", "adaptive", "poll"};
+        for (int i = 0; i < 4; i++)
+        {
+            if (strcmp(value, names[i]) == 0)
+            {
+                for (int q = 0; q < queues; q++)
+                {
+                    consumer_producer_set_wait_strategy(stage_queue(context, q), (consumer_producer_wait_strategy_t)i,
+                                                        atomic_load(&queue->spin_limit));
+                }
+                return NULL;
+            }
+        }
+        return "Unknown wait strategy (expected block, spin, adaptive or poll)";
     }
 
-    while (!context->finished)
+    if (strcmp(key, "spin") == 0)
     {
-        char *input = consumer_producer_get(context->queue); // If Queue is empty, will wait for queue to fill up here
-
-        if (!input)
+        int spin = parse_positive(value);
+        if (spin < 0)
         {
-            context->finished = 1;
-            break; // Consumer_producer_get will return NULL only when finished signal was recived
+            return "Spin rounds must be a positive integer";
         }
+        for (int q = 0; q < queues; q++)
+        {
+            consumer_producer_set_wait_strategy(stage_queue(context, q), atomic_load(&queue->wait_strategy), spin);
+        }
+        return NULL;
+    }
 
-        if (strcmp(input, "<END>") == 0)
+    if (strcmp(key, "overflow") == 0)
+    {
+        static const char *names[] = {"block", "drop_oldest", "drop_newest", "sample"};
+        for (int i = 0; i < 4; i++)
         {
-            if (context->next_place_work != NULL)
+            if (strcmp(value, names[i]) == 0)
             {
-                const char *error = context->next_place_work("<END>");
-                if (error != NULL)
+                // A dropped item would leave a hole the reorder buffer waits on forever
+                if (context->replicas > 1 && context->ordered && i != CONSUMER_PRODUCER_OVERFLOW_BLOCK)
+                {
+                    return "Ordered replicas can't drop items (use order=unordered)";
+                }
+                for (int q = 0; q < queues; q++)
                 {
-                    log_error(context, error);
+                    consumer_producer_set_overflow(stage_queue(context, q), (consumer_producer_overflow_t)i,
+                                                   atomic_load(&queue->sample_rate));
                 }
+                return NULL;
             }
-            consumer_producer_signal_finished(context->queue);
-            context->finished = 1;
-            free(input); // Free the original <END> input
-            break;
         }
+        return "Unknown overflow policy (expected block, drop_oldest, drop_newest or sample)";
+    }
 
-        const char *output = context->process_function(input);
+    if (strcmp(key, "sample") == 0)
+    {
+        int rate = parse_positive(value);
+        if (rate < 0)
+        {
+            return "Sample rate must be a positive integer";
+        }
+        for (int q = 0; q < queues; q++)
+        {
+            consumer_producer_set_overflow(stage_queue(context, q), atomic_load(&queue->overflow), rate);
+        }
+        return NULL;
+    }
 
-        free(input);
+    if (strcmp(key, "batch") == 0)
+    {
+        int batch = parse_positive(value);
+        if (batch < 0 || batch > PLUGIN_BATCH_MAX)
+        {
+            return "Batch size must be between 1 and 64";
+        }
+        atomic_store(&context->batch_size, batch);
+        return NULL;
+    }
 
-        if (output == NULL)
+    if (strcmp(key, "inline") == 0)
+    {
+        int size = parse_positive(value);
+        if (size < 0)
         {
-            log_error(context, "Transformation of input failed");
-            continue;
+            return "Inline size must be a positive integer";
+        }
+        for (int q = 0; q < queues; q++)
+        {
+            const char *error = consumer_producer_set_inline(stage_queue(context, q), size);
+            if (error)
+            {
+                return error;
+            }
+        }
+        return NULL;
+    }
+
+    if (strcmp(key, "sched") == 0)
+    {
+        if (strcmp(value, "pool") == 0)
+        {
+            return context->scheduled ? NULL : "Stage has its own threads, the scheduler runs under analyzer --pool";
+        }
+        if (strcmp(value, "thread") != 0)
+        {
+            return "Unknown scheduling (expected pool or thread)";
+        }
+        if (!context->scheduled)
+        {
+            return NULL;
+        }
+        if (atomic_load(&queue->total_put) > 0)
+        {
+            return "Option must be set before work is placed";
         }
+        // Nothing woke the task yet, the thread takes its queue over
+        if (pthread_create(&context->consumer_thread, NULL, plugin_consumer_thread, context) != 0)
+        {
+            return "Creating the consumer thread failed";
+        }
+        context->scheduled = 0;
+        free_task_arena(context);
+        return NULL;
+    }
 
-        if (context->next_place_work != NULL)
+    if (strcmp(key, "cpu") == 0)
+    {
+        if (context->scheduled)
+        {
+            return "Stage runs on the scheduler's workers, set sched=thread first";
+        }
+        cpu_set_t cpus;
+        if (parse_cpu_list(value, &cpus) != 0)
+        {
+            return "CPU must be a comma separated list of CPU numbers";
+        }
+        for (int q = 0; q < queues; q++)
+        {
+            pthread_t thread = context->replicas > 1 ? context->workers[q].thread : context->consumer_thread;
+            if (pthread_setaffinity_np(thread, sizeof(cpus), &cpus) != 0)
+            {
+                return "Setting the consumer thread's CPU affinity failed";
+            }
+        }
+        // An empty queue moves to the consumer's NUMA node; one in use stays where it is
+        int node = cpu_list_node(&cpus);
+        for (int q = 0; node >= 0 && q < queues; q++)
         {
-            const char *error = context->next_place_work(output);
-            if (error != NULL)
+            consumer_producer_t *queue = stage_queue(context, q);
+            if (consumer_producer_set_node(queue, node) == NULL)
             {
-                log_error(context, error);
+                topology_bind(queue, sizeof(*queue), node);
             }
         }
-        free((void *)output);
+        return NULL;
     }
 
-    return NULL;
+    if (strcmp(key, "inflight") == 0)
+    {
+        if (!context->paced)
+        {
+            return "Option needs plugin_transform_paced";
+        }
+        if (atomic_load(&queue->total_put) > 0)
+        {
+            return "Option must be set before work is placed";
+        }
+        int inflight = parse_positive(value);
+        if (inflight < 0 || inflight > PLUGIN_INFLIGHT_MAX)
+        {
+            return "In-flight messages must be between 1 and 4096";
+        }
+        // The ring is empty and nothing is taken from the queue before the first put
+        paced_slot_t *paced = calloc(inflight, sizeof(paced_slot_t));
+        if (!paced)
+        {
+            return "Memory allocation for the paced slots failed";
+        }
+        free(context->paced);
+        context->paced = paced;
+        atomic_store(&context->inflight, inflight);
+        return NULL;
+    }
+
+    if (strcmp(key, "order") == 0 || strcmp(key, "window") == 0)
+    {
+        if (context->replicas == 1)
+        {
+            return "Option needs replicas > 1";
+        }
+        if (context->next_dispatch > 0)
+        {
+            return "Option must be set before work is placed";
+        }
+    }
+
+    if (strcmp(key, "order") == 0)
+    {
+        if (strcmp(value, "ordered") == 0)
+        {
+            if (atomic_load(&queue->overflow) != CONSUMER_PRODUCER_OVERFLOW_BLOCK)
+            {
+                return "Ordered replicas can't drop items (set overflow=block first)";
+            }
+            context->ordered = 1;
+            return NULL;
+        }
+        if (strcmp(value, "unordered") == 0)
+        {
+            context->ordered = 0;
+            return NULL;
+        }
+        return "Unknown order (expected ordered or unordered)";
+    }
+
+    if (strcmp(key, "window") == 0)
+    {
+        int window = parse_positive(value);
+        if (window < 0)
+        {
+            return "Reorder window must be a positive integer";
+        }
+        if (window < context->replicas)
+        {
+            return "Reorder window must be at least the number of replicas";
+        }
+        // No worker gets further ahead than its queue and the round in its hands, a wider window never fills
+        long most = (long)context->replicas * (queue->capacity + PLUGIN_BATCH_MAX);
+        if (window > most)
+        {
+            return "Reorder window must be at most replicas * (queue size + 64)";
+        }
+        message_t *reorder = calloc(window, sizeof(message_t));
+        if (!reorder)
+        {
+            return "Memory allocation for reorder buffer failed";
+        }
+        pthread_mutex_lock(&context->emit_lock);
+        free(context->reorder);
+        context->reorder = reorder;
+        context->window = (unsigned long)window;
+        pthread_mutex_unlock(&context->emit_lock);
+        return NULL;
+    }
+
+    // The rest are the plugin's own
+    return context->hooks.option ? context->hooks.option(context->state, key, value) : "Unknown option";
 }
 
-void log_error(plugin_context_t *context, const char *message)
+/*
+ * Legacy entry points. They drive the default instance; what plugin_attach*
+ * sets is wrapped into its sink, so the consumer thread only knows sinks.
+ * A host with built-in plugins has no single plugin to drive, so it only
+ * gets instances.
+ */
+
+#ifndef PLUGIN_STATIC_BUILD
+
+static const char *legacy_next_place_work(void *instance, const char *str)
 {
-    fprintf(stderr, "[%s] %s\n", context->name, message);
+    return ((plugin_context_t *)instance)->legacy_next_place_work(str);
 }
 
-void log_info(plugin_context_t *context, const char *message)
+static const char *legacy_next_place_work_owned(void *instance, char *str)
 {
-    printf("[%s] %s\n", context->name, message);
+    return ((plugin_context_t *)instance)->legacy_next_place_work_owned(str);
+}
+
+static const char *legacy_next_place_work_batch(void *instance, char *const *items, int count)
+{
+    return ((plugin_context_t *)instance)->legacy_next_place_work_batch(items, count);
 }
 
 const char *plugin_get_name(void)
@@ -83,107 +1741,284 @@ const char *plugin_get_name(void)
     return plugin_context.name;
 }
 
-const char *common_plugin_init(const char *(*process_function)(const char *), const char *name, int queue_size)
+const char *plugin_fini(void)
 {
+    return context_fini(&plugin_context);
+}
 
-    // Input validation
-    if (!process_function)
+const char *plugin_place_work(const char *str)
+{
+    return context_place_work(&plugin_context, str);
+}
+
+const char *plugin_place_work_owned(char *str)
+{
+    return context_place_work_owned(&plugin_context, str);
+}
+
+const char *plugin_place_work_batch(char *const *items, int count)
+{
+    return context_place_work_batch(&plugin_context, items, count);
+}
+
+void plugin_attach(const char *(*next_place_work)(const char *))
+{
+    plugin_context.legacy_next_place_work = next_place_work;
+    plugin_context.next.instance = &plugin_context;
+    plugin_context.next.place_work = next_place_work ? legacy_next_place_work : NULL;
+}
+
+void plugin_attach_owned(plugin_place_work_owned_t next_place_work_owned)
+{
+    plugin_context.legacy_next_place_work_owned = next_place_work_owned;
+    plugin_context.next.instance = &plugin_context;
+    plugin_context.next.place_work_owned = next_place_work_owned ? legacy_next_place_work_owned : NULL;
+}
+
+void plugin_attach_batch(plugin_place_work_batch_t next_place_work_batch)
+{
+    plugin_context.legacy_next_place_work_batch = next_place_work_batch;
+    plugin_context.next.instance = &plugin_context;
+    plugin_context.next.place_work_batch = next_place_work_batch ? legacy_next_place_work_batch : NULL;
+}
+
+const char *plugin_set_option(const char *key, const char *value)
+{
+    return context_set_option(&plugin_context, key, value);
+}
+
+__attribute__((visibility("default")))
+const char *
+plugin_wait_finished(void)
+{
+    return context_wait_finished(&plugin_context);
+}
+
+const char *plugin_get_stats(consumer_producer_stats_t *stats)
+{
+    return context_get_stats(&plugin_context, stats);
+}
+
+#endif
+
+/*
+ * Instance API. init runs the plugin's own plugin_init with init_target
+ * pointing at a fresh context, so every plugin gets instances without
+ * changing its source.
+ */
+
+// Runs plugin_init with init_target pointing at a fresh context
+static const char *create_instance(const char *(*plugin_init)(int), const plugin_transforms_t *transforms,
+                                   const plugin_hooks_t *hooks, int queue_size, int replicas, void **instance)
+{
+    if (!instance)
     {
-        return "Process_function can't be NULL";
+        return "Instance pointer can't be NULL";
     }
-    if (!name)
+    if (replicas <= 0)
     {
-        return "Plugin name cannot be NULL";
+        return "Replicas must be positive";
     }
-
-    if (queue_size <= 0)
+    plugin_context_t *context = calloc(1, sizeof(plugin_context_t));
+    if (!context)
     {
-        return "Queue size must be positive";
+        return "Memory allocation for plugin instance failed";
     }
+    context->replicas = replicas;
 
-    // Initialize the fields of the plugin
-    plugin_context.name = name;
-    plugin_context.process_function = process_function;
-    plugin_context.next_place_work = NULL;
-    plugin_context.initialized = 0;
-    plugin_context.finished = 0;
+    init_target = context;
+    init_transforms = transforms;
+    init_hooks = hooks;
+    const char *error = plugin_init(queue_size);
+    init_target = NULL;
+    init_transforms = NULL;
+    init_hooks = NULL;
 
-    // Initialize a pointer for the plugins queue:
-    plugin_context.queue = malloc(sizeof(consumer_producer_t));
-    if (!plugin_context.queue)
+    if (error)
     {
-        return "Memory allocation for queue failed";
+        free(context);
+        return error;
     }
+    *instance = context;
+    return NULL;
+}
 
-    // Initiate the consumer_producer sync mechanism
-    const char *error = consumer_producer_init(plugin_context.queue, queue_size);
-    if (error)
+#ifdef PLUGIN_STATIC_BUILD
+const char *plugin_static_instance_init(const char *(*plugin_init)(int), const plugin_transforms_t *transforms,
+                                        const plugin_hooks_t *hooks, int queue_size, int replicas, void **instance)
+{
+    return create_instance(plugin_init, transforms, hooks, queue_size, replicas, instance);
+}
+#else
+static const char *instance_init(int queue_size, int replicas, void **instance)
+{
+    return create_instance(plugin_init, NULL, NULL, queue_size, replicas, instance);
+}
+#endif
+
+static const char *instance_fini(void *instance)
+{
+    if (!instance)
     {
-        free(plugin_context.queue);
-        plugin_context.queue = NULL;
-        return error;
+        return "NULL plugin instance";
     }
+    const char *error = context_fini(instance);
+    free(instance);
+    return error;
+}
 
-    // Create the consumer thread
-    int thread_output = pthread_create(&plugin_context.consumer_thread, NULL, plugin_consumer_thread, &plugin_context);
-    if (thread_output != 0)
-    { // Thread wasn't created properly, output of the function is 0
-        consumer_producer_destroy(plugin_context.queue);
-        free(plugin_context.queue);
-        plugin_context.queue = NULL;
-        return "Creating the consumer thread failed";
+static const char *instance_place_work(void *instance, const char *str)
+{
+    return instance ? context_place_work(instance, str) : "NULL plugin instance";
+}
+
+static const char *instance_place_work_owned(void *instance, char *str)
+{
+    if (!instance)
+    {
+        free(str);
+        return "NULL plugin instance";
     }
+    return context_place_work_owned(instance, str);
+}
 
-    // If we reached here - success
-    return NULL;
+static const char *instance_place_work_batch(void *instance, char *const *items, int count)
+{
+    if (!instance)
+    {
+        for (int i = 0; items && i < count; i++)
+        {
+            free(items[i]);
+        }
+        return "NULL plugin instance";
+    }
+    return context_place_work_batch(instance, items, count);
 }
 
-const char *plugin_fini(void)
+static const char *instance_place_messages(void *instance, message_t *messages, int count)
 {
-    if (!plugin_context.queue)
+    if (!instance)
     {
-        return "Plugin not initialized yet";
+        for (int i = 0; messages && i < count; i++)
+        {
+            message_release(&messages[i]);
+        }
+        return "NULL plugin instance";
     }
-    // Destroy and free all resources
-    pthread_join(plugin_context.consumer_thread, NULL);
-    consumer_producer_destroy(plugin_context.queue);
-    free(plugin_context.queue);
-    plugin_context.queue = NULL;
-    return NULL;
+    return context_place_messages(instance, messages, count);
 }
 
-const char *plugin_place_work(const char *str)
+static const char *instance_place_control(void *instance, unsigned int flags)
+{
+    return instance ? context_place_control(instance, flags) : "NULL plugin instance";
+}
+
+static const char *instance_wait_barrier(void *instance, unsigned long count, consumer_producer_stats_t *stats)
+{
+    return instance ? context_wait_barrier(instance, count, stats) : "NULL plugin instance";
+}
+
+static const char *instance_attach(void *instance, const plugin_sink_t *next)
 {
-    if (!plugin_context.queue)
+    if (!instance)
     {
-        return "Plugin not initialized yet";
+        return "NULL plugin instance";
     }
-    if (!str)
+    if (next && !next->place_work)
     {
-        return "Can't insert NULL to queue";
+        return "The next stage must provide place_work";
+    }
+    plugin_context_t *context = instance;
+    if (next)
+    {
+        context->next = *next;
+    }
+    else
+    {
+        memset(&context->next, 0, sizeof(context->next));
     }
-    return consumer_producer_put(plugin_context.queue, str);
+    return NULL;
 }
 
-void plugin_attach(const char *(*next_place_work)(const char *))
+static const char *instance_wait_finished(void *instance)
 {
-    plugin_context.next_place_work = next_place_work;
+    return instance ? context_wait_finished(instance) : "NULL plugin instance";
 }
 
-__attribute__((visibility("default")))
-const char *
-plugin_wait_finished(void)
+static const char *instance_set_option(void *instance, const char *key, const char *value)
 {
-    if (!plugin_context.queue)
+    return instance ? context_set_option(instance, key, value) : "NULL plugin instance";
+}
+
+static const char *instance_get_stats(void *instance, consumer_producer_stats_t *stats)
+{
+    return instance ? context_get_stats(instance, stats) : "NULL plugin instance";
+}
+
+static const char *instance_fuse(void *instance, const plugin_transforms_t *transforms)
+{
+    plugin_context_t *context = instance;
+    if (!context || !context->queue)
     {
         return "Plugin not initialized yet";
     }
-    int result = consumer_producer_wait_finished(plugin_context.queue);
+    if (!transforms || !transforms->transform)
+    {
+        return "Transform can't be NULL";
+    }
+    if (context->fused_count == PLUGIN_FUSE_MAX)
+    {
+        return "Too many fused stages";
+    }
 
-    if (result != 0)
+    // The stage thread reads fused without locking; the first put publishes it
+    consumer_producer_stats_t stats;
+    context_get_stats(context, &stats);
+    if (stats.total_put > 0)
     {
-        return "Failed to wait for consumer-producer to finish";
+        return "Stages must be fused before work is placed";
     }
+    context->transforms[++context->fused_count] = *transforms;
+    return NULL;
+}
 
-    return NULL; // Success
+static const char *instance_get_transform_stats(void *instance, int index, plugin_transform_stats_t *stats)
+{
+    plugin_context_t *context = instance;
+    if (!context || !stats)
+    {
+        return "NULL argument";
+    }
+    if (index < 0 || index > context->fused_count)
+    {
+        return "No such transform";
+    }
+    stats->calls = atomic_load_explicit(&context->transform_calls[index], memory_order_relaxed);
+    stats->time_ns = atomic_load_explicit(&context->transform_ns[index], memory_order_relaxed);
+    return NULL;
+}
+
+const plugin_instance_api_t *plugin_instance_api(void)
+{
+    static const plugin_instance_api_t api = {
+#ifdef PLUGIN_STATIC_BUILD
+        NULL, // Each built-in plugin has its own, see plugin_registry.c
+#else
+        instance_init,
+#endif
+        instance_fini,
+        instance_place_work,
+        instance_place_work_owned,
+        instance_place_work_batch,
+        instance_attach,
+        instance_wait_finished,
+        instance_set_option,
+        instance_get_stats,
+        instance_fuse,
+        instance_get_transform_stats,
+        instance_place_messages,
+        instance_place_control,
+        instance_wait_barrier,
+    };
+    return &api;
 }
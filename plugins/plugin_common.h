@@ -2,18 +2,214 @@
 #define PLUGIN_COMMON_H
 #include "sync/consumer_producer.h"
 #include "sync/monitor.h"
+#include "sync/scheduler.h"
+#include "sync/timer_wheel.h"
 
-// Plugin context structure
+// Maximum number of items the consumer thread drains from its queue per round
+#define PLUGIN_BATCH_MAX 64
+
+// Next plugin's entry points that take ownership of heap strings, see
+// plugin_place_work_owned and plugin_place_work_batch
+typedef const char *(*plugin_place_work_owned_t)(char *str);
+typedef const char *(*plugin_place_work_batch_t)(char *const *items, int count);
+
+// Where a stage sends its output: entry points of one instance of the next
+// plugin, called with that instance as first argument
+typedef struct
+{
+    void *instance;
+    const char *(*place_work)(void *instance, const char *str);                      // Copies str
+    const char *(*place_work_owned)(void *instance, char *str);                      // Takes ownership (optional)
+    const char *(*place_work_batch)(void *instance, char *const *items, int count); // Takes ownership (optional)
+    const char *(*place_messages)(void *instance, message_t *messages, int count);  // Takes ownership (optional)
+    const char *(*place_control)(void *instance, unsigned int flags);               // MESSAGE_* control (optional)
+} plugin_sink_t;
+
+// A plugin's transform: returns a new heap string, or NULL on failure
+typedef const char *(*plugin_transform_t)(const char *input);
+
+// A plugin's optional in-place transform: rewrites the len bytes of buf
+// without changing the length. Returns 0 on success, -1 on failure
+typedef int (*plugin_transform_inplace_t)(char *buf, size_t len);
+
+// A plugin's optional message transform: rewrites message in place or
+// replaces its data (see message_replace), keeping len and cap right.
+// Returns 0 on success, -1 on failure
+typedef int (*plugin_transform_message_t)(message_t *message);
+
+// A plugin's optional batch transform, see plugin_transform_batch in plugin_sdk.h
+typedef long (*plugin_transform_batch_t)(const char *input, const size_t *offsets, int count, char *output,
+                                         size_t capacity, size_t *output_offsets);
+
+// A plugin's optional paced transform, see plugin_transform_paced in plugin_sdk.h
+typedef long (*plugin_transform_paced_t)(void *state, message_t *message, unsigned int step);
+
+// Every signature a plugin's transform comes in; the stage uses the first
+// one present of paced, message, inplace, batch and transform
 typedef struct
 {
-    const char *name;                              // Plugin name (for diagnosis)
-    consumer_producer_t *queue;                    // Input queue
-    pthread_t consumer_thread;                     // Consumer thread
-    const char *(*next_place_work)(const char *);  // Next plugin's place_work function
-    const char *(*process_function)(const char *); // Plugin-specific processing function
-    int initialized;                               // Initialization flag
-    int finished;                                  // Finished processing flag
+    plugin_transform_t transform;       // plugin_transform, always there
+    plugin_transform_inplace_t inplace; // plugin_transform_inplace, or NULL
+    plugin_transform_message_t message; // plugin_transform_message, or NULL
+    plugin_transform_batch_t batch;     // plugin_transform_batch, or NULL
+    plugin_transform_paced_t paced;     // plugin_transform_paced, or NULL; only a stage of its own runs it
+} plugin_transforms_t;
+
+// Transforms of other stages one stage can run after its own
+#define PLUGIN_FUSE_MAX 8
+
+// A plugin's optional settings of its own, see plugin_option in plugin_sdk.h
+typedef const char *(*plugin_option_t)(void *state, const char *key, const char *value);
+
+// A plugin's optional per-stage state, see plugin_state_create in plugin_sdk.h
+typedef void *(*plugin_state_create_t)(void);
+typedef void (*plugin_state_destroy_t)(void *state);
+
+// The plugin's exports a stage calls besides its transforms
+typedef struct
+{
+    plugin_state_create_t state_create;   // plugin_state_create, or NULL
+    plugin_state_destroy_t state_destroy; // plugin_state_destroy, or NULL
+    plugin_option_t option;               // plugin_option, or NULL
+} plugin_hooks_t;
+
+/**
+ * Counters of one transform of a stage, see plugin_instance_api_t.get_transform_stats
+ */
+typedef struct
+{
+    unsigned long calls;   // Inputs the transform ran on
+    unsigned long time_ns; // Time spent inside it
+} plugin_transform_stats_t;
+
+// What a plugin tells the host about itself through plugin_capabilities(),
+// so the host can decide fusion and replication without being told
+#define PLUGIN_CAP_STATELESS 0x01u         // An output depends on its input only
+#define PLUGIN_CAP_THREAD_SAFE 0x02u       // Its transforms may run on several threads at once
+#define PLUGIN_CAP_LENGTH_PRESERVING 0x04u // Outputs are as long as their inputs
+#define PLUGIN_CAP_INPLACE 0x08u           // Exports plugin_transform_inplace
+#define PLUGIN_CAP_BATCH 0x10u             // Exports plugin_transform_batch
+#define PLUGIN_CAP_OBSERVER 0x20u          // Outputs equal inputs, it only looks at them
+#define PLUGIN_CAP_BLOCKING 0x40u          // Sleeps or waits for I/O in its transform
+#define PLUGIN_CAP_PACED 0x80u             // Exports plugin_transform_paced, its stage waits without sleeping
+
+// Rough time a transform takes per line
+typedef enum
+{
+    PLUGIN_COST_UNKNOWN = 0,
+    PLUGIN_COST_CHEAP,    // A pass over the bytes
+    PLUGIN_COST_MODERATE, // Several passes, or allocations
+    PLUGIN_COST_EXPENSIVE // Far more than the queue hand-off around it
+} plugin_cost_t;
+
+typedef struct
+{
+    unsigned int flags; // PLUGIN_CAP_*
+    plugin_cost_t cost;
+} plugin_capabilities_t;
+
+// Rounds a stage run by the scheduler takes from its queue before it lets others run
+#define PLUGIN_TASK_ROUNDS 1
+
+// Reorder window of a replicated stage, in items, per replica
+#define PLUGIN_REORDER_WINDOW (2 * PLUGIN_BATCH_MAX)
+
+// Most messages a paced stage holds between their steps, see the inflight option
+#define PLUGIN_INFLIGHT_MAX 4096
+
+struct plugin_worker;
+struct batch_arena;
+struct paced_slot;
+
+// Plugin context structure, one per plugin instance
+typedef struct
+{
+    const char *name;                                       // Plugin name (for diagnosis)
+    plugin_hooks_t hooks;                                   // The plugin's state and option exports
+    void *state;                                            // Made by hooks.state_create, NULL without it
+    consumer_producer_t *queue;                             // Input queue (the first worker's when replicated)
+    pthread_t consumer_thread;                              // Consumer thread (replicas == 1)
+    plugin_sink_t next;                                     // Next stage, place_work is NULL for the last one
+    const char *(*legacy_next_place_work)(const char *);    // Set by plugin_attach, next is routed through it
+    plugin_place_work_owned_t legacy_next_place_work_owned; // Set by plugin_attach_owned
+    plugin_place_work_batch_t legacy_next_place_work_batch; // Set by plugin_attach_batch
+    atomic_int batch_size;                                  // Items drained from the queue per round, 1..PLUGIN_BATCH_MAX
+    int initialized;                                        // Initialization flag
+    int finished;                                           // Finished processing flag
+    int scheduled;                                          // Runs as a scheduler task instead of consumer_thread
+    scheduler_task_t task;                                  // The task, woken by every put into queue
+    struct batch_arena *task_arena;                         // Batch transform buffers of the task
+
+    /* Replicated stage: workers each own an input queue and get items
+     * round-robin, so item seq goes to worker seq % replicas. Outputs pass
+     * through a reorder buffer of window slots (indexed by seq % window)
+     * and are forwarded in input order under emit_lock. */
+    int replicas;                                           // Worker threads, 1 keeps the single consumer thread
+    struct plugin_worker *workers;                          // replicas entries when replicas > 1
+    unsigned long next_dispatch;                            // Sequence number of the next item placed
+    int ordered;                                            // 0 forwards outputs as they come, without reordering
+    pthread_mutex_t emit_lock;                              // Serializes forwarding downstream
+    pthread_cond_t window_open;                             // Broadcast when next_emit moves on
+    message_t *reorder;                                     // Outputs waiting for their turn
+    unsigned long window;                                   // Slots in reorder
+    unsigned long next_emit;                                // Sequence number to forward next
+    atomic_int live_workers;                                // Workers still running
+    monitor_t done;                                         // Signaled once <END> went downstream
+
+    /* Paced stage (transforms[0].paced, replicas == 1): messages between
+     * their steps wait in a ring of inflight slots, in input order, and
+     * leave it from the front once done. A thread waits for the next due
+     * step on its queue; a task arms paced_timer, which wakes it. */
+    struct paced_slot *paced;                               // inflight slots, NULL unless paced
+    atomic_int inflight;                                    // Messages whose steps may overlap
+    int paced_head;                                         // Slot of the oldest message
+    int paced_count;                                        // Slots in use
+    int paced_ended;                                        // <END> was taken, nothing more is
+    timer_wheel_timer_t paced_timer;                        // Wakes task when the next step is due
+
+    /* Transforms run on every input: entry 0 is the plugin's own, the
+     * fused_count entries after it belong to fused stages, which run right
+     * after ours on the same thread instead of behind a queue of their own.
+     * The counters are indexed the same way and only kept while something
+     * is fused. */
+    plugin_transforms_t transforms[PLUGIN_FUSE_MAX + 1];
+    int fused_count;
+    atomic_ulong transform_calls[PLUGIN_FUSE_MAX + 1];
+    atomic_ulong transform_ns[PLUGIN_FUSE_MAX + 1];
+
+    /* The stage's counters as the last BARRIER passed it, guarded by barrier_lock */
+    pthread_mutex_t barrier_lock;
+    pthread_cond_t barrier_passed;                          // Broadcast when a BARRIER passes or the stage ends
+    unsigned long barriers;                                 // BARRIER messages passed so far
+    int stream_ended;                                       // END passed, no BARRIER follows
+    consumer_producer_stats_t barrier_stats;
 } plugin_context_t;
+
+/*
+ * Instance API. The plugin_* exports below drive one default instance per
+ * loaded .so, so a plugin listed twice in a chain would share its queue and
+ * thread. Hosts that want several copies of a plugin use the entry points
+ * returned by plugin_instance_api() instead: init returns a new instance
+ * that every other call takes as its first argument.
+ */
+typedef struct
+{
+    const char *(*init)(int queue_size, int replicas, void **instance); // replicas worker threads share the stage
+    const char *(*fini)(void *instance); // Joins the thread and frees the instance
+    const char *(*place_work)(void *instance, const char *str);
+    const char *(*place_work_owned)(void *instance, char *str);
+    const char *(*place_work_batch)(void *instance, char *const *items, int count);
+    const char *(*attach)(void *instance, const plugin_sink_t *next);
+    const char *(*wait_finished)(void *instance);
+    const char *(*set_option)(void *instance, const char *key, const char *value);
+    const char *(*get_stats)(void *instance, consumer_producer_stats_t *stats);
+    const char *(*fuse)(void *instance, const plugin_transforms_t *transforms); // Before any work is placed
+    const char *(*get_transform_stats)(void *instance, int index, plugin_transform_stats_t *stats); // 0 is our own
+    const char *(*place_messages)(void *instance, message_t *messages, int count); // Takes ownership
+    const char *(*place_control)(void *instance, unsigned int flags); // Queues MESSAGE_END, _FLUSH or _BARRIER
+    const char *(*wait_barrier)(void *instance, unsigned long count,
+                                consumer_producer_stats_t *stats); // Until count BARRIERs passed, then their snapshot
+} plugin_instance_api_t;
 /**
  * Generic consumer thread function
  * This function runs in a separate thread and processes items from the queue
@@ -42,7 +238,9 @@ const char *
 plugin_get_name(void);
 
 /**
- * Initialize the common plugin infrastructure with the specified queue size
+ * Initialize the common plugin infrastructure with the specified queue size.
+ * Called from plugin_init; sets up the default instance, or the instance
+ * being created when plugin_init runs on behalf of the instance API.
  * @param process_function Plugin-specific processing function
  * @param name Plugin name
  * @param queue_size Maximum number of items that can be queued
@@ -68,6 +266,63 @@ __attribute__((visibility("default")))
 const char *
 plugin_place_work(const char *str);
 /**
+* Place a heap allocated string into the plugin's queue without copying it
+* @param str malloc'd string; the plugin owns it from now on (and frees it on
+failure), the caller must not touch it again
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char *
+plugin_place_work_owned(char *str);
+/**
+* Place several heap allocated strings into the plugin's queue in one
+* synchronization round, without copying them
+* @param items malloc'd strings; ownership of all of them moves to the plugin
+* @param count Number of strings
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char *
+plugin_place_work_batch(char *const *items, int count);
+/**
+* Attach this plugin to the next plugin's place_work_owned, so transform
+* outputs are handed over instead of copied
+* @param next_place_work_owned Function pointer to the next plugin's
+place_work_owned function
+*/
+__attribute__((visibility("default"))) void plugin_attach_owned(plugin_place_work_owned_t next_place_work_owned);
+/**
+* Attach this plugin to the next plugin's batch entry point. When set, the
+* consumer thread forwards each drained batch downstream in a single call
+* instead of calling next_place_work once per item.
+* @param next_place_work_batch Function pointer to the next plugin's
+place_work_batch function
+*/
+__attribute__((visibility("default"))) void plugin_attach_batch(plugin_place_work_batch_t next_place_work_batch);
+/**
+* Set a runtime option of this plugin
+* Supported keys:
+*   wait  - how the consumer thread waits for work: block, spin, adaptive or poll
+*   spin  - spin rounds for the spin and adaptive strategies
+*   overflow - what placing work on a full queue does: block, drop_oldest,
+*              drop_newest or sample (<END> is never dropped)
+*   sample - keep one in this many lines while full, for overflow=sample
+*   batch - most lines the consumer thread takes per round, 1..PLUGIN_BATCH_MAX
+*   cpu   - pin the consumer thread to these CPUs, a comma separated list;
+*           set before any work, it also moves the queue to their NUMA node
+*   sched - pool runs the stage on the scheduler's workers (analyzer --pool,
+*           the default then), thread gives it its own consumer thread
+*   inflight - messages a paced stage (plugin_transform_paced) lets overlap,
+*           1..PLUGIN_INFLIGHT_MAX, 1 by default
+* Any other key goes to the plugin's plugin_option, if it exports one, with the stage's state.
+* @param key Option name
+* @param value Option value
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char *
+plugin_set_option(const char *key, const char *value);
+/**
 * Attach this plugin to the next plugin in the chain
 * @param next_place_work Function pointer to the next plugin's place_work
 function
@@ -82,5 +337,38 @@ shutdown
 __attribute__((visibility("default")))
 const char *
 plugin_wait_finished(void);
+/**
+* Read the counters of this plugin's input queue: depth, high-water mark,
+* totals, time spent blocked on either side and overflow drops
+* @param stats Receives the counters
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char *
+plugin_get_stats(consumer_producer_stats_t *stats);
+/**
+* Get the instance entry points of this plugin
+* @return Table of functions that work on instances created by its init
+*/
+__attribute__((visibility("default")))
+const plugin_instance_api_t *
+plugin_instance_api(void);
+
+#ifdef PLUGIN_STATIC_BUILD
+/**
+* Create an instance of a plugin built into the host. Its exports are
+* renamed (see plugin_sdk.h), so plugin_instance_api() has no plugin_init
+* to call and leaves init NULL; plugin_registry.c wraps this per plugin.
+* @param plugin_init The plugin's plugin_init
+* @param transforms The plugin's transforms
+* @param hooks The plugin's state and option exports
+* @param queue_size Maximum number of items that can be queued
+* @param replicas Worker threads sharing the stage
+* @param instance Receives the new instance
+* @return NULL on success, error message on failure
+*/
+const char *plugin_static_instance_init(const char *(*plugin_init)(int), const plugin_transforms_t *transforms,
+                                        const plugin_hooks_t *hooks, int queue_size, int replicas, void **instance);
+#endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,68 @@
+#include "plugin_registry.h"
+
+#include <string.h>
+
+// The plugins build.sh static compiles into the analyzer
+#define PLUGIN_REGISTRY_PLUGINS(X)                                                                             \
+    X(logger) X(uppercaser) X(rotator) X(flipper) X(expander) X(typewriter) X(ratelimiter)
+
+// A plugin's exports as plugin_sdk.h renames them. The optional ones are
+// weak, so one the plugin doesn't define is NULL, as dlsym would return
+#define PLUGIN_REGISTRY_DECLARE(name)                                                                          \
+    const char *name##_plugin_init(int queue_size);                                                             \
+    const char *name##_plugin_transform(const char *input);                                                     \
+    __attribute__((weak)) int name##_plugin_transform_inplace(char *buf, size_t len);                           \
+    __attribute__((weak)) int name##_plugin_transform_message(message_t *message);                              \
+    __attribute__((weak)) long name##_plugin_transform_batch(const char *input, const size_t *offsets,          \
+                                                             int count, char *output, size_t capacity,          \
+                                                             size_t *output_offsets);                           \
+    __attribute__((weak)) long name##_plugin_transform_paced(void *state, message_t *message,                   \
+                                                             unsigned int step);                                \
+    __attribute__((weak)) const plugin_capabilities_t *name##_plugin_capabilities(void);                        \
+    __attribute__((weak)) const char *name##_plugin_option(void *state, const char *key, const char *value);    \
+    __attribute__((weak)) void *name##_plugin_state_create(void);                                               \
+    __attribute__((weak)) void name##_plugin_state_destroy(void *state);                                        \
+                                                                                                                \
+    static const plugin_transforms_t name##_transforms = {                                                      \
+        name##_plugin_transform,                                                                                \
+        name##_plugin_transform_inplace,                                                                        \
+        name##_plugin_transform_message,                                                                        \
+        name##_plugin_transform_batch,                                                                          \
+        name##_plugin_transform_paced,                                                                          \
+    };                                                                                                          \
+    static const plugin_hooks_t name##_hooks = {                                                                \
+        name##_plugin_state_create,                                                                             \
+        name##_plugin_state_destroy,                                                                            \
+        name##_plugin_option,                                                                                   \
+    };                                                                                                          \
+                                                                                                                \
+    static const char *name##_instance_init(int queue_size, int replicas, void **instance)                      \
+    {                                                                                                           \
+        return plugin_static_instance_init(name##_plugin_init, &name##_transforms, &name##_hooks,               \
+                                           queue_size, replicas, instance);                                     \
+    }
+
+#define PLUGIN_REGISTRY_ENTRY(name) {#name, name##_instance_init, &name##_transforms, name##_plugin_capabilities},
+
+PLUGIN_REGISTRY_PLUGINS(PLUGIN_REGISTRY_DECLARE)
+
+static plugin_registry_entry_t registry[] = {PLUGIN_REGISTRY_PLUGINS(PLUGIN_REGISTRY_ENTRY)};
+
+const plugin_registry_entry_t *plugin_registry_find(const char *name)
+{
+    for (size_t i = 0; i < sizeof(registry) / sizeof(registry[0]); i++)
+    {
+        plugin_registry_entry_t *entry = &registry[i];
+        if (strcmp(entry->name, name) == 0)
+        {
+            // Every entry point but init is the runtime's own
+            if (entry->api.init == NULL)
+            {
+                entry->api = *plugin_instance_api();
+                entry->api.init = entry->init;
+            }
+            return entry;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,31 @@
+#ifndef PLUGIN_REGISTRY_H
+#define PLUGIN_REGISTRY_H
+#include "plugin_common.h"
+
+/*
+ * Plugins built into the analyzer (build.sh static). The host looks a stage
+ * up here before it tries dlopen, so the bundled plugins share the host's
+ * runtime and skip symbol lookup, while any other name still loads
+ * output/<name>.so.
+ */
+
+/**
+ * A built-in plugin: what pipeline_init would otherwise dlsym from its .so
+ */
+typedef struct
+{
+    const char *name;                                                   // Plugin name, as on the command line
+    const char *(*init)(int queue_size, int replicas, void **instance); // Creates an instance
+    const plugin_transforms_t *transforms;                              // For fusing it into another stage
+    const plugin_capabilities_t *(*capabilities)(void);                 // plugin_capabilities, or NULL
+    plugin_instance_api_t api;                                          // plugin_instance_api() with init set
+} plugin_registry_entry_t;
+
+/**
+ * Find a built-in plugin
+ * @param name Plugin name, without .so
+ * @return The plugin, NULL if it isn't built in
+ */
+const plugin_registry_entry_t *plugin_registry_find(const char *name);
+
+#endif
@@ -1,3 +1,28 @@
+#include <stddef.h>
+#include "sync/message.h"
+#include "plugin_common.h"
+
+/*
+ * Built-in plugins. build.sh static compiles the bundled plugins into the
+ * analyzer with PLUGIN_STATIC_NAME set to the plugin's name, which turns
+ * every export below into <name>_plugin_..., so several plugins link into
+ * one image without their symbols clashing. Plugin sources don't change.
+ */
+#ifdef PLUGIN_STATIC_NAME
+#define PLUGIN_STATIC_CONCAT(prefix, symbol) prefix##_##symbol
+#define PLUGIN_STATIC_SYMBOL(prefix, symbol) PLUGIN_STATIC_CONCAT(prefix, symbol)
+#define plugin_init PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_init)
+#define plugin_transform PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_transform)
+#define plugin_transform_inplace PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_transform_inplace)
+#define plugin_transform_message PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_transform_message)
+#define plugin_transform_batch PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_transform_batch)
+#define plugin_transform_paced PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_transform_paced)
+#define plugin_capabilities PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_capabilities)
+#define plugin_option PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_option)
+#define plugin_state_create PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_state_create)
+#define plugin_state_destroy PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_state_destroy)
+#endif
+
 /**
  * Get the plugin's name
  * @return The plugin's name (should not be modified or freed)
@@ -11,6 +36,104 @@ const char *plugin_get_name(void);
  */
 const char *plugin_init(int queue_size);
 
+/**
+ * Optional: transform a string in place, for plugins that never change its
+ * length. When a plugin exports it, its stage rewrites the buffer it took
+ * from the queue and forwards that same buffer instead of calling
+ * plugin_transform, which must still be exported.
+ * @param buf The string, modifiable and NUL terminated
+ * @param len strlen(buf)
+ * @return 0 on success, -1 on failure
+ */
+int plugin_transform_inplace(char *buf, size_t len);
+
+/**
+ * Optional: transform a message (see sync/message.h), which carries the
+ * string's length so the plugin doesn't have to scan for it. Preferred over
+ * plugin_transform_inplace and plugin_transform, which must still be
+ * exported for hosts that pass plain strings.
+ * @param message The input; rewrite its data in place or swap in new data
+ * with message_replace, or better a buffer from the message pool
+ * (message_buffer_alloc) with message_replace_buffer
+ * @return 0 on success, -1 on failure
+ */
+int plugin_transform_message(message_t *message);
+
+/**
+ * Optional: transform a whole batch of lines in one call. The lines come
+ * packed back to back, without NULs: line i is the offsets[i + 1] -
+ * offsets[i] bytes at input + offsets[i]. The outputs are written the same
+ * way into output, with their offsets in output_offsets. Preferred over
+ * plugin_transform, which must still be exported; plugin_transform_message
+ * and plugin_transform_inplace are preferred over it, as they don't copy
+ * the lines into the batch and back.
+ * @param input The lines
+ * @param offsets count + 1 offsets into input, offsets[0] is 0
+ * @param count Number of lines
+ * @param output Buffer for the outputs
+ * @param capacity Bytes output holds
+ * @param output_offsets Receives count + 1 offsets into output
+ * @return Bytes the outputs take; if that is more than capacity the call
+ * may have written nothing and is made again with enough room. -1 on
+ * failure.
+ */
+long plugin_transform_batch(const char *input, const size_t *offsets, int count, char *output, size_t capacity,
+                            size_t *output_offsets);
+
+/**
+ * Optional: a transform that takes time without spending it, for plugins
+ * that delay or pace their output. Instead of sleeping it returns how long
+ * to wait before its next step; the stage calls it again for the message
+ * after that long, and takes other messages meanwhile, up to the stage's
+ * inflight option (1 unless the host raises it). Messages leave the stage
+ * in input order. Preferred over the other transforms when the stage has a
+ * thread or task of its own; they must still be exported, and a replicated
+ * or fused stage uses them instead.
+ * @param state The stage's state, see plugin_state_create
+ * @param message The input, transformed like by plugin_transform_message;
+ * release it (message_release) and return 0 to drop it
+ * @param step 0 on the first call for the message, counting up
+ * @return Microseconds until the next step, 0 once the message is done, -1 on failure
+ */
+long plugin_transform_paced(void *state, message_t *message, unsigned int step);
+
+/**
+ * Optional: describe the plugin to the host. Without it the host assumes
+ * nothing and leaves fusion and replication to the configuration. With it,
+ * analyzer --fuse leaves blocking and expensive stages on their own
+ * threads, replicas=auto replicates expensive or blocking stages that are
+ * stateless and thread safe, and replicas > 1 is refused for the others.
+ * @return Static descriptor, PLUGIN_CAP_* flags and a cost class
+ */
+const plugin_capabilities_t *plugin_capabilities(void);
+
+/**
+ * Optional: take a setting of the plugin's own. A stage option the runtime
+ * doesn't know (see plugin_set_option in plugin_common.h) comes here, e.g.
+ * from a --config line.
+ * @param state The stage's state, see plugin_state_create
+ * @param key Option name
+ * @param value Option value
+ * @return NULL on success, error message on failure ("Unknown option" for a key it doesn't know)
+ */
+const char *plugin_option(void *state, const char *key, const char *value);
+
+/**
+ * Optional: create the state of one stage, for a plugin whose settings and
+ * bookkeeping belong to a stage instead of the process. Each stage makes
+ * its own when it is initialized and hands it to plugin_option and
+ * plugin_transform_paced; the other transforms don't get it, so a stage
+ * with state can't be replicated.
+ * @return The state, NULL if it can't be made
+ */
+void *plugin_state_create(void);
+
+/**
+ * Optional, with plugin_state_create: free a stage's state once the stage is finalized
+ * @param state What plugin_state_create returned
+ */
+void plugin_state_destroy(void *state);
+
 /**
  * Finalize the plugin - terminate thread gracefully
  * @return NULL on success, error message on failure
@@ -0,0 +1,242 @@
+#include "plugin_common.h"
+#include "plugin_sdk.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Token buckets: lines and bytes refill at their budget per second up to
+// their burst, and a line takes one line token and its length in byte
+// tokens. A line longer than the byte burst waits for a full bucket and
+// leaves it in debt. A budget of 0 doesn't limit.
+typedef struct
+{
+    double rate;   // Tokens per second, 0 for no limit
+    double burst;  // Most tokens the bucket holds
+    double tokens; // Tokens now, below 0 while in debt
+} bucket_t;
+
+typedef enum
+{
+    LIMIT_BLOCK, // A line waits for its tokens, and the stage takes nothing else meanwhile
+    LIMIT_DROP,  // A line without its tokens is dropped
+    LIMIT_DELAY, // A line takes its tokens ahead and waits until they are earned, while
+                 // the stage takes more lines, up to its inflight option
+} limit_mode_t;
+
+// The budget of one stage, see plugin_state_create
+typedef struct
+{
+    pthread_mutex_t lock;
+    bucket_t lines;
+    bucket_t bytes;
+    int burst_bytes_given;
+    limit_mode_t mode;
+    unsigned long refilled_ns;
+} limiter_t;
+
+static unsigned long now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)now.tv_sec * 1000000000UL + (unsigned long)now.tv_nsec;
+}
+
+static void refill(bucket_t *bucket, unsigned long elapsed_ns)
+{
+    bucket->tokens += bucket->rate * (double)elapsed_ns / 1e9;
+    if (bucket->tokens > bucket->burst)
+    {
+        bucket->tokens = bucket->burst;
+    }
+}
+
+// Microseconds until a bucket holds needed tokens, at least 1; 0 if it does now
+static long wait_us(const bucket_t *bucket, double needed)
+{
+    if (bucket->rate == 0 || bucket->tokens >= needed)
+    {
+        return 0;
+    }
+    return (long)((needed - bucket->tokens) / bucket->rate * 1e6) + 1;
+}
+
+// Spends a line of len bytes, or says how long until it may. Called with the limiter's lock held
+static long take(limiter_t *limiter, size_t len, int ahead)
+{
+    unsigned long now = now_ns();
+    refill(&limiter->lines, now - limiter->refilled_ns);
+    refill(&limiter->bytes, now - limiter->refilled_ns);
+    limiter->refilled_ns = now;
+
+    double byte_need = (double)len < limiter->bytes.burst ? (double)len : limiter->bytes.burst;
+    long wait = wait_us(&limiter->lines, 1);
+    long byte_wait = wait_us(&limiter->bytes, byte_need);
+    wait = byte_wait > wait ? byte_wait : wait;
+    if (wait > 0 && !ahead)
+    {
+        return wait;
+    }
+    if (limiter->lines.rate > 0)
+    {
+        limiter->lines.tokens -= 1;
+    }
+    if (limiter->bytes.rate > 0)
+    {
+        limiter->bytes.tokens -= (double)len;
+    }
+    return ahead ? wait : 0;
+}
+
+// How long a line waits before its step: block retries until it has its
+// tokens, delay takes them on the first step and waits until they are
+// earned, drop never waits. Returns -2 for a line to drop.
+static long pace(limiter_t *limiter, size_t len, unsigned int step)
+{
+    pthread_mutex_lock(&limiter->lock);
+    long wait = 0;
+    if (limiter->mode == LIMIT_DELAY)
+    {
+        wait = step == 0 ? take(limiter, len, 1) : 0;
+    }
+    else
+    {
+        wait = take(limiter, len, 0);
+        if (wait > 0 && limiter->mode == LIMIT_DROP)
+        {
+            wait = -2;
+        }
+    }
+    pthread_mutex_unlock(&limiter->lock);
+    return wait;
+}
+
+long plugin_transform_paced(void *state, message_t *message, unsigned int step)
+{
+    long wait = pace(state, message->len, step);
+    if (wait == -2)
+    {
+        message_release(message);
+        return 0;
+    }
+    return wait;
+}
+
+// The budget is the stage's, which only plugin_transform_paced gets: a stage
+// with state is never fused or replicated, so no line should come here
+const char *plugin_transform(const char *input)
+{
+    (void)input;
+    return NULL;
+}
+
+void *plugin_state_create(void)
+{
+    limiter_t *limiter = calloc(1, sizeof(limiter_t));
+    if (!limiter)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&limiter->lock, NULL);
+    limiter->lines = (bucket_t){0, 1, 1};
+    limiter->mode = LIMIT_BLOCK;
+    return limiter;
+}
+
+void plugin_state_destroy(void *state)
+{
+    limiter_t *limiter = state;
+    pthread_mutex_destroy(&limiter->lock);
+    free(limiter);
+}
+
+// Parses a non-negative whole number of at most 1e9
+static int parse_amount(const char *value, double *amount)
+{
+    char *end;
+    long parsed = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || parsed < 0 || parsed > 1000000000L)
+    {
+        return -1;
+    }
+    *amount = (double)parsed;
+    return 0;
+}
+
+const char *plugin_option(void *state, const char *key, const char *value)
+{
+    limiter_t *limiter = state;
+    double amount = 0;
+    const char *error = NULL;
+    pthread_mutex_lock(&limiter->lock);
+    if (strcmp(key, "mode") == 0)
+    {
+        static const char *names[] = {"block", "drop", "delay"};
+        error = "Unknown mode (expected block, drop or delay)";
+        for (int i = 0; i < 3; i++)
+        {
+            if (strcmp(value, names[i]) == 0)
+            {
+                limiter->mode = (limit_mode_t)i;
+                error = NULL;
+            }
+        }
+    }
+    else if (strcmp(key, "rate") == 0 || strcmp(key, "bytes") == 0 || strcmp(key, "burst") == 0 ||
+             strcmp(key, "burst_bytes") == 0)
+    {
+        if (parse_amount(value, &amount) != 0)
+        {
+            error = "Value must be a whole number from 0 to 1000000000";
+        }
+        else if (strcmp(key, "rate") == 0)
+        {
+            limiter->lines.rate = amount;
+        }
+        else if (strcmp(key, "bytes") == 0)
+        {
+            limiter->bytes.rate = amount;
+            if (!limiter->burst_bytes_given)
+            {
+                limiter->bytes.burst = limiter->bytes.tokens = amount; // One second's worth
+            }
+        }
+        else if (amount < 1)
+        {
+            error = "Burst must be at least 1";
+        }
+        else if (strcmp(key, "burst") == 0)
+        {
+            limiter->lines.burst = limiter->lines.tokens = amount;
+        }
+        else
+        {
+            limiter->bytes.burst = limiter->bytes.tokens = amount;
+            limiter->burst_bytes_given = 1;
+        }
+    }
+    else
+    {
+        error = "Unknown option";
+    }
+    limiter->refilled_ns = now_ns();
+    pthread_mutex_unlock(&limiter->lock);
+    return error;
+}
+
+const plugin_capabilities_t *plugin_capabilities(void)
+{
+    // One budget per stage, so it can't be split over replicas
+    static const plugin_capabilities_t capabilities = {
+        PLUGIN_CAP_LENGTH_PRESERVING | PLUGIN_CAP_BLOCKING | PLUGIN_CAP_PACED,
+        PLUGIN_COST_CHEAP,
+    };
+    return &capabilities;
+}
+
+__attribute__((visibility("default")))
+const char *
+plugin_init(int queue_size)
+{
+    return common_plugin_init(plugin_transform, "ratelimiter", queue_size);
+}
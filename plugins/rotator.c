@@ -2,27 +2,36 @@
 #include "plugin_sdk.h"
 #include <string.h>
 
+int plugin_transform_inplace(char *buf, size_t len)
+{
+    if (len <= 1)
+    {
+        return 0;
+    }
+    char lastChar = buf[len - 1];
+    memmove(buf + 1, buf, len - 1);
+    buf[0] = lastChar;
+    return 0;
+}
+
 const char *plugin_transform(const char *input)
 {
     char *output = strdup(input);
     if (!output)
         return NULL;
 
-    int stringLength = strlen(output);
-    if (stringLength <= 1)
-    {
-        return output;
-    }
-    char lastChar = output[stringLength - 1];
-
-    for (int i = stringLength - 1; i > 0; i--)
-    {
-        output[i] = output[i - 1];
-    }
-    output[0] = lastChar;
-
+    plugin_transform_inplace(output, strlen(output));
     return output;
 }
+const plugin_capabilities_t *plugin_capabilities(void)
+{
+    static const plugin_capabilities_t capabilities = {
+        PLUGIN_CAP_STATELESS | PLUGIN_CAP_THREAD_SAFE | PLUGIN_CAP_LENGTH_PRESERVING | PLUGIN_CAP_INPLACE,
+        PLUGIN_COST_CHEAP,
+    };
+    return &capabilities;
+}
+
 __attribute__((visibility("default")))
 const char *
 plugin_init(int queue_size)
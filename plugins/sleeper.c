@@ -19,17 +19,33 @@ const char *plugin_transform(const char *input)
     char *aexpand_str = malloc(len + 1);
     if (!aexpand_str)
     {
-        log_error(NULL, "Error: Memory allocation for the expanded string failed");
-        return input;
+        return NULL;
     }
 
     strcpy(aexpand_str, input);
-    aexpand_str[len + 1] = '\0';
 
     return aexpand_str;
 }
 
+// Holds each line for the same time without sleeping, so lines held together overlap
+long plugin_transform_paced(void *state, message_t *message, unsigned int step)
+{
+    (void)state;
+    (void)message;
+    return step == 0 ? SECOND * 5 * 1000000L : 0;
+}
+
+const plugin_capabilities_t *plugin_capabilities(void)
+{
+    static const plugin_capabilities_t capabilities = {
+        PLUGIN_CAP_STATELESS | PLUGIN_CAP_THREAD_SAFE | PLUGIN_CAP_LENGTH_PRESERVING | PLUGIN_CAP_BLOCKING |
+            PLUGIN_CAP_PACED,
+        PLUGIN_COST_EXPENSIVE,
+    };
+    return &capabilities;
+}
+
 const char *plugin_init(int queue_size)
 {
     return common_plugin_init(plugin_transform, "<sleeplug>", queue_size);
-}
\ No newline at end of file
+}
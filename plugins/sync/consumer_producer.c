@@ -1,9 +1,21 @@
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "consumer_producer.h"
+#include "topology.h"
+
+#define SPSC_MAX_CAPACITY (1u << 30)
+#define SPSC_INLINE_GET_MAX 64 // Items an SPSC get with inline slots takes at once
 
 const char *consumer_producer_init(consumer_producer_t *queue, int capacity)
+{
+    return consumer_producer_init_mode(queue, capacity, CONSUMER_PRODUCER_MPMC);
+}
+
+const char *consumer_producer_init_mode(consumer_producer_t *queue, int capacity,
+                                        consumer_producer_mode_t mode)
 {
     if (queue == NULL)
     {
@@ -15,45 +27,85 @@ const char *consumer_producer_init(consumer_producer_t *queue, int capacity)
         return "Queue capacity can only be a positive number";
     }
 
-    queue->items = malloc(capacity * sizeof(char *));
-    if (queue->items == NULL)
+    // The SPSC ring is sized to the next power of two so indices can be masked
+    unsigned int slots = (unsigned int)capacity;
+    if (mode == CONSUMER_PRODUCER_SPSC)
     {
-        return "Failed to allocate memory for items array";
+        if ((unsigned int)capacity > SPSC_MAX_CAPACITY)
+        {
+            return "Queue capacity is too large for a ring";
+        }
+        slots = 1;
+        while (slots < (unsigned int)capacity)
+        {
+            slots <<= 1;
+        }
     }
 
-    for (int i = 0; i < capacity; i++)
+    queue->items = calloc(slots, sizeof(message_t));
+    if (queue->items == NULL)
     {
-        queue->items[i] = NULL;
+        return "Failed to allocate memory for items array";
     }
 
     queue->capacity = capacity;
     queue->count = 0;
     queue->head = 0;
     queue->tail = 0;
+    queue->mode = mode;
+    queue->mask = slots - 1;
+    queue->inline_slots = NULL;
+    queue->inline_size = 0;
+    queue->inline_stride = 0;
+    queue->node = -1;
+    atomic_init(&queue->ring_head, 0);
+    atomic_init(&queue->ring_tail, 0);
+    atomic_init(&queue->finished, 0);
+    atomic_init(&queue->wait_strategy, CONSUMER_PRODUCER_WAIT_BLOCK);
+    atomic_init(&queue->spin_limit, CONSUMER_PRODUCER_DEFAULT_SPIN);
+    atomic_init(&queue->overflow, CONSUMER_PRODUCER_OVERFLOW_BLOCK);
+    atomic_init(&queue->sample_rate, CONSUMER_PRODUCER_DEFAULT_SAMPLE);
+    atomic_init(&queue->dropped_oldest, 0);
+    atomic_init(&queue->dropped_newest, 0);
+    atomic_init(&queue->total_put, 0);
+    atomic_init(&queue->total_got, 0);
+    atomic_init(&queue->high_water, 0);
+    atomic_init(&queue->producer_blocked_ns, 0);
+    atomic_init(&queue->consumer_blocked_ns, 0);
+    queue->sample_seed = 2463534242u;
+    for (int i = 0; i < CONSUMER_PRODUCER_PHASES; i++)
+    {
+        atomic_init(&queue->consumer_waits[i], 0);
+        atomic_init(&queue->producer_waits[i], 0);
+    }
 
-    if (monitor_init(&queue->not_empty_monitor) != 0)
+    if (eventcount_init(&queue->not_empty_event) != 0)
     {
-        return "Failed to initialize not_empty_monitor";
+        free(queue->items);
+        return "Failed to initialize not_empty_event";
     }
 
-    if (monitor_init(&queue->not_full_monitor) != 0)
+    if (eventcount_init(&queue->not_full_event) != 0)
     {
-        monitor_destroy(&queue->not_empty_monitor);
-        return "Failed to initialize not_full_monitor";
+        eventcount_destroy(&queue->not_empty_event);
+        free(queue->items);
+        return "Failed to initialize not_full_event";
     }
 
     if (monitor_init(&queue->finished_monitor) != 0)
     {
-        monitor_destroy(&queue->not_empty_monitor);
-        monitor_destroy(&queue->not_full_monitor);
+        eventcount_destroy(&queue->not_empty_event);
+        eventcount_destroy(&queue->not_full_event);
+        free(queue->items);
         return "Failed to initialize finished_monitor";
     }
 
     if (pthread_mutex_init(&queue->queue_lock, NULL) != 0)
     {
-        monitor_destroy(&queue->not_empty_monitor);
-        monitor_destroy(&queue->not_full_monitor);
+        eventcount_destroy(&queue->not_empty_event);
+        eventcount_destroy(&queue->not_full_event);
         monitor_destroy(&queue->finished_monitor);
+        free(queue->items);
         return "Failed to initialize queue mutex";
     }
 
@@ -67,102 +119,1129 @@ void consumer_producer_destroy(consumer_producer_t *queue)
         return;
     }
     monitor_destroy(&queue->finished_monitor);
-    monitor_destroy(&queue->not_full_monitor);
-    monitor_destroy(&queue->not_empty_monitor);
+    eventcount_destroy(&queue->not_full_event);
+    eventcount_destroy(&queue->not_empty_event);
     pthread_mutex_destroy(&queue->queue_lock);
     free(queue->items);
+    free(queue->inline_slots);
 }
 
-const char *consumer_producer_put(consumer_producer_t *queue, const char *item)
+/*
+ * Wait strategies. Every wait loop first re-checks its condition, then asks
+ * wait_backoff() whether to spin or yield once more before it registers on
+ * the eventcount and sleeps. The phase a wait was in when the condition came
+ * true is counted once the wait is over, and so is the time spent waiting;
+ * the clock is only read once a wait actually has to back off.
+ */
+
+typedef struct
 {
-    if (queue == NULL)
+    int phase;          /* CONSUMER_PRODUCER_PHASE_* reached so far */
+    int rounds;         /* Backoff rounds done */
+    long blocked_since; /* CLOCK_MONOTONIC ns of the first backoff, 0 while not waiting */
+} wait_state_t;
+
+static long now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Does one spin/yield round if the strategy allows it. Returns 0 when the caller should sleep
+static int wait_backoff(consumer_producer_t *queue, wait_state_t *state)
+{
+    consumer_producer_wait_strategy_t strategy = atomic_load_explicit(&queue->wait_strategy, memory_order_relaxed);
+    int spin_limit = atomic_load_explicit(&queue->spin_limit, memory_order_relaxed);
+
+    if (state->blocked_since == 0)
     {
-        return "Null Queue pointer";
+        state->blocked_since = now_ns();
     }
 
-    if (item == NULL)
+    switch (strategy)
     {
-        return "NULL Item pointer";
+    case CONSUMER_PRODUCER_WAIT_POLL:
+        state->phase = CONSUMER_PRODUCER_PHASE_SPIN;
+        return 1;
+    case CONSUMER_PRODUCER_WAIT_SPIN:
+    case CONSUMER_PRODUCER_WAIT_ADAPTIVE:
+        if (state->rounds < spin_limit)
+        {
+            state->phase = CONSUMER_PRODUCER_PHASE_SPIN;
+            state->rounds++;
+            cpu_relax();
+            return 1;
+        }
+        if (strategy == CONSUMER_PRODUCER_WAIT_ADAPTIVE &&
+            state->rounds < spin_limit + CONSUMER_PRODUCER_YIELD_ROUNDS)
+        {
+            state->phase = CONSUMER_PRODUCER_PHASE_YIELD;
+            state->rounds++;
+            sched_yield();
+            return 1;
+        }
+        return 0;
+    case CONSUMER_PRODUCER_WAIT_BLOCK:
+    default:
+        return 0;
     }
+}
+
+static void wait_done(atomic_ulong *counters, const wait_state_t *state)
+{
+    atomic_fetch_add_explicit(&counters[state->phase], 1, memory_order_relaxed);
+}
 
-    if (queue->finished_monitor.signaled == 1)
+// Adds the time a wait spent backing off to blocked_ns and passes status through
+static int wait_end(atomic_ulong *blocked_ns, const wait_state_t *state, int status)
+{
+    if (state->blocked_since != 0)
     {
-        return "Can't add items after finish";
+        atomic_fetch_add_explicit(blocked_ns, now_ns() - state->blocked_since, memory_order_relaxed);
     }
+    return status;
+}
 
-    pthread_mutex_lock(&queue->queue_lock);
+// Raises the high-water mark, only ever called by one producer at a time
+static void note_depth(consumer_producer_t *queue, unsigned long depth)
+{
+    if (depth > atomic_load_explicit(&queue->high_water, memory_order_relaxed))
+    {
+        atomic_store_explicit(&queue->high_water, depth, memory_order_relaxed);
+    }
+}
+
+/* Outcome of a put/get, the values the timed public functions return */
+enum
+{
+    STATUS_FAILED = -1, /* Error, or the queue finished (and, for gets, is drained) */
+    STATUS_OK = 0,
+    STATUS_TIMEOUT = 1 /* The deadline passed first */
+};
+
+// The scheduler's (see scheduler.h), when it is linked in or the host exports it. Weak, so the
+// queue links without it and a put that waits for room just sleeps
+__attribute__((weak)) void scheduler_block_begin(void);
+__attribute__((weak)) void scheduler_block_end(void);
+
+// Waits for room, and if the caller is a scheduler worker lends its CPU out
+// meanwhile: the consumer may need it to make room
+static void wait_not_full(consumer_producer_t *queue, unsigned int key, const struct timespec *deadline)
+{
+    if (scheduler_block_begin)
+    {
+        scheduler_block_begin();
+    }
+    eventcount_wait_until(&queue->not_full_event, key, deadline);
+    if (scheduler_block_end)
+    {
+        scheduler_block_end();
+    }
+}
+
+// Returns 1 once an absolute CLOCK_MONOTONIC deadline has passed, a NULL deadline never does
+static int deadline_passed(const struct timespec *deadline)
+{
+    if (deadline == NULL)
+    {
+        return 0;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > deadline->tv_sec ||
+           (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+// An already expired deadline, turns a timed call into a non-blocking one
+static const struct timespec expired_deadline = {0, 0};
+
+/*
+ * SPSC ring. The producer owns ring_tail and the consumer owns ring_head, so
+ * neither side needs a lock. A side that finds the ring full/empty registers
+ * on the matching eventcount and re-checks before sleeping; the other side
+ * publishes its index and then notifies, which costs no syscall unless
+ * somebody is registered. Since a side only registers after seeing the ring
+ * empty (or full), a notify only ever reaches the kernel on an
+ * empty->non-empty (or full->non-full) transition.
+ *
+ * The one exception to single ownership is the drop-oldest overflow policy,
+ * where the producer advances ring_head to evict an item. The consumer
+ * therefore claims items with a CAS on ring_head, and slot fields are
+ * accessed atomically because an evicted slot can be refilled while a
+ * consumer whose CAS is about to fail still reads it.
+ */
+
+// Stores a message in a slot; data goes last and publishes the rest
+static void store_slot(message_t *slot, const message_t *message)
+{
+    __atomic_store_n(&slot->len, message->len, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->cap, message->cap, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->flags, message->flags, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->data, message->data, __ATOMIC_RELEASE);
+}
+
+static void load_slot(const message_t *slot, message_t *message)
+{
+    message->data = __atomic_load_n(&slot->data, __ATOMIC_ACQUIRE);
+    message->len = __atomic_load_n(&slot->len, __ATOMIC_RELAXED);
+    message->cap = __atomic_load_n(&slot->cap, __ATOMIC_RELAXED);
+    message->flags = __atomic_load_n(&slot->flags, __ATOMIC_RELAXED);
+}
+
+// Waits until the ring has room and stores the number of free slots in room
+static int spsc_wait_not_full(consumer_producer_t *queue, unsigned int tail,
+                              const struct timespec *deadline, unsigned int *room)
+{
+    unsigned int capacity = (unsigned int)queue->capacity;
+    wait_state_t state = {CONSUMER_PRODUCER_PHASE_IMMEDIATE, 0, 0};
+
+    for (;;)
+    {
+        if (atomic_load(&queue->finished))
+        {
+            return wait_end(&queue->producer_blocked_ns, &state, STATUS_FAILED);
+        }
+        unsigned int head = atomic_load_explicit(&queue->ring_head, memory_order_acquire);
+        if (tail - head < capacity)
+        {
+            wait_done(queue->producer_waits, &state);
+            *room = capacity - (tail - head);
+            return wait_end(&queue->producer_blocked_ns, &state, STATUS_OK);
+        }
+        if (deadline_passed(deadline))
+        {
+            return wait_end(&queue->producer_blocked_ns, &state, STATUS_TIMEOUT);
+        }
+        if (wait_backoff(queue, &state))
+        {
+            continue;
+        }
+
+        state.phase = CONSUMER_PRODUCER_PHASE_PARK;
+        unsigned int key = eventcount_prepare_wait(&queue->not_full_event);
+        head = atomic_load(&queue->ring_head);
+        if (tail - head < capacity || atomic_load(&queue->finished))
+        {
+            eventcount_cancel_wait(&queue->not_full_event);
+            continue;
+        }
+        wait_not_full(queue, key, deadline);
+    }
+}
+
+// Waits until the ring has items and stores how many are readable in available
+static int spsc_wait_not_empty(consumer_producer_t *queue, unsigned int head,
+                               const struct timespec *deadline, unsigned int *available)
+{
+    wait_state_t state = {CONSUMER_PRODUCER_PHASE_IMMEDIATE, 0, 0};
+
+    for (;;)
+    {
+        // Read finished before tail: items put before the finish signal must still be drained
+        int finished = atomic_load(&queue->finished);
+        unsigned int tail = atomic_load_explicit(&queue->ring_tail, memory_order_acquire);
+        if (tail != head)
+        {
+            wait_done(queue->consumer_waits, &state);
+            *available = tail - head;
+            return wait_end(&queue->consumer_blocked_ns, &state, STATUS_OK);
+        }
+        if (finished)
+        {
+            return wait_end(&queue->consumer_blocked_ns, &state, STATUS_FAILED);
+        }
+        if (deadline_passed(deadline))
+        {
+            return wait_end(&queue->consumer_blocked_ns, &state, STATUS_TIMEOUT);
+        }
+        if (wait_backoff(queue, &state))
+        {
+            continue;
+        }
+
+        state.phase = CONSUMER_PRODUCER_PHASE_PARK;
+        unsigned int key = eventcount_prepare_wait(&queue->not_empty_event);
+        finished = atomic_load(&queue->finished);
+        tail = atomic_load(&queue->ring_tail);
+        if (tail != head || finished)
+        {
+            eventcount_cancel_wait(&queue->not_empty_event);
+            continue;
+        }
+        eventcount_wait_until(&queue->not_empty_event, key, deadline);
+    }
+}
+
+/*
+ * The queue stores messages. Items come in as messages, or as strings that
+ * are copied or handed over, and leave as either; these adapters convert at
+ * the edges so the backends only move messages.
+ */
+
+typedef struct
+{
+    const char *const *strings; /* Items given as strings, NULL when given as messages */
+    message_t *messages;        /* Items given as messages, always handed over */
+    int owned;                  /* The strings are handed over */
+} put_source_t;
+
+typedef struct
+{
+    char **strings;      /* Where string gets store items, NULL when messages are wanted */
+    message_t *messages; /* Where message gets store items */
+} get_target_t;
+
+// Fills in the message to store for item i: the item itself when ownership is handed over, a copy otherwise
+static int claim_item(const put_source_t *source, int i, message_t *message)
+{
+    if (source->messages)
+    {
+        *message = source->messages[i];
+        return 0;
+    }
+    if (source->owned)
+    {
+        message_adopt(message, (char *)source->strings[i]);
+        return 0;
+    }
+    return message_copy(message, source->strings[i], strlen(source->strings[i]));
+}
+
+// Frees items that were handed over but never made it into the queue
+static void release_items(const put_source_t *source, int from, int n)
+{
+    for (int i = from; i < from + n; i++)
+    {
+        if (source->messages)
+        {
+            message_release(&source->messages[i]);
+        }
+        else if (source->owned)
+        {
+            free((void *)source->strings[i]);
+        }
+    }
+}
+
+// Copies item i of a put into slot index when it is short enough, else
+// claims it. An inline message has cap 0 and its data in the slot
+static int fill_slot(consumer_producer_t *queue, const put_source_t *source, int i, unsigned int index,
+                     message_t *message)
+{
+    if (queue->inline_size == 0)
+    {
+        return claim_item(source, i, message);
+    }
+    const char *data = source->messages ? source->messages[i].data : source->strings[i];
+    size_t len = source->messages ? source->messages[i].len : strlen(data);
+    if (len >= queue->inline_size)
+    {
+        return claim_item(source, i, message);
+    }
+
+    message->data = queue->inline_slots + (size_t)index * queue->inline_stride;
+    memcpy(message->data, data, len + 1);
+    message->len = len;
+    message->cap = 0;
+    message->flags = source->messages ? source->messages[i].flags : 0;
+    release_items(source, i, 1); // The original buffer is no longer needed
+    return 0;
+}
+
+// Frees what a slot's message owns, inline payloads belong to the queue
+static void release_slot(message_t *slot)
+{
+    if (slot->cap == 0)
+    {
+        slot->data = NULL;
+        return;
+    }
+    message_release(slot);
+}
+
+// Hands item i of a get over to the caller, copying an inline payload out of its slot
+static int deliver_item(const get_target_t *target, int i, const message_t *message)
+{
+    message_t item = *message;
+    if (item.cap == 0)
+    {
+        item.data = message_buffer_alloc(item.len + 1, &item.cap);
+        if (item.data == NULL)
+        {
+            return -1;
+        }
+        memcpy(item.data, message->data, item.len + 1);
+    }
+
+    if (target->messages)
+    {
+        target->messages[i] = item;
+    }
+    else
+    {
+        target->strings[i] = item.data;
+    }
+    return 0;
+}
+
+// Gives back item i of a get that didn't happen after all
+static void undeliver_item(const get_target_t *target, int i)
+{
+    if (target->messages)
+    {
+        message_release(&target->messages[i]);
+    }
+    else
+    {
+        free(target->strings[i]);
+    }
+}
+
+/*
+ * Overflow policies. A put that finds the queue full under a dropping policy
+ * either makes room by evicting the oldest item or discards the item it was
+ * about to add, and goes on without waiting.
+ */
+
+// xorshift32, only called by the producer (SPSC) or under queue_lock (MPMC)
+static unsigned int next_random(consumer_producer_t *queue)
+{
+    unsigned int x = queue->sample_seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    queue->sample_seed = x;
+    return x;
+}
+
+// Returns 1 if the item that found the queue full should evict the oldest, 0 if it should be discarded
+static int overflow_keeps_item(consumer_producer_t *queue, consumer_producer_overflow_t policy)
+{
+    switch (policy)
+    {
+    case CONSUMER_PRODUCER_OVERFLOW_DROP_OLDEST:
+        return 1;
+    case CONSUMER_PRODUCER_OVERFLOW_SAMPLE:
+        return next_random(queue) % (unsigned int)atomic_load_explicit(&queue->sample_rate, memory_order_relaxed) == 0;
+    default:
+        return 0;
+    }
+}
+
+// Discards an item instead of queueing it
+static void drop_newest(consumer_producer_t *queue, const put_source_t *source, int i)
+{
+    release_items(source, i, 1);
+    atomic_fetch_add_explicit(&queue->dropped_newest, 1, memory_order_relaxed);
+}
+
+// Evicts the oldest item of a full ring, fails if the consumer took it first
+static void spsc_drop_oldest(consumer_producer_t *queue, unsigned int tail)
+{
+    unsigned int head = atomic_load(&queue->ring_head);
+    if (tail - head < (unsigned int)queue->capacity)
+    {
+        return; // The consumer made room meanwhile
+    }
+    char *oldest = __atomic_load_n(&queue->items[head & queue->mask].data, __ATOMIC_ACQUIRE);
+    size_t cap = __atomic_load_n(&queue->items[head & queue->mask].cap, __ATOMIC_RELAXED);
+    if (atomic_compare_exchange_strong(&queue->ring_head, &head, head + 1))
+    {
+        if (cap != 0) // An inline payload is simply overwritten
+        {
+            message_buffer_free(oldest, cap);
+        }
+        atomic_fetch_add_explicit(&queue->dropped_oldest, 1, memory_order_relaxed);
+    }
+}
+
+// Called with queue_lock held on a full queue
+static void mpmc_drop_oldest(consumer_producer_t *queue)
+{
+    release_slot(&queue->items[queue->head]);
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    atomic_fetch_add_explicit(&queue->dropped_oldest, 1, memory_order_relaxed);
+}
+
+// Error message for a wait that ended without the queue becoming ready
+static const char *wait_error(int status)
+{
+    return status == STATUS_TIMEOUT ? "Timed out waiting for a free slot" : "Queue finished while waiting";
+}
+
+static int spsc_put_batch(consumer_producer_t *queue, const put_source_t *source, int n,
+                          consumer_producer_overflow_t policy, const struct timespec *deadline,
+                          const char **error)
+{
+    unsigned int tail = atomic_load_explicit(&queue->ring_tail, memory_order_relaxed);
+
+    if (atomic_load(&queue->finished))
+    {
+        release_items(source, 0, n);
+        *error = "Can't add items after finish";
+        return STATUS_FAILED;
+    }
+
+    // A dropping policy never waits for room
+    const struct timespec *wait_deadline = policy == CONSUMER_PRODUCER_OVERFLOW_BLOCK ? deadline : &expired_deadline;
+
+    int done = 0;
+    while (done < n)
+    {
+        unsigned int room = 0;
+        int status = spsc_wait_not_full(queue, tail, wait_deadline, &room);
+        if (status == STATUS_TIMEOUT && policy != CONSUMER_PRODUCER_OVERFLOW_BLOCK)
+        {
+            if (overflow_keeps_item(queue, policy))
+            {
+                spsc_drop_oldest(queue, tail);
+            }
+            else
+            {
+                drop_newest(queue, source, done++);
+            }
+            continue;
+        }
+        if (status != STATUS_OK)
+        {
+            release_items(source, done, n - done);
+            *error = wait_error(status);
+            return status;
+        }
+
+        // Fill every free slot we saw, then publish them with a single tail store
+        *error = NULL;
+        unsigned int start = tail;
+        while (room > 0 && done < n)
+        {
+            message_t message;
+            if (fill_slot(queue, source, done, tail & queue->mask, &message) != 0)
+            {
+                *error = "Error: Memory allocation for string failed";
+                break;
+            }
+            store_slot(&queue->items[tail & queue->mask], &message);
+            tail++;
+            room--;
+            done++;
+        }
+
+        if (tail != start)
+        {
+            // Counted before they are published, so whoever takes them also sees them counted
+            atomic_fetch_add_explicit(&queue->total_put, tail - start, memory_order_relaxed);
+            atomic_store(&queue->ring_tail, tail);
+            eventcount_notify(&queue->not_empty_event);
+            // Right after the tail store the ring held at least this run, and still holds tail - head
+            unsigned int depth = tail - atomic_load_explicit(&queue->ring_head, memory_order_relaxed);
+            note_depth(queue, depth > tail - start ? depth : tail - start);
+        }
+        if (*error)
+        {
+            return STATUS_FAILED;
+        }
+    }
+    return STATUS_OK;
+}
+
+static int spsc_get_batch(consumer_producer_t *queue, const get_target_t *target, int max,
+                          const struct timespec *deadline, int *taken)
+{
+    unsigned int head = atomic_load(&queue->ring_head);
+    unsigned int available = 0;
+
+    *taken = 0;
+    for (;;)
+    {
+        int status = spsc_wait_not_empty(queue, head, deadline, &available);
+        if (status != STATUS_OK)
+        {
+            return status;
+        }
+
+        unsigned int n = available < (unsigned int)max ? available : (unsigned int)max;
+        if (queue->inline_size > 0 && n > SPSC_INLINE_GET_MAX)
+        {
+            n = SPSC_INLINE_GET_MAX; // copied must have a bit for each
+        }
+        unsigned long long copied = 0;
+        for (unsigned int i = 0; i < n; i++)
+        {
+            message_t message;
+            load_slot(&queue->items[(head + i) & queue->mask], &message);
+            if (deliver_item(target, (int)i, &message) != 0)
+            {
+                n = i; // Out of memory: take what was delivered, the rest stays queued
+                break;
+            }
+            copied |= (unsigned long long)(message.cap == 0) << i;
+        }
+        if (n == 0)
+        {
+            return STATUS_FAILED;
+        }
+        // Only fails if a drop-oldest producer evicted some of them, head is reloaded then
+        if (atomic_compare_exchange_strong(&queue->ring_head, &head, head + n))
+        {
+            *taken = (int)n;
+            break;
+        }
+        // The copies may hold a payload the producer was overwriting, and are made again
+        for (unsigned int i = 0; i < n; i++)
+        {
+            if (copied & (1ULL << i))
+            {
+                undeliver_item(target, (int)i);
+            }
+        }
+    }
+    eventcount_notify(&queue->not_full_event);
+    atomic_fetch_add_explicit(&queue->total_got, *taken, memory_order_relaxed);
+    return STATUS_OK;
+}
+
+/*
+ * MPMC queue. All state is guarded by queue_lock. Waiters register on the
+ * eventcount while still holding the lock, so a put/get that changes the
+ * state afterwards always finds them; only transitions out of the empty or
+ * full state notify, and those wake every waiter since any of them may be
+ * the one able to proceed.
+ */
+
+// Called with queue_lock held, returns with it held
+static int mpmc_wait_not_full(consumer_producer_t *queue, const struct timespec *deadline)
+{
+    wait_state_t state = {CONSUMER_PRODUCER_PHASE_IMMEDIATE, 0, 0};
 
     while (queue->count >= queue->capacity)
     {
-        if (queue->finished_monitor.signaled == 1)
+        if (atomic_load(&queue->finished))
+        {
+            return wait_end(&queue->producer_blocked_ns, &state, STATUS_FAILED);
+        }
+        if (deadline_passed(deadline))
         {
+            return wait_end(&queue->producer_blocked_ns, &state, STATUS_TIMEOUT);
+        }
+        if (wait_backoff(queue, &state))
+        {
+            // Let the consumers in while we back off
             pthread_mutex_unlock(&queue->queue_lock);
-            return "Queue finished while waiting";
+            pthread_mutex_lock(&queue->queue_lock);
+            continue;
         }
 
-        monitor_reset(&queue->not_full_monitor);
+        state.phase = CONSUMER_PRODUCER_PHASE_PARK;
+        unsigned int key = eventcount_prepare_wait(&queue->not_full_event);
+        if (atomic_load(&queue->finished))
+        {
+            eventcount_cancel_wait(&queue->not_full_event);
+            return wait_end(&queue->producer_blocked_ns, &state, STATUS_FAILED);
+        }
         pthread_mutex_unlock(&queue->queue_lock);
-        monitor_wait(&queue->not_full_monitor);
+        wait_not_full(queue, key, deadline);
         pthread_mutex_lock(&queue->queue_lock);
     }
+    if (atomic_load(&queue->finished))
+    {
+        return wait_end(&queue->producer_blocked_ns, &state, STATUS_FAILED);
+    }
+    wait_done(queue->producer_waits, &state);
+    return wait_end(&queue->producer_blocked_ns, &state, STATUS_OK);
+}
 
-    if (queue->finished_monitor.signaled == 1)
+// Called with queue_lock held, returns with it held
+static int mpmc_wait_not_empty(consumer_producer_t *queue, const struct timespec *deadline)
+{
+    wait_state_t state = {CONSUMER_PRODUCER_PHASE_IMMEDIATE, 0, 0};
+
+    while (queue->count <= 0)
     {
+        if (atomic_load(&queue->finished))
+        {
+            return wait_end(&queue->consumer_blocked_ns, &state, STATUS_FAILED);
+        }
+        if (deadline_passed(deadline))
+        {
+            return wait_end(&queue->consumer_blocked_ns, &state, STATUS_TIMEOUT);
+        }
+        if (wait_backoff(queue, &state))
+        {
+            // Let the producers in while we back off
+            pthread_mutex_unlock(&queue->queue_lock);
+            pthread_mutex_lock(&queue->queue_lock);
+            continue;
+        }
+
+        state.phase = CONSUMER_PRODUCER_PHASE_PARK;
+        unsigned int key = eventcount_prepare_wait(&queue->not_empty_event);
+        if (atomic_load(&queue->finished))
+        {
+            eventcount_cancel_wait(&queue->not_empty_event);
+            return wait_end(&queue->consumer_blocked_ns, &state, STATUS_FAILED);
+        }
         pthread_mutex_unlock(&queue->queue_lock);
-        return "Queue finished while waiting";
+        eventcount_wait_until(&queue->not_empty_event, key, deadline);
+        pthread_mutex_lock(&queue->queue_lock);
+    }
+    wait_done(queue->consumer_waits, &state);
+    return wait_end(&queue->consumer_blocked_ns, &state, STATUS_OK);
+}
+
+static int mpmc_put_batch(consumer_producer_t *queue, const put_source_t *source, int n,
+                          consumer_producer_overflow_t policy, const struct timespec *deadline,
+                          const char **error)
+{
+    if (atomic_load(&queue->finished))
+    {
+        release_items(source, 0, n);
+        *error = "Can't add items after finish";
+        return STATUS_FAILED;
+    }
+
+    // A dropping policy never waits for room
+    const struct timespec *wait_deadline = policy == CONSUMER_PRODUCER_OVERFLOW_BLOCK ? deadline : &expired_deadline;
+
+    pthread_mutex_lock(&queue->queue_lock);
+
+    int done = 0;
+    while (done < n)
+    {
+        int status = mpmc_wait_not_full(queue, wait_deadline);
+        if (status == STATUS_TIMEOUT && policy != CONSUMER_PRODUCER_OVERFLOW_BLOCK)
+        {
+            if (overflow_keeps_item(queue, policy))
+            {
+                mpmc_drop_oldest(queue);
+            }
+            else
+            {
+                drop_newest(queue, source, done++);
+            }
+            continue;
+        }
+        if (status != STATUS_OK)
+        {
+            pthread_mutex_unlock(&queue->queue_lock);
+            release_items(source, done, n - done);
+            *error = wait_error(status);
+            return status;
+        }
+
+        // Insert as many as fit under this lock hold
+        *error = NULL;
+        int was_empty = queue->count == 0;
+        int first = done;
+        while (done < n && queue->count < queue->capacity)
+        {
+            if (fill_slot(queue, source, done, (unsigned int)queue->tail, &queue->items[queue->tail]) != 0)
+            {
+                *error = "Error: Memory allocation for string failed";
+                break;
+            }
+            queue->tail = (queue->tail + 1) % queue->capacity;
+            queue->count++;
+            done++;
+        }
+
+        if (was_empty && queue->count > 0)
+        {
+            eventcount_notify_all(&queue->not_empty_event);
+        }
+        atomic_fetch_add_explicit(&queue->total_put, done - first, memory_order_relaxed);
+        note_depth(queue, queue->count);
+        if (*error)
+        {
+            pthread_mutex_unlock(&queue->queue_lock);
+            return STATUS_FAILED;
+        }
     }
 
-    queue->items[queue->tail] = strdup(item);
-    if (queue->items[queue->tail] == NULL)
+    pthread_mutex_unlock(&queue->queue_lock);
+
+    return STATUS_OK;
+}
+
+static int mpmc_get_batch(consumer_producer_t *queue, const get_target_t *target, int max,
+                          const struct timespec *deadline, int *taken)
+{
+    pthread_mutex_lock(&queue->queue_lock);
+
+    *taken = 0;
+    int status = mpmc_wait_not_empty(queue, deadline);
+    if (status != STATUS_OK)
     {
         pthread_mutex_unlock(&queue->queue_lock);
-        return "Error: Memory allocation for string failed";
+        return status;
     }
 
-    queue->tail = (queue->tail + 1) % queue->capacity;
-    queue->count++;
+    int was_full = queue->count >= queue->capacity;
+    while (*taken < max && queue->count > 0)
+    {
+        if (deliver_item(target, *taken, &queue->items[queue->head]) != 0)
+        {
+            break; // Out of memory, the rest stays queued
+        }
+        (*taken)++;
+        queue->items[queue->head].data = NULL;
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+    }
 
-    monitor_signal(&queue->not_empty_monitor);
+    if (was_full)
+    {
+        eventcount_notify_all(&queue->not_full_event);
+    }
+    atomic_fetch_add_explicit(&queue->total_got, *taken, memory_order_relaxed);
 
     pthread_mutex_unlock(&queue->queue_lock);
 
-    return NULL;
+    return STATUS_OK;
+}
+
+// Common entry for every put flavour: validates, then dispatches on the backend
+static int put_items(consumer_producer_t *queue, const put_source_t *source, int n,
+                     int apply_overflow, const struct timespec *deadline, const char **error)
+{
+    const void *items = source->messages ? (const void *)source->messages : (const void *)source->strings;
+    if (queue == NULL)
+    {
+        if (items != NULL && n > 0)
+        {
+            release_items(source, 0, n);
+        }
+        *error = "Null Queue pointer";
+        return STATUS_FAILED;
+    }
+
+    if (items == NULL || n < 0)
+    {
+        *error = "Invalid batch";
+        return STATUS_FAILED;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        if ((source->messages ? (const void *)source->messages[i].data : (const void *)source->strings[i]) == NULL)
+        {
+            release_items(source, 0, n); // free(NULL) is harmless
+            *error = "NULL Item pointer";
+            return STATUS_FAILED;
+        }
+    }
+
+    consumer_producer_overflow_t policy = CONSUMER_PRODUCER_OVERFLOW_BLOCK;
+    if (apply_overflow)
+    {
+        policy = atomic_load_explicit(&queue->overflow, memory_order_relaxed);
+    }
+
+    if (queue->mode == CONSUMER_PRODUCER_SPSC)
+    {
+        return spsc_put_batch(queue, source, n, policy, deadline, error);
+    }
+    return mpmc_put_batch(queue, source, n, policy, deadline, error);
+}
+
+// Common entry for every get flavour
+static int get_items(consumer_producer_t *queue, const get_target_t *target, int max,
+                     const struct timespec *deadline, int *taken)
+{
+    *taken = 0;
+    if (!queue || !(target->strings || target->messages) || max <= 0)
+    {
+        return STATUS_FAILED;
+    }
+
+    if (queue->mode == CONSUMER_PRODUCER_SPSC)
+    {
+        return spsc_get_batch(queue, target, max, deadline, taken);
+    }
+    return mpmc_get_batch(queue, target, max, deadline, taken);
+}
+
+// Put of strings
+static int put_strings(consumer_producer_t *queue, const char *const *items, int n, int owned,
+                       int apply_overflow, const struct timespec *deadline, const char **error)
+{
+    put_source_t source = {items, NULL, owned};
+    return put_items(queue, &source, n, apply_overflow, deadline, error);
+}
+
+// Get of strings
+static int get_strings(consumer_producer_t *queue, char **out, int max,
+                       const struct timespec *deadline, int *taken)
+{
+    get_target_t target = {out, NULL};
+    return get_items(queue, &target, max, deadline, taken);
+}
+
+const char *consumer_producer_put(consumer_producer_t *queue, const char *item)
+{
+    const char *error = NULL;
+    put_strings(queue, &item, 1, 0, 1, NULL, &error);
+    return error;
+}
+
+const char *consumer_producer_put_owned(consumer_producer_t *queue, char *item)
+{
+    const char *items[1] = {item};
+    const char *error = NULL;
+    put_strings(queue, items, 1, 1, 1, NULL, &error);
+    return error;
+}
+
+const char *consumer_producer_put_batch(consumer_producer_t *queue, const char *const *items, int n)
+{
+    const char *error = NULL;
+    put_strings(queue, items, n, 0, 1, NULL, &error);
+    return error;
+}
+
+const char *consumer_producer_put_batch_owned(consumer_producer_t *queue, char *const *items, int n)
+{
+    const char *error = NULL;
+    put_strings(queue, (const char *const *)items, n, 1, 1, NULL, &error);
+    return error;
+}
+
+const char *consumer_producer_put_messages(consumer_producer_t *queue, message_t *messages, int n)
+{
+    put_source_t source = {NULL, messages, 1};
+    const char *error = NULL;
+    put_items(queue, &source, n, 1, NULL, &error);
+    return error;
+}
+
+int consumer_producer_try_put(consumer_producer_t *queue, const char *item)
+{
+    return consumer_producer_put_until(queue, item, &expired_deadline);
+}
+
+int consumer_producer_put_until(consumer_producer_t *queue, const char *item, const struct timespec *deadline)
+{
+    const char *error = NULL;
+    return put_strings(queue, &item, 1, 0, 0, deadline, &error);
+}
+
+int consumer_producer_put_message_until(consumer_producer_t *queue, message_t *message,
+                                        const struct timespec *deadline)
+{
+    put_source_t source = {NULL, message, 1};
+    const char *error = NULL;
+    return put_items(queue, &source, 1, 0, deadline, &error);
 }
 
 char *consumer_producer_get(consumer_producer_t *queue)
+{
+    char *item = NULL;
+    int taken = 0;
+    get_strings(queue, &item, 1, NULL, &taken);
+    return taken == 1 ? item : NULL;
+}
+
+int consumer_producer_get_batch(consumer_producer_t *queue, char **out, int max)
+{
+    int taken = 0;
+    get_strings(queue, out, max, NULL, &taken);
+    return taken;
+}
+
+int consumer_producer_get_messages(consumer_producer_t *queue, message_t *out, int max)
+{
+    get_target_t target = {NULL, out};
+    int taken = 0;
+    get_items(queue, &target, max, NULL, &taken);
+    return taken;
+}
+
+int consumer_producer_try_get_messages(consumer_producer_t *queue, message_t *out, int max)
+{
+    return consumer_producer_get_messages_until(queue, out, max, &expired_deadline);
+}
+
+int consumer_producer_get_messages_until(consumer_producer_t *queue, message_t *out, int max,
+                                         const struct timespec *deadline)
+{
+    get_target_t target = {NULL, out};
+    int taken = 0;
+    int status = get_items(queue, &target, max, deadline, &taken);
+    return status == STATUS_FAILED && taken == 0 ? -1 : taken;
+}
+
+int consumer_producer_try_get(consumer_producer_t *queue, char **item)
+{
+    return consumer_producer_get_until(queue, item, &expired_deadline);
+}
+
+int consumer_producer_get_until(consumer_producer_t *queue, char **item, const struct timespec *deadline)
+{
+    int taken = 0;
+    if (item == NULL)
+    {
+        return STATUS_FAILED;
+    }
+    *item = NULL;
+    return get_strings(queue, item, 1, deadline, &taken);
+}
+
+// Memory for slots, cache line aligned, bound to the queue's node once it has one
+static void *alloc_slots(consumer_producer_t *queue, size_t size)
+{
+    if (queue->node < 0)
+    {
+        return aligned_alloc(CONSUMER_PRODUCER_CACHE_LINE, size);
+    }
+    void *slots = topology_alloc_pages(size);
+    if (slots)
+    {
+        // Without NUMA support the kernel refuses, and the memory is as good as any
+        topology_bind(slots, size, queue->node);
+    }
+    return slots;
+}
+
+const char *consumer_producer_set_inline(consumer_producer_t *queue, int size)
 {
     if (!queue)
     {
-        return NULL;
+        return "Queue pointer is NULL";
+    }
+    if (size <= 0 || size > CONSUMER_PRODUCER_INLINE_MAX)
+    {
+        return "Inline size must be between 1 and 1024";
+    }
+    if (queue->inline_slots)
+    {
+        return "Inline size is already set";
+    }
+    if (atomic_load(&queue->total_put) > 0)
+    {
+        return "Inline size must be set before the first put";
     }
 
-    pthread_mutex_lock(&queue->queue_lock);
+    size_t slots = queue->mode == CONSUMER_PRODUCER_SPSC ? (size_t)queue->mask + 1 : (size_t)queue->capacity;
+    size_t stride = ((size_t)size + CONSUMER_PRODUCER_CACHE_LINE - 1) & ~(size_t)(CONSUMER_PRODUCER_CACHE_LINE - 1);
+    queue->inline_slots = alloc_slots(queue, slots * stride);
+    if (!queue->inline_slots)
+    {
+        return "Failed to allocate memory for inline slots";
+    }
+    queue->inline_stride = stride;
+    queue->inline_size = (size_t)size;
+    return NULL;
+}
 
-    while (queue->count <= 0 && queue->finished_monitor.signaled == 0)
+const char *consumer_producer_set_node(consumer_producer_t *queue, int node)
+{
+    if (queue == NULL)
     {
-        monitor_reset(&queue->not_empty_monitor);
-        pthread_mutex_unlock(&queue->queue_lock);
-        monitor_wait(&queue->not_empty_monitor);
-        pthread_mutex_lock(&queue->queue_lock);
+        return "Queue pointer is NULL";
+    }
+    if (node < 0)
+    {
+        return "NUMA node can't be negative";
+    }
+    if (atomic_load(&queue->total_put) > 0)
+    {
+        return "NUMA node must be set before the first put";
     }
 
-    if (queue->count <= 0 && queue->finished_monitor.signaled == 1)
+    size_t slots = queue->mode == CONSUMER_PRODUCER_SPSC ? (size_t)queue->mask + 1 : (size_t)queue->capacity;
+    int previous = queue->node;
+    queue->node = node;
+    message_t *items = alloc_slots(queue, slots * sizeof(message_t));
+    char *inline_slots = queue->inline_slots ? alloc_slots(queue, slots * queue->inline_stride) : NULL;
+    if (!items || (queue->inline_slots && !inline_slots))
     {
-        pthread_mutex_unlock(&queue->queue_lock);
-        return NULL;
+        free(items);
+        free(inline_slots);
+        queue->node = previous;
+        return "Failed to allocate memory for slots";
+    }
+    // Touched first here, so the pages come from the node
+    memset(items, 0, slots * sizeof(message_t));
+    free(queue->items);
+    queue->items = items;
+    if (inline_slots)
+    {
+        free(queue->inline_slots);
+        queue->inline_slots = inline_slots;
     }
+    return NULL;
+}
 
-    char *returnVal = queue->items[queue->head];
-    queue->items[queue->head] = NULL;
+void consumer_producer_set_wait_strategy(consumer_producer_t *queue,
+                                         consumer_producer_wait_strategy_t strategy, int spin_limit)
+{
+    if (queue == NULL)
+    {
+        return;
+    }
+    atomic_store_explicit(&queue->spin_limit, spin_limit > 0 ? spin_limit : CONSUMER_PRODUCER_DEFAULT_SPIN,
+                          memory_order_relaxed);
+    atomic_store_explicit(&queue->wait_strategy, strategy, memory_order_relaxed);
+}
 
-    queue->head = (queue->head + 1) % queue->capacity;
-    queue->count--;
+void consumer_producer_set_overflow(consumer_producer_t *queue,
+                                    consumer_producer_overflow_t policy, int sample_rate)
+{
+    if (queue == NULL)
+    {
+        return;
+    }
+    atomic_store_explicit(&queue->sample_rate, sample_rate > 0 ? sample_rate : CONSUMER_PRODUCER_DEFAULT_SAMPLE,
+                          memory_order_relaxed);
+    atomic_store_explicit(&queue->overflow, policy, memory_order_relaxed);
+}
 
-    monitor_signal(&queue->not_full_monitor);
+static void read_wait_counts(atomic_ulong *counters, consumer_producer_wait_counts_t *out)
+{
+    out->immediate = atomic_load_explicit(&counters[CONSUMER_PRODUCER_PHASE_IMMEDIATE], memory_order_relaxed);
+    out->spin = atomic_load_explicit(&counters[CONSUMER_PRODUCER_PHASE_SPIN], memory_order_relaxed);
+    out->yield = atomic_load_explicit(&counters[CONSUMER_PRODUCER_PHASE_YIELD], memory_order_relaxed);
+    out->park = atomic_load_explicit(&counters[CONSUMER_PRODUCER_PHASE_PARK], memory_order_relaxed);
+}
 
-    pthread_mutex_unlock(&queue->queue_lock);
+void consumer_producer_stats(consumer_producer_t *queue, consumer_producer_stats_t *stats)
+{
+    if (queue == NULL || stats == NULL)
+    {
+        return;
+    }
+    read_wait_counts(queue->consumer_waits, &stats->consumer_waits);
+    read_wait_counts(queue->producer_waits, &stats->producer_waits);
+    stats->dropped_oldest = atomic_load_explicit(&queue->dropped_oldest, memory_order_relaxed);
+    stats->dropped_newest = atomic_load_explicit(&queue->dropped_newest, memory_order_relaxed);
+    stats->total_put = atomic_load_explicit(&queue->total_put, memory_order_relaxed);
+    stats->total_got = atomic_load_explicit(&queue->total_got, memory_order_relaxed);
+    stats->high_water = atomic_load_explicit(&queue->high_water, memory_order_relaxed);
+    stats->producer_blocked_ns = atomic_load_explicit(&queue->producer_blocked_ns, memory_order_relaxed);
+    stats->consumer_blocked_ns = atomic_load_explicit(&queue->consumer_blocked_ns, memory_order_relaxed);
 
-    return returnVal;
+    if (queue->mode == CONSUMER_PRODUCER_SPSC)
+    {
+        // head first: tail only grows, so the difference can't go negative
+        unsigned int head = atomic_load_explicit(&queue->ring_head, memory_order_relaxed);
+        stats->depth = atomic_load_explicit(&queue->ring_tail, memory_order_relaxed) - head;
+    }
+    else
+    {
+        pthread_mutex_lock(&queue->queue_lock);
+        stats->depth = queue->count;
+        pthread_mutex_unlock(&queue->queue_lock);
+    }
 }
 
 void consumer_producer_signal_finished(consumer_producer_t *queue)
@@ -172,16 +1251,22 @@ void consumer_producer_signal_finished(consumer_producer_t *queue)
         return;
     }
 
+    atomic_store(&queue->finished, 1);
     monitor_signal(&queue->finished_monitor);
-    monitor_signal(&queue->not_empty_monitor);
+    eventcount_notify_all(&queue->not_empty_event);
+    eventcount_notify_all(&queue->not_full_event);
 }
 
 int consumer_producer_wait_finished(consumer_producer_t *queue)
+{
+    return consumer_producer_wait_finished_until(queue, NULL);
+}
+
+int consumer_producer_wait_finished_until(consumer_producer_t *queue, const struct timespec *deadline)
 {
     if (!queue)
     {
         return -1;
     }
-    monitor_wait(&queue->finished_monitor);
-    return 0;
+    return monitor_wait_timed(&queue->finished_monitor, deadline);
 }
\ No newline at end of file
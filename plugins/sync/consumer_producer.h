@@ -1,19 +1,137 @@
 #ifndef CONSUMER_PRODUCER_H_
 #define CONSUMER_PRODUCER_H_
 #include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 #include "monitor.h"
+#include "eventcount.h"
+#include "message.h"
 
+#define CONSUMER_PRODUCER_CACHE_LINE 64
+#define CONSUMER_PRODUCER_INLINE_MAX 1024 /* Largest inline slot, see consumer_producer_set_inline */
+
+/**
+ * Queue backends. Both are driven through the same put/get API.
+ */
+typedef enum
+{
+    CONSUMER_PRODUCER_MPMC = 0, /* Mutex protected queue, any number of producers and consumers */
+    CONSUMER_PRODUCER_SPSC      /* Lock-free ring, exactly one producer thread and one consumer thread */
+} consumer_producer_mode_t;
+
+/**
+ * How a thread waits for an empty queue to fill (or a full one to drain).
+ * Spinning keeps a core busy but saves the futex wake and scheduler latency
+ * when the other side is about to deliver.
+ */
+typedef enum
+{
+    CONSUMER_PRODUCER_WAIT_BLOCK = 0, /* Sleep on the eventcount right away */
+    CONSUMER_PRODUCER_WAIT_SPIN,      /* Spin with a pause instruction up to spin_limit rounds, then sleep */
+    CONSUMER_PRODUCER_WAIT_ADAPTIVE,  /* Spin, then yield the CPU for a few rounds, then sleep */
+    CONSUMER_PRODUCER_WAIT_POLL       /* Re-check in a tight loop and never sleep */
+} consumer_producer_wait_strategy_t;
+
+#define CONSUMER_PRODUCER_DEFAULT_SPIN 2000 /* Spin rounds when none are configured */
+#define CONSUMER_PRODUCER_YIELD_ROUNDS 16   /* sched_yield rounds of the adaptive strategy */
+
+/**
+ * What a put does when the queue is full. Anything but BLOCK keeps the
+ * producer running at the cost of losing items, for consumers that care more
+ * about fresh data than about seeing all of it.
+ */
+typedef enum
+{
+    CONSUMER_PRODUCER_OVERFLOW_BLOCK = 0,   /* Wait for a free slot */
+    CONSUMER_PRODUCER_OVERFLOW_DROP_OLDEST, /* Evict the oldest queued item to make room */
+    CONSUMER_PRODUCER_OVERFLOW_DROP_NEWEST, /* Discard the item being put */
+    CONSUMER_PRODUCER_OVERFLOW_SAMPLE       /* Keep about one in sample_rate items by evicting the oldest, discard the rest */
+} consumer_producer_overflow_t;
+
+#define CONSUMER_PRODUCER_DEFAULT_SAMPLE 8 /* Sample rate when none is configured */
+
+/* Wait phases, index into the per-side wait counters */
+enum
+{
+    CONSUMER_PRODUCER_PHASE_IMMEDIATE = 0,
+    CONSUMER_PRODUCER_PHASE_SPIN,
+    CONSUMER_PRODUCER_PHASE_YIELD,
+    CONSUMER_PRODUCER_PHASE_PARK,
+    CONSUMER_PRODUCER_PHASES
+};
+
+/**
+ * How often each phase of the wait strategy ended a wait
+ */
+typedef struct
+{
+    unsigned long immediate; /* Calls that found the queue ready without waiting */
+    unsigned long spin;      /* Waits resolved while spinning */
+    unsigned long yield;     /* Waits resolved while yielding the CPU */
+    unsigned long park;      /* Waits that had to sleep */
+} consumer_producer_wait_counts_t;
+
+/**
+ * Snapshot of a queue's counters, see consumer_producer_stats()
+ */
 typedef struct
 {
-    char **items; /* Array of string pointers */
+    unsigned long depth;               /* Items queued right now */
+    unsigned long high_water;          /* Most items ever queued at once */
+    unsigned long total_put;           /* Items added since init */
+    unsigned long total_got;           /* Items taken since init */
+    unsigned long producer_blocked_ns; /* Time put callers spent waiting for a free slot */
+    unsigned long consumer_blocked_ns; /* Time get callers spent waiting for an item */
+    consumer_producer_wait_counts_t consumer_waits; /* get side: waiting for items */
+    consumer_producer_wait_counts_t producer_waits; /* put side: waiting for free slots */
+    unsigned long dropped_oldest;                   /* Queued items evicted by the overflow policy */
+    unsigned long dropped_newest;                   /* Items the overflow policy discarded instead of queueing */
+} consumer_producer_stats_t;
+
+typedef struct
+{
+    message_t *items; /* Slots, messages own their data while queued */
     int capacity; /* Maximum number of items */
-    int count;    /* Current number of items */
-    int head;     /* Index of first item */
-    int tail;     /* Index of next insertion point */
+    int count;    /* Current number of items (MPMC only) */
+    int head;     /* Index of first item (MPMC only) */
+    int tail;     /* Index of next insertion point (MPMC only) */
     pthread_mutex_t queue_lock;
-    monitor_t not_full_monitor;  /* Monitor for "not full" state */
-    monitor_t not_empty_monitor; /* Monitor for "not empty" state */
-    monitor_t finished_monitor;  /* Monitor for finished signal */
+    eventcount_t not_full_event;  /* Producers sleep here while the queue is full */
+    eventcount_t not_empty_event; /* Consumers sleep here while the queue is empty */
+    monitor_t finished_monitor;   /* Monitor for finished signal */
+    consumer_producer_mode_t mode;
+    unsigned int mask; /* Ring slots - 1, the ring is a power of two (SPSC only) */
+
+    /* Inline payloads: a string shorter than inline_size is copied into its
+     * slot's inline_stride bytes of inline_slots instead of travelling as a
+     * heap pointer. The slot's message then has cap 0 and points there. */
+    char *inline_slots;   /* NULL unless consumer_producer_set_inline was called */
+    size_t inline_size;   /* Longest inline payload plus its NUL */
+    size_t inline_stride; /* inline_size rounded up to whole cache lines */
+    int node;             /* NUMA node the slots are bound to, -1 if left to the kernel */
+
+    /* Shared state and settings, read by both sides and changed while the queue is in use */
+    atomic_int finished;      /* Set once signal_finished was called */
+    atomic_int wait_strategy; /* consumer_producer_wait_strategy_t, may change while in use */
+    atomic_int spin_limit;    /* Spin rounds before yielding/sleeping */
+    atomic_int overflow;      /* consumer_producer_overflow_t, may change while in use */
+    atomic_int sample_rate;   /* 1 in sample_rate items survive an overflow when sampling */
+
+    /* Each side's hot data sits on its own cache line, led by its SPSC ring
+     * index. The indices run freely and are masked on access; each one is
+     * written by a single thread. */
+    _Alignas(CONSUMER_PRODUCER_CACHE_LINE) atomic_uint ring_head; /* Next slot to read, owned by the consumer (SPSC only) */
+    atomic_ulong consumer_waits[CONSUMER_PRODUCER_PHASES];        /* get side wait counters */
+    atomic_ulong total_got;                                       /* Items taken */
+    atomic_ulong consumer_blocked_ns;                             /* Time spent waiting for items */
+    _Alignas(CONSUMER_PRODUCER_CACHE_LINE) atomic_uint ring_tail; /* Next slot to write, owned by the producer (SPSC only) */
+    atomic_ulong producer_waits[CONSUMER_PRODUCER_PHASES];        /* put side wait counters */
+    atomic_ulong dropped_oldest;                                  /* Items evicted on overflow */
+    atomic_ulong dropped_newest;                                  /* Items discarded on overflow */
+    atomic_ulong total_put;                                       /* Items added */
+    atomic_ulong high_water;                                      /* Deepest the queue has been */
+    atomic_ulong producer_blocked_ns;                             /* Time spent waiting for free slots */
+    unsigned int sample_seed;                                     /* xorshift state for sampling, producer side */
 } consumer_producer_t;
 
 /**
@@ -24,6 +142,19 @@ typedef struct
  */
 const char *consumer_producer_init(consumer_producer_t *queue, int capacity);
 
+/**
+ * Initialize a consumer-producer queue with an explicit backend.
+ * In SPSC mode put must only ever be called from one thread at a time and get
+ * from one thread at a time; items are exchanged without taking any lock and
+ * the threads only park when the ring is empty or full.
+ * @param queue Pointer to queue structure
+ * @param capacity Maximum number of items
+ * @param mode Queue backend
+ * @return NULL on success, error message on failure
+ */
+const char *consumer_producer_init_mode(consumer_producer_t *queue, int capacity,
+                                        consumer_producer_mode_t mode);
+
 /**
  * Destroy a consumer-producer queue and free its resources
  * @param queue Pointer to queue structure
@@ -32,13 +163,23 @@ void consumer_producer_destroy(consumer_producer_t *queue);
 
 /**
  * Add an item to the queue (producer).
- * Blocks if queue is full.
+ * Blocks if queue is full, unless the queue has a dropping overflow policy.
  * @param queue Pointer to queue structure
  * @param item String to add (queue takes ownership)
  * @return NULL on success, error message on failure
  */
 const char *consumer_producer_put(consumer_producer_t *queue, const char *item);
 
+/**
+ * Add an item to the queue without copying it (producer).
+ * Blocks if queue is full, unless the queue has a dropping overflow policy. The caller hands over a heap allocated string and
+ * must not touch it again, the queue frees it if it can't be added.
+ * @param queue Pointer to queue structure
+ * @param item malloc'd string, ownership moves to the queue
+ * @return NULL on success, error message on failure
+ */
+const char *consumer_producer_put_owned(consumer_producer_t *queue, char *item);
+
 /**
  * Remove an item from the queue (consumer) and returns it.
  * Blocks if queue is empty.
@@ -47,6 +188,193 @@ const char *consumer_producer_put(consumer_producer_t *queue, const char *item);
  */
 char *consumer_producer_get(consumer_producer_t *queue);
 
+/**
+ * Add several items to the queue with one synchronization round per run of
+ * free slots instead of one per item. Blocks while the queue is full, unless
+ * the overflow policy drops items.
+ * Items are copied in order; on failure the items before the failing one
+ * have already been queued.
+ * @param queue Pointer to queue structure
+ * @param items Strings to add
+ * @param n Number of strings
+ * @return NULL on success, error message on failure
+ */
+const char *consumer_producer_put_batch(consumer_producer_t *queue, const char *const *items, int n);
+
+/**
+ * Batch version of consumer_producer_put_owned: the strings are queued
+ * without copying and the caller gives up all of them, including any the
+ * queue fails to add (those are freed).
+ * @param queue Pointer to queue structure
+ * @param items malloc'd strings, ownership moves to the queue
+ * @param n Number of strings
+ * @return NULL on success, error message on failure
+ */
+const char *consumer_producer_put_batch_owned(consumer_producer_t *queue, char *const *items, int n);
+
+/**
+ * Remove up to max items from the queue at once (consumer).
+ * Blocks until at least one item is available, then takes everything that is
+ * queued (up to max) in a single synchronization round.
+ * @param queue Pointer to queue structure
+ * @param out Array receiving the strings, the caller frees each of them
+ * @param max Capacity of out
+ * @return Number of items stored in out, 0 once finished and drained
+ */
+int consumer_producer_get_batch(consumer_producer_t *queue, char **out, int max);
+
+/*
+ * Message variants. Items are stored as message_t either way; handing them
+ * over as messages saves the strlen the string variants need to fill in the
+ * length, and keeps the flags.
+ */
+
+/**
+ * Batch put of messages. The queue takes over the data of all of them,
+ * including any it fails to add (those are released).
+ * @param queue Pointer to queue structure
+ * @param messages Messages to add
+ * @param n Number of messages
+ * @return NULL on success, error message on failure
+ */
+const char *consumer_producer_put_messages(consumer_producer_t *queue, message_t *messages, int n);
+
+/**
+ * Batch get of messages, see consumer_producer_get_batch
+ * @param queue Pointer to queue structure
+ * @param out Array receiving the messages, the caller releases each of them
+ * @param max Capacity of out
+ * @return Number of messages stored in out, 0 once finished and drained
+ */
+int consumer_producer_get_messages(consumer_producer_t *queue, message_t *out, int max);
+
+/*
+ * Non-blocking and timed variants. Deadlines are absolute CLOCK_MONOTONIC
+ * times (a NULL deadline waits forever) so a caller can spread one budget
+ * over several calls. They all return 0 on success, 1 when the queue stayed
+ * full/empty until the deadline, and -1 on error or once the queue is
+ * finished (for gets: finished and drained). The overflow policy does not
+ * apply to them, so they can queue an item that must not be lost.
+ */
+
+/**
+ * Add a copy of item only if there is room right now
+ * @param queue Pointer to queue structure
+ * @param item String to add (copied)
+ * @return 0 if queued, 1 if the queue is full, -1 on error/finished
+ */
+int consumer_producer_try_put(consumer_producer_t *queue, const char *item);
+
+/**
+ * Add a copy of item, waiting for room until the deadline
+ * @param queue Pointer to queue structure
+ * @param item String to add (copied)
+ * @param deadline Absolute CLOCK_MONOTONIC time, NULL waits forever
+ * @return 0 if queued, 1 on timeout, -1 on error/finished
+ */
+int consumer_producer_put_until(consumer_producer_t *queue, const char *item, const struct timespec *deadline);
+
+/**
+ * Add a message, waiting for room until the deadline. The queue takes over
+ * its data whether or not it is added.
+ * @param queue Pointer to queue structure
+ * @param message Message to add
+ * @param deadline Absolute CLOCK_MONOTONIC time, NULL waits forever
+ * @return 0 if queued, 1 on timeout, -1 on error/finished
+ */
+int consumer_producer_put_message_until(consumer_producer_t *queue, message_t *message,
+                                        const struct timespec *deadline);
+
+/**
+ * Take the messages queued right now, without waiting
+ * @param queue Pointer to queue structure
+ * @param out Array receiving the messages, the caller releases each of them
+ * @param max Capacity of out
+ * @return Number of messages stored in out, 0 if the queue is empty, -1 once finished and drained
+ */
+int consumer_producer_try_get_messages(consumer_producer_t *queue, message_t *out, int max);
+
+/**
+ * Take the messages queued, waiting for some until the deadline
+ * @param queue Pointer to queue structure
+ * @param out Array receiving the messages, the caller releases each of them
+ * @param max Capacity of out
+ * @param deadline Absolute CLOCK_MONOTONIC time, NULL waits forever
+ * @return Number of messages stored in out, 0 on timeout, -1 once finished and drained
+ */
+int consumer_producer_get_messages_until(consumer_producer_t *queue, message_t *out, int max,
+                                         const struct timespec *deadline);
+
+/**
+ * Take an item only if one is queued right now
+ * @param queue Pointer to queue structure
+ * @param item Receives the string (caller frees it), NULL unless 0 is returned
+ * @return 0 if an item was taken, 1 if the queue is empty, -1 on error/finished and drained
+ */
+int consumer_producer_try_get(consumer_producer_t *queue, char **item);
+
+/**
+ * Take an item, waiting for one until the deadline
+ * @param queue Pointer to queue structure
+ * @param item Receives the string (caller frees it), NULL unless 0 is returned
+ * @param deadline Absolute CLOCK_MONOTONIC time, NULL waits forever
+ * @return 0 if an item was taken, 1 on timeout, -1 on error/finished and drained
+ */
+int consumer_producer_get_until(consumer_producer_t *queue, char **item, const struct timespec *deadline);
+
+/**
+ * Choose what put does when the queue is full. The timed put variants always
+ * wait. Items dropped by the policy are counted in consumer_producer_stats().
+ * @param queue Pointer to queue structure
+ * @param policy Overflow policy
+ * @param sample_rate Keep one in sample_rate items while full (SAMPLE only), <= 0 for the default
+ */
+void consumer_producer_set_overflow(consumer_producer_t *queue,
+                                    consumer_producer_overflow_t policy, int sample_rate);
+
+/**
+ * Choose how callers of put/get wait on this queue. Safe to call while the
+ * queue is in use; waits already in progress finish with the old strategy.
+ * @param queue Pointer to queue structure
+ * @param strategy Wait strategy
+ * @param spin_limit Spin rounds for SPIN/ADAPTIVE, <= 0 for the default
+ */
+void consumer_producer_set_wait_strategy(consumer_producer_t *queue,
+                                         consumer_producer_wait_strategy_t strategy, int spin_limit);
+
+/**
+ * Store strings shorter than size bytes (NUL included) in the queue's own
+ * cache line sized slots rather than as pointers to their heap buffers. The
+ * producer's buffer goes back to the pool (or is never made, for copying
+ * puts) and the consumer gets a fresh one from its own thread's cache, so a
+ * short item costs no cross-thread allocation and no pointer chase. Longer
+ * strings still travel as pointers. While enabled, get calls on an SPSC
+ * queue take at most 64 items at once.
+ * Must be called before the first put.
+ * @param queue Pointer to queue structure
+ * @param size Inline capacity per slot in bytes, including the NUL
+ * @return NULL on success, error message on failure
+ */
+const char *consumer_producer_set_inline(consumer_producer_t *queue, int size);
+
+/**
+ * Move the queue's slots (and inline slots, now or later) to memory bound
+ * to a NUMA node, normally the consumer's, so the side that touches them
+ * most finds them local. Must be called before the first put.
+ * @param queue Pointer to queue structure
+ * @param node NUMA node, see topology_cpu_node
+ * @return NULL on success, error message on failure
+ */
+const char *consumer_producer_set_node(consumer_producer_t *queue, int node);
+
+/**
+ * Take a snapshot of the queue's counters. Counters are updated with relaxed
+ * atomics, so the snapshot is not a single consistent point in time.
+ * @param queue Pointer to queue structure
+ * @param stats Receives the counters
+ */
+void consumer_producer_stats(consumer_producer_t *queue, consumer_producer_stats_t *stats);
+
 /**
  * Signal that processing is finished
  * @param queue Pointer to queue structure
@@ -56,8 +384,16 @@ void consumer_producer_signal_finished(consumer_producer_t *queue);
 /**
  * Wait for processing to be finished
  * @param queue Pointer to queue structure
- * @return 0 on success, -1 on timeout
+ * @return 0 on success, -1 on error
  */
 int consumer_producer_wait_finished(consumer_producer_t *queue);
 
+/**
+ * Wait for processing to be finished, giving up at a deadline
+ * @param queue Pointer to queue structure
+ * @param deadline Absolute CLOCK_MONOTONIC time, NULL waits forever
+ * @return 0 on success, 1 on timeout, -1 on error
+ */
+int consumer_producer_wait_finished_until(consumer_producer_t *queue, const struct timespec *deadline);
+
 #endif
\ No newline at end of file
@@ -12,6 +12,7 @@
 #include <assert.h>
 #include <errno.h>
 #include "consumer_producer.h"
+#include "topology.h"
 
 #define MAX_THREADS 10
 #define TEST_CAPACITY 5
@@ -649,43 +650,50 @@ static int test_finished_signal(void)
     return 1;
 }
 
-/* Thread for timeout test */
-static void *no_signal_thread(void *arg)
+/* Returns an absolute CLOCK_MONOTONIC deadline ms milliseconds from now */
+static struct timespec deadline_in(long ms)
 {
-    /* This thread does nothing - no signal sent */
-    sleep(10); /* Sleep longer than timeout */
-    return NULL;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+/* Milliseconds elapsed since start on CLOCK_MONOTONIC */
+static long elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000L + (now.tv_nsec - start->tv_nsec) / 1000000L;
 }
 
 /* Test 9: Timeout on finished wait */
 static int test_finished_timeout(void)
 {
-    printf("\nTest 9: Timeout on finished wait - SKIPPED (monitor doesn't support timeout)\n");
-    printf("    Note: To enable this test, add monitor_wait_timeout() to your monitor implementation\n");
+    printf("\nTest 9: Timeout on finished wait\n");
 
-    /* Skip this test if monitor doesn't support timeout */
-    printf("    SKIPPED\n");
-    results.passed++; /* Count as passed since it's not a failure */
-    results.total++;
-    return 1;
-
-    /* Original test code commented out - uncomment if you add timeout support:
     consumer_producer_t queue;
-    const char* error = consumer_producer_init(&queue, TEST_CAPACITY);
+    const char *error = consumer_producer_init(&queue, TEST_CAPACITY);
     TEST_ASSERT_NULL(error, "Initialization should succeed");
 
-    pthread_t dummy_thread;
-    pthread_create(&dummy_thread, NULL, no_signal_thread, NULL);
-
-    time_t start = time(NULL);
-    int result = consumer_producer_wait_finished(&queue);
-    time_t end = time(NULL);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct timespec deadline = deadline_in(200);
+    int result = consumer_producer_wait_finished_until(&queue, &deadline);
 
-    TEST_ASSERT_EQUAL(result, -1, "Wait should timeout when not signaled");
-    TEST_ASSERT(end - start >= TIMEOUT_SEC - 1, "Should wait for timeout period");
+    TEST_ASSERT_EQUAL(result, 1, "Wait should timeout when not signaled");
+    TEST_ASSERT(elapsed_ms(&start) >= 190, "Should wait for timeout period");
 
-    pthread_cancel(dummy_thread);
-    pthread_join(dummy_thread, NULL);
+    consumer_producer_signal_finished(&queue);
+    deadline = deadline_in(200);
+    result = consumer_producer_wait_finished_until(&queue, &deadline);
+    TEST_ASSERT_EQUAL(result, 0, "Wait should succeed once signaled");
 
     consumer_producer_destroy(&queue);
 
@@ -693,7 +701,6 @@ static int test_finished_timeout(void)
     results.passed++;
     results.total++;
     return 1;
-    */
 }
 
 /* Stress test producer */
@@ -870,7 +877,834 @@ static int test_memory_management(void)
     return 1;
 }
 
+/* Test 13: SPSC ring basic operations and wraparound */
+static int test_spsc_ring(void)
+{
+    printf("\nTest 13: SPSC ring basic operations and wraparound\n");
+
+    consumer_producer_t queue;
+    const char *error;
+    char *item;
+
+    error = consumer_producer_init_mode(&queue, TEST_CAPACITY, CONSUMER_PRODUCER_SPSC);
+    TEST_ASSERT_NULL(error, "SPSC initialization should succeed");
+    TEST_ASSERT_EQUAL(queue.mask, 7u, "Ring should be rounded up to a power of two");
+
+    /* Several laps around the ring, filling it to its logical capacity each time */
+    for (int lap = 0; lap < 4; lap++)
+    {
+        for (int i = 0; i < TEST_CAPACITY; i++)
+        {
+            char *test_str = create_test_string(lap * 100 + i);
+            error = consumer_producer_put(&queue, test_str);
+            TEST_ASSERT_NULL(error, "Put should succeed");
+            free(test_str);
+        }
+        TEST_ASSERT_EQUAL(atomic_load(&queue.ring_tail) - atomic_load(&queue.ring_head),
+                          (unsigned int)TEST_CAPACITY, "Ring should hold capacity items");
+
+        for (int i = 0; i < TEST_CAPACITY; i++)
+        {
+            item = consumer_producer_get(&queue);
+            TEST_ASSERT_NOT_NULL(item, "Get should return an item");
+            TEST_ASSERT_EQUAL(extract_value(item), lap * 100 + i, "Items should be in FIFO order");
+            free(item);
+        }
+    }
+
+    /* Finished with an empty ring: get returns NULL and put is refused */
+    consumer_producer_signal_finished(&queue);
+    TEST_ASSERT_NULL(consumer_producer_get(&queue), "Get should return NULL once finished and empty");
+    TEST_ASSERT_NOT_NULL(consumer_producer_put(&queue, "late"), "Put should fail after finish");
+
+    consumer_producer_destroy(&queue);
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 14: SPSC ring with a producer and a consumer thread */
+static int test_spsc_threads(void)
+{
+    printf("\nTest 14: SPSC ring with concurrent producer and consumer\n");
+
+    consumer_producer_t queue;
+    test_context_t ctx = {0};
+    pthread_t producer, consumer;
+
+    const char *error = consumer_producer_init_mode(&queue, 2, CONSUMER_PRODUCER_SPSC);
+    TEST_ASSERT_NULL(error, "SPSC initialization should succeed");
+
+    ctx.queue = &queue;
+    ctx.num_items = 200;
+    ctx.start_value = 0;
+    ctx.produced_items = calloc(ctx.num_items, sizeof(int));
+    ctx.consumed_items = calloc(ctx.num_items, sizeof(int));
+    pthread_mutex_init(&ctx.count_mutex, NULL);
+
+    pthread_create(&producer, NULL, producer_thread, &ctx);
+    pthread_create(&consumer, NULL, consumer_thread, &ctx);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+
+    TEST_ASSERT_EQUAL(ctx.consumed_count, ctx.num_items, "All items should be consumed");
+    for (int i = 0; i < ctx.num_items; i++)
+    {
+        TEST_ASSERT_EQUAL(ctx.consumed_items[i], i, "Items should be consumed in FIFO order");
+    }
+
+    free(ctx.produced_items);
+    free(ctx.consumed_items);
+    pthread_mutex_destroy(&ctx.count_mutex);
+    consumer_producer_destroy(&queue);
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 15: Batch put and get on both backends */
+static int test_batch_operations(void)
+{
+    printf("\nTest 15: Batch put and get on both backends\n");
+
+    consumer_producer_mode_t modes[] = {CONSUMER_PRODUCER_MPMC, CONSUMER_PRODUCER_SPSC};
+
+    for (int m = 0; m < 2; m++)
+    {
+        consumer_producer_t queue;
+        char *batch[TEST_CAPACITY];
+        char *out[TEST_CAPACITY * 2];
+        const char *error;
+
+        error = consumer_producer_init_mode(&queue, TEST_CAPACITY, modes[m]);
+        TEST_ASSERT_NULL(error, "Initialization should succeed");
+
+        for (int i = 0; i < TEST_CAPACITY; i++)
+        {
+            batch[i] = create_test_string(i);
+        }
+        error = consumer_producer_put_batch(&queue, (const char *const *)batch, TEST_CAPACITY);
+        TEST_ASSERT_NULL(error, "Batch put should succeed");
+        for (int i = 0; i < TEST_CAPACITY; i++)
+        {
+            free(batch[i]);
+        }
+
+        /* A get_batch larger than the queue returns everything that is queued */
+        int got = consumer_producer_get_batch(&queue, out, TEST_CAPACITY * 2);
+        TEST_ASSERT_EQUAL(got, TEST_CAPACITY, "Batch get should drain the whole queue");
+        for (int i = 0; i < got; i++)
+        {
+            TEST_ASSERT_EQUAL(extract_value(out[i]), i, "Batch items should be in FIFO order");
+            free(out[i]);
+        }
+
+        /* A get_batch smaller than the queue leaves the rest in order */
+        consumer_producer_put(&queue, "item_7");
+        consumer_producer_put(&queue, "item_8");
+        got = consumer_producer_get_batch(&queue, out, 1);
+        TEST_ASSERT_EQUAL(got, 1, "Batch get should respect max");
+        TEST_ASSERT_EQUAL(extract_value(out[0]), 7, "First item should come first");
+        free(out[0]);
+        char *item = consumer_producer_get(&queue);
+        TEST_ASSERT_EQUAL(extract_value(item), 8, "Remaining item should stay queued");
+        free(item);
+
+        consumer_producer_signal_finished(&queue);
+        TEST_ASSERT_EQUAL(consumer_producer_get_batch(&queue, out, 4), 0,
+                          "Batch get should return 0 once finished and empty");
+
+        consumer_producer_destroy(&queue);
+    }
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Thread that pushes LARGE_TEST_ITEMS items in batches larger than the queue */
+static void *batch_producer_thread(void *arg)
+{
+    test_context_t *ctx = (test_context_t *)arg;
+    char *batch[7];
+
+    for (int i = 0; i < ctx->num_items; i += 7)
+    {
+        int n = ctx->num_items - i < 7 ? ctx->num_items - i : 7;
+        for (int j = 0; j < n; j++)
+        {
+            batch[j] = create_test_string(i + j);
+        }
+        consumer_producer_put_batch(ctx->queue, (const char *const *)batch, n);
+        for (int j = 0; j < n; j++)
+        {
+            free(batch[j]);
+        }
+    }
+    return NULL;
+}
+
+/* Test 16: Concurrent batch producer and batch consumer */
+static int test_batch_threads(void)
+{
+    printf("\nTest 16: Concurrent batch producer and batch consumer\n");
+
+    consumer_producer_mode_t modes[] = {CONSUMER_PRODUCER_MPMC, CONSUMER_PRODUCER_SPSC};
+
+    for (int m = 0; m < 2; m++)
+    {
+        consumer_producer_t queue;
+        test_context_t ctx = {0};
+        pthread_t producer;
+        char *out[4];
+
+        const char *error = consumer_producer_init_mode(&queue, 3, modes[m]);
+        TEST_ASSERT_NULL(error, "Initialization should succeed");
+
+        ctx.queue = &queue;
+        ctx.num_items = LARGE_TEST_ITEMS;
+        pthread_create(&producer, NULL, batch_producer_thread, &ctx);
+
+        int expected = 0;
+        int in_order = 1;
+        while (expected < LARGE_TEST_ITEMS)
+        {
+            int got = consumer_producer_get_batch(&queue, out, 4);
+            for (int i = 0; i < got; i++)
+            {
+                if (extract_value(out[i]) != expected++)
+                {
+                    in_order = 0;
+                }
+                free(out[i]);
+            }
+        }
+        pthread_join(producer, NULL);
+
+        TEST_ASSERT(in_order, "Batches should preserve FIFO order");
+        consumer_producer_destroy(&queue);
+    }
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 17: Ownership-transfer puts hand the very same buffer to the consumer */
+static int test_owned_put(void)
+{
+    printf("\nTest 17: Ownership-transfer puts\n");
+
+    consumer_producer_mode_t modes[] = {CONSUMER_PRODUCER_MPMC, CONSUMER_PRODUCER_SPSC};
+
+    for (int m = 0; m < 2; m++)
+    {
+        consumer_producer_t queue;
+        const char *error = consumer_producer_init_mode(&queue, TEST_CAPACITY, modes[m]);
+        TEST_ASSERT_NULL(error, "Initialization should succeed");
+
+        char *single = create_test_string(1);
+        error = consumer_producer_put_owned(&queue, single);
+        TEST_ASSERT_NULL(error, "Owned put should succeed");
+
+        char *batch[3];
+        for (int i = 0; i < 3; i++)
+        {
+            batch[i] = create_test_string(2 + i);
+        }
+        error = consumer_producer_put_batch_owned(&queue, batch, 3);
+        TEST_ASSERT_NULL(error, "Owned batch put should succeed");
+
+        char *item = consumer_producer_get(&queue);
+        TEST_ASSERT(item == single, "Owned put should not copy the string");
+        free(item);
+        for (int i = 0; i < 3; i++)
+        {
+            item = consumer_producer_get(&queue);
+            TEST_ASSERT(item == batch[i], "Owned batch put should not copy the strings");
+            free(item);
+        }
+
+        /* Rejected owned items are freed by the queue (run with valgrind) */
+        consumer_producer_signal_finished(&queue);
+        error = consumer_producer_put_owned(&queue, create_test_string(9));
+        TEST_ASSERT_NOT_NULL(error, "Owned put should fail after finish");
+
+        consumer_producer_destroy(&queue);
+    }
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 18: Wait strategies and their phase counters */
+static int test_wait_strategies(void)
+{
+    printf("\nTest 18: Wait strategies and their phase counters\n");
+
+    consumer_producer_wait_strategy_t strategies[] = {
+        CONSUMER_PRODUCER_WAIT_BLOCK, CONSUMER_PRODUCER_WAIT_SPIN,
+        CONSUMER_PRODUCER_WAIT_ADAPTIVE, CONSUMER_PRODUCER_WAIT_POLL};
+    const char *names[] = {"block", "spin", "adaptive", "poll"};
+
+    for (int s = 0; s < 4; s++)
+    {
+        consumer_producer_t queue;
+        consumer_producer_stats_t stats;
+        test_context_t ctx = {0};
+        pthread_t producer, consumer;
+
+        printf("    18.%d: %s...\n", s + 1, names[s]);
+        const char *error = consumer_producer_init_mode(&queue, 2, CONSUMER_PRODUCER_SPSC);
+        TEST_ASSERT_NULL(error, "Initialization should succeed");
+        consumer_producer_set_wait_strategy(&queue, strategies[s], 100);
+
+        ctx.queue = &queue;
+        ctx.num_items = 100;
+        ctx.consumed_items = calloc(ctx.num_items, sizeof(int));
+        pthread_mutex_init(&ctx.count_mutex, NULL);
+
+        pthread_create(&producer, NULL, producer_thread, &ctx);
+        pthread_create(&consumer, NULL, consumer_thread, &ctx);
+        pthread_join(producer, NULL);
+        pthread_join(consumer, NULL);
+
+        TEST_ASSERT_EQUAL(ctx.consumed_count, ctx.num_items, "All items should be consumed");
+        for (int i = 0; i < ctx.num_items; i++)
+        {
+            TEST_ASSERT_EQUAL(ctx.consumed_items[i], i, "Items should be consumed in FIFO order");
+        }
+
+        consumer_producer_stats(&queue, &stats);
+        consumer_producer_wait_counts_t *waits = &stats.consumer_waits;
+        TEST_ASSERT_EQUAL(waits->immediate + waits->spin + waits->yield + waits->park,
+                          (unsigned long)ctx.num_items, "Every get should be counted once");
+        if (strategies[s] == CONSUMER_PRODUCER_WAIT_BLOCK)
+        {
+            TEST_ASSERT(waits->spin == 0 && waits->yield == 0, "Block should never spin or yield");
+        }
+        if (strategies[s] == CONSUMER_PRODUCER_WAIT_SPIN)
+        {
+            TEST_ASSERT_EQUAL(waits->yield, 0ul, "Spin should never yield");
+        }
+        if (strategies[s] == CONSUMER_PRODUCER_WAIT_POLL)
+        {
+            TEST_ASSERT(waits->park == 0 && waits->yield == 0, "Poll should never yield or sleep");
+        }
+
+        free(ctx.consumed_items);
+        pthread_mutex_destroy(&ctx.count_mutex);
+        consumer_producer_destroy(&queue);
+    }
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Thread that puts one item after a short delay */
+static void *delayed_put_thread(void *arg)
+{
+    consumer_producer_t *queue = (consumer_producer_t *)arg;
+    usleep(50000);
+    consumer_producer_put(queue, "late");
+    return NULL;
+}
+
+/* Test 19: Non-blocking and timed put/get */
+static int test_try_and_timed(void)
+{
+    printf("\nTest 19: Non-blocking and timed put/get\n");
+
+    consumer_producer_mode_t modes[] = {CONSUMER_PRODUCER_MPMC, CONSUMER_PRODUCER_SPSC};
+    for (int m = 0; m < 2; m++)
+    {
+        consumer_producer_t queue;
+        const char *error = consumer_producer_init_mode(&queue, 2, modes[m]);
+        TEST_ASSERT_NULL(error, "Initialization should succeed");
+
+        char *item = (char *)1;
+        TEST_ASSERT_EQUAL(consumer_producer_try_get(&queue, &item), 1, "try_get on empty queue should report empty");
+        TEST_ASSERT_NULL(item, "try_get should clear the output on failure");
+
+        TEST_ASSERT_EQUAL(consumer_producer_try_put(&queue, "a"), 0, "try_put should succeed with room");
+        TEST_ASSERT_EQUAL(consumer_producer_try_put(&queue, "b"), 0, "try_put should succeed with room");
+        TEST_ASSERT_EQUAL(consumer_producer_try_put(&queue, "c"), 1, "try_put on full queue should report full");
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        struct timespec deadline = deadline_in(100);
+        TEST_ASSERT_EQUAL(consumer_producer_put_until(&queue, "c", &deadline), 1, "put_until should time out on a full queue");
+        TEST_ASSERT(elapsed_ms(&start) >= 90, "put_until should wait until the deadline");
+
+        TEST_ASSERT_EQUAL(consumer_producer_try_get(&queue, &item), 0, "try_get should take a queued item");
+        TEST_ASSERT(item && strcmp(item, "a") == 0, "try_get should keep FIFO order");
+        free(item);
+        TEST_ASSERT_EQUAL(consumer_producer_try_get(&queue, &item), 0, "try_get should take a queued item");
+        TEST_ASSERT(item && strcmp(item, "b") == 0, "try_get should keep FIFO order");
+        free(item);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        deadline = deadline_in(100);
+        TEST_ASSERT_EQUAL(consumer_producer_get_until(&queue, &item, &deadline), 1, "get_until should time out on an empty queue");
+        TEST_ASSERT(elapsed_ms(&start) >= 90, "get_until should wait until the deadline");
+
+        /* An item arriving before the deadline wakes the waiter */
+        pthread_t producer;
+        pthread_create(&producer, NULL, delayed_put_thread, &queue);
+        deadline = deadline_in(5000);
+        TEST_ASSERT_EQUAL(consumer_producer_get_until(&queue, &item, &deadline), 0, "get_until should return the late item");
+        TEST_ASSERT(item && strcmp(item, "late") == 0, "get_until should return the late item");
+        free(item);
+        pthread_join(producer, NULL);
+
+        /* Finished and drained reports -1, not a timeout */
+        consumer_producer_signal_finished(&queue);
+        TEST_ASSERT_EQUAL(consumer_producer_try_put(&queue, "x"), -1, "try_put after finish should fail");
+        deadline = deadline_in(1000);
+        TEST_ASSERT_EQUAL(consumer_producer_get_until(&queue, &item, &deadline), -1, "get_until on finished queue should fail");
+        TEST_ASSERT_EQUAL(consumer_producer_try_put(NULL, "x"), -1, "NULL queue should fail");
+
+        consumer_producer_destroy(&queue);
+    }
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Consumer for the overflow test: slow, checks order survives eviction */
+typedef struct
+{
+    consumer_producer_t *queue;
+    int received;
+    int in_order;
+} overflow_context_t;
+
+static void *overflow_consumer_thread(void *arg)
+{
+    overflow_context_t *ctx = (overflow_context_t *)arg;
+    int last = -1;
+    char *batch[4];
+    int n;
+
+    ctx->in_order = 1;
+    while ((n = consumer_producer_get_batch(ctx->queue, batch, 4)) > 0)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            int value = extract_value(batch[i]);
+            if (value <= last)
+            {
+                ctx->in_order = 0;
+            }
+            last = value;
+            ctx->received++;
+            free(batch[i]);
+        }
+        usleep(10);
+    }
+    return NULL;
+}
+
+/* Test 20: Overflow policies */
+static int test_overflow_policies(void)
+{
+    printf("\nTest 20: Overflow policies\n");
+
+    consumer_producer_mode_t modes[] = {CONSUMER_PRODUCER_MPMC, CONSUMER_PRODUCER_SPSC};
+    char buffer[32];
+    for (int m = 0; m < 2; m++)
+    {
+        consumer_producer_t queue;
+        consumer_producer_stats_t stats;
+        char *item;
+
+        printf("    20.%d: %s drop_newest and drop_oldest...\n", m + 1, m ? "SPSC" : "MPMC");
+        consumer_producer_init_mode(&queue, 4, modes[m]);
+        consumer_producer_set_overflow(&queue, CONSUMER_PRODUCER_OVERFLOW_DROP_NEWEST, 0);
+        for (int i = 0; i < 10; i++)
+        {
+            sprintf(buffer, "item_%d", i);
+            TEST_ASSERT_NULL(consumer_producer_put(&queue, buffer), "Dropping put should not fail");
+        }
+        consumer_producer_stats(&queue, &stats);
+        TEST_ASSERT_EQUAL(stats.dropped_newest, 6ul, "Six items should be discarded");
+        TEST_ASSERT_EQUAL(stats.dropped_oldest, 0ul, "Nothing should be evicted");
+        for (int i = 0; i < 4; i++)
+        {
+            item = consumer_producer_get(&queue);
+            TEST_ASSERT_EQUAL(extract_value(item), i, "The oldest items should survive");
+            free(item);
+        }
+
+        consumer_producer_set_overflow(&queue, CONSUMER_PRODUCER_OVERFLOW_DROP_OLDEST, 0);
+        for (int i = 0; i < 10; i++)
+        {
+            sprintf(buffer, "item_%d", i);
+            consumer_producer_put_owned(&queue, strdup(buffer));
+        }
+        consumer_producer_stats(&queue, &stats);
+        TEST_ASSERT_EQUAL(stats.dropped_oldest, 6ul, "Six items should be evicted");
+        for (int i = 6; i < 10; i++)
+        {
+            item = consumer_producer_get(&queue);
+            TEST_ASSERT_EQUAL(extract_value(item), i, "The newest items should survive");
+            free(item);
+        }
+
+        /* The timed variants ignore the policy */
+        for (int i = 0; i < 4; i++)
+        {
+            consumer_producer_put(&queue, "fill");
+        }
+        TEST_ASSERT_EQUAL(consumer_producer_try_put(&queue, "x"), 1, "try_put should report full, not evict");
+        consumer_producer_stats(&queue, &stats);
+        TEST_ASSERT_EQUAL(stats.dropped_oldest, 6ul, "try_put should not evict");
+        while (consumer_producer_try_get(&queue, &item) == 0)
+        {
+            free(item);
+        }
+
+        /* Sampling loses some items and evicts for some */
+        consumer_producer_set_overflow(&queue, CONSUMER_PRODUCER_OVERFLOW_SAMPLE, 4);
+        for (int i = 0; i < 1000; i++)
+        {
+            consumer_producer_put(&queue, "sampled");
+        }
+        consumer_producer_stats(&queue, &stats);
+        TEST_ASSERT_EQUAL(stats.dropped_newest - 6ul + stats.dropped_oldest - 6ul, 996ul,
+                          "Every overflowing item should be counted once");
+        TEST_ASSERT(stats.dropped_oldest > 6ul && stats.dropped_newest > stats.dropped_oldest,
+                    "Sampling should keep a minority of the overflow");
+        while (consumer_producer_try_get(&queue, &item) == 0)
+        {
+            free(item);
+        }
+        consumer_producer_destroy(&queue);
+
+        printf("    20.%d: %s drop_oldest against a slow consumer...\n", m + 3, m ? "SPSC" : "MPMC");
+        consumer_producer_init_mode(&queue, 8, modes[m]);
+        consumer_producer_set_overflow(&queue, CONSUMER_PRODUCER_OVERFLOW_DROP_OLDEST, 0);
+        overflow_context_t ctx = {&queue, 0, 0};
+        pthread_t consumer;
+        pthread_create(&consumer, NULL, overflow_consumer_thread, &ctx);
+        for (int i = 0; i < 50000; i++)
+        {
+            sprintf(buffer, "item_%d", i);
+            consumer_producer_put(&queue, buffer);
+        }
+        consumer_producer_signal_finished(&queue);
+        pthread_join(consumer, NULL);
+        consumer_producer_stats(&queue, &stats);
+        TEST_ASSERT(ctx.in_order, "Eviction should never reorder items");
+        TEST_ASSERT_EQUAL(ctx.received + (int)stats.dropped_oldest, 50000, "Every item is received or evicted");
+        consumer_producer_destroy(&queue);
+    }
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Thread that takes one item after a short delay */
+static void *delayed_get_thread(void *arg)
+{
+    consumer_producer_t *queue = (consumer_producer_t *)arg;
+    usleep(50000);
+    free(consumer_producer_get(queue));
+    return NULL;
+}
+
+/* Test 21: Occupancy and blocking time counters */
+static int test_telemetry(void)
+{
+    printf("\nTest 21: Occupancy and blocking time counters\n");
+
+    consumer_producer_mode_t modes[] = {CONSUMER_PRODUCER_MPMC, CONSUMER_PRODUCER_SPSC};
+    for (int m = 0; m < 2; m++)
+    {
+        consumer_producer_t queue;
+        consumer_producer_stats_t stats;
+        consumer_producer_init_mode(&queue, 4, modes[m]);
+
+        consumer_producer_put(&queue, "a");
+        consumer_producer_put(&queue, "b");
+        consumer_producer_put(&queue, "c");
+        free(consumer_producer_get(&queue));
+        free(consumer_producer_get(&queue));
+        consumer_producer_stats(&queue, &stats);
+        TEST_ASSERT_EQUAL(stats.depth, 1ul, "One item should be queued");
+        TEST_ASSERT_EQUAL(stats.high_water, 3ul, "High-water mark should be three");
+        TEST_ASSERT_EQUAL(stats.total_put, 3ul, "Three items should have been put");
+        TEST_ASSERT_EQUAL(stats.total_got, 2ul, "Two items should have been taken");
+        TEST_ASSERT_EQUAL(stats.producer_blocked_ns + stats.consumer_blocked_ns, 0ul, "Nobody waited yet");
+
+        /* The consumer waits ~50ms on an empty queue */
+        free(consumer_producer_get(&queue));
+        pthread_t other;
+        pthread_create(&other, NULL, delayed_put_thread, &queue);
+        free(consumer_producer_get(&queue));
+        pthread_join(other, NULL);
+
+        /* The producer waits ~50ms on a full queue */
+        for (int i = 0; i < 4; i++)
+        {
+            consumer_producer_put(&queue, "fill");
+        }
+        pthread_create(&other, NULL, delayed_get_thread, &queue);
+        consumer_producer_put(&queue, "late");
+        pthread_join(other, NULL);
+
+        consumer_producer_stats(&queue, &stats);
+        TEST_ASSERT(stats.consumer_blocked_ns >= 40000000ul, "Consumer blocking time should be counted");
+        TEST_ASSERT(stats.producer_blocked_ns >= 40000000ul, "Producer blocking time should be counted");
+        TEST_ASSERT_EQUAL(stats.high_water, 4ul, "High-water mark should reach capacity");
+        TEST_ASSERT_EQUAL(stats.depth, 4ul, "Queue should be full again");
+        TEST_ASSERT_EQUAL(stats.total_put - stats.total_got, stats.depth, "Totals should match the depth");
+
+        char *item;
+        while (consumer_producer_try_get(&queue, &item) == 0)
+        {
+            free(item);
+        }
+        consumer_producer_destroy(&queue);
+    }
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
 /* Main test runner */
+/* Test 22: Messages keep their length and flags through the queue */
+static int test_messages(void)
+{
+    printf("\nTest 22: Message puts and gets\n");
+
+    consumer_producer_mode_t modes[] = {CONSUMER_PRODUCER_MPMC, CONSUMER_PRODUCER_SPSC};
+
+    for (int m = 0; m < 2; m++)
+    {
+        consumer_producer_t queue;
+        const char *error = consumer_producer_init_mode(&queue, TEST_CAPACITY, modes[m]);
+        TEST_ASSERT_NULL(error, "Initialization should succeed");
+
+        message_t in[2];
+        TEST_ASSERT_EQUAL(message_copy(&in[0], "hello", 5), 0, "message_copy should succeed");
+        TEST_ASSERT_EQUAL(message_end(&in[1]), 0, "message_end should succeed");
+        char *data = in[0].data;
+        error = consumer_producer_put_messages(&queue, in, 2);
+        TEST_ASSERT_NULL(error, "Message put should succeed");
+
+        /* A string put is measured once on the way in */
+        error = consumer_producer_put(&queue, "abc");
+        TEST_ASSERT_NULL(error, "String put should succeed");
+
+        message_t out[4];
+        int got = consumer_producer_get_messages(&queue, out, 4);
+        TEST_ASSERT_EQUAL(got, 3, "get_messages should take everything queued");
+        TEST_ASSERT(out[0].data == data, "Message put should not copy the data");
+        TEST_ASSERT(out[0].len == 5 && out[0].flags == 0, "Length and flags should be kept");
+        TEST_ASSERT(out[1].flags == MESSAGE_END && strcmp(out[1].data, "<END>") == 0, "END flag should be kept");
+        TEST_ASSERT(out[2].len == 3 && strcmp(out[2].data, "abc") == 0, "String puts should get their length");
+        for (int i = 0; i < got; i++)
+        {
+            message_release(&out[i]);
+        }
+
+        /* Messages come out of the string gets as plain heap strings */
+        TEST_ASSERT_EQUAL(message_copy(&in[0], "xyz", 3), 0, "message_copy should succeed");
+        TEST_ASSERT_EQUAL(consumer_producer_put_message_until(&queue, &in[0], NULL), 0, "Timed message put should succeed");
+        char *item = consumer_producer_get(&queue);
+        TEST_ASSERT(item && strcmp(item, "xyz") == 0, "String get should return the message data");
+        free(item);
+
+        consumer_producer_destroy(&queue);
+    }
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Puts POOL_TEST_ITEMS fresh messages, the way the first stage of a pipeline does */
+#define POOL_TEST_ITEMS 20000
+
+static void *pool_producer(void *arg)
+{
+    consumer_producer_t *queue = (consumer_producer_t *)arg;
+    for (int i = 0; i < POOL_TEST_ITEMS; i++)
+    {
+        message_t message;
+        if (message_copy(&message, "pooled item", 11) != 0 ||
+            consumer_producer_put_message_until(queue, &message, NULL) != 0)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static int test_message_pool(void)
+{
+    printf("\nTest 23: Message pool across threads\n");
+
+    size_t cap;
+    char *buffer = message_buffer_alloc(100, &cap);
+    TEST_ASSERT(buffer != NULL && cap >= 100 && cap < 200, "A buffer should come from the next size class");
+    message_buffer_free(buffer, cap);
+
+    /* Allocated on one thread and freed on another, buffers come back through the depot */
+    consumer_producer_t queue;
+    const char *error = consumer_producer_init_mode(&queue, 64, CONSUMER_PRODUCER_SPSC);
+    TEST_ASSERT_NULL(error, "Initialization should succeed");
+
+    pthread_t producer;
+    TEST_ASSERT_EQUAL(pthread_create(&producer, NULL, pool_producer, &queue), 0, "Producer should start");
+
+    message_pool_stats_t warm = {0, 0};
+    message_t items[16];
+    int taken = 0;
+    while (taken < POOL_TEST_ITEMS)
+    {
+        int got = consumer_producer_get_messages(&queue, items, 16);
+        for (int i = 0; i < got; i++)
+        {
+            message_release(&items[i]);
+        }
+        if (taken < POOL_TEST_ITEMS / 2 && taken + got >= POOL_TEST_ITEMS / 2)
+        {
+            message_pool_stats(&warm);
+        }
+        taken += got;
+    }
+    pthread_join(producer, NULL);
+    consumer_producer_destroy(&queue);
+
+    message_pool_stats_t done;
+    message_pool_stats(&done);
+    TEST_ASSERT(done.mallocs - warm.mallocs < POOL_TEST_ITEMS / 100, "A warm pool should hardly call malloc");
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+static int test_inline_slots(void)
+{
+    printf("\nTest 24: Inline slots\n");
+
+    consumer_producer_mode_t modes[] = {CONSUMER_PRODUCER_MPMC, CONSUMER_PRODUCER_SPSC};
+    const char *long_item = "a string that is far too long to fit into an inline slot";
+
+    for (int m = 0; m < 2; m++)
+    {
+        consumer_producer_t queue;
+        const char *error = consumer_producer_init_mode(&queue, TEST_CAPACITY, modes[m]);
+        TEST_ASSERT_NULL(error, "Initialization should succeed");
+        TEST_ASSERT_NOT_NULL(consumer_producer_set_inline(&queue, 0), "Inline size 0 should be rejected");
+        error = consumer_producer_set_inline(&queue, 16);
+        TEST_ASSERT_NULL(error, "Setting the inline size should succeed");
+
+        /* Twice around the ring, so slots are reused */
+        for (int round = 0; round < 2 * TEST_CAPACITY; round++)
+        {
+            message_t in[2];
+            TEST_ASSERT_EQUAL(message_copy(&in[0], "short", 5), 0, "message_copy should succeed");
+            TEST_ASSERT_EQUAL(message_copy(&in[1], long_item, strlen(long_item)), 0, "message_copy should succeed");
+            in[0].flags = MESSAGE_FLUSH;
+            char *long_data = in[1].data;
+            error = consumer_producer_put_messages(&queue, in, 2);
+            TEST_ASSERT_NULL(error, "Message put should succeed");
+
+            message_t out[2];
+            TEST_ASSERT_EQUAL(consumer_producer_get_messages(&queue, out, 2), 2, "Both messages should come out");
+            TEST_ASSERT(strcmp(out[0].data, "short") == 0 && out[0].len == 5, "Inline payload should be copied out");
+            TEST_ASSERT(out[0].flags == MESSAGE_FLUSH && out[0].cap > 5, "An inline message should get its own buffer");
+            TEST_ASSERT(out[1].data == long_data, "A long payload should stay a pointer");
+            message_release(&out[0]);
+            message_release(&out[1]);
+        }
+
+        /* String puts copy straight into the slot and string gets get a heap copy */
+        TEST_ASSERT_NULL(consumer_producer_put(&queue, "abc"), "String put should succeed");
+        char *item = consumer_producer_get(&queue);
+        TEST_ASSERT(item && strcmp(item, "abc") == 0, "String get should return the inline payload");
+        free(item);
+
+        TEST_ASSERT_NOT_NULL(consumer_producer_set_inline(&queue, 32), "Inline size can only be set once");
+        consumer_producer_destroy(&queue);
+    }
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+static int test_numa_node(void)
+{
+    printf("\nTest 25: Moving the slots to a NUMA node\n");
+
+    /* Without NUMA support the slots still move, the kernel just ignores the binding */
+    int node = topology_cpu_node(0) >= 0 ? topology_cpu_node(0) : 0;
+    consumer_producer_mode_t modes[] = {CONSUMER_PRODUCER_MPMC, CONSUMER_PRODUCER_SPSC};
+
+    for (int m = 0; m < 2; m++)
+    {
+        consumer_producer_t queue;
+        const char *error = consumer_producer_init_mode(&queue, TEST_CAPACITY, modes[m]);
+        TEST_ASSERT_NULL(error, "Initialization should succeed");
+        TEST_ASSERT_NOT_NULL(consumer_producer_set_node(&queue, -1), "A negative node should be rejected");
+        TEST_ASSERT_NULL(consumer_producer_set_inline(&queue, 16), "Setting the inline size should succeed");
+        error = consumer_producer_set_node(&queue, node);
+        TEST_ASSERT_NULL(error, "Moving an unused queue should succeed");
+        TEST_ASSERT_EQUAL(queue.node, node, "The queue should know its node");
+
+        /* Around the ring twice, inline and pointer payloads alike */
+        for (int round = 0; round < 2 * TEST_CAPACITY; round++)
+        {
+            TEST_ASSERT_NULL(consumer_producer_put(&queue, round % 2 ? "short" : "a payload too long to be inline"),
+                             "Put should succeed");
+            char *item = consumer_producer_get(&queue);
+            TEST_ASSERT(item && strcmp(item, round % 2 ? "short" : "a payload too long to be inline") == 0,
+                        "Items should survive the move");
+            free(item);
+        }
+
+        TEST_ASSERT_NOT_NULL(consumer_producer_set_node(&queue, node), "A queue in use can't move");
+        consumer_producer_destroy(&queue);
+    }
+
+    int cpus[TOPOLOGY_MAX_CPUS];
+    int count = topology_cpu_order(cpus, TOPOLOGY_MAX_CPUS);
+    TEST_ASSERT(count >= 1, "There is at least one CPU");
+    for (int i = 1; i < count; i++)
+    {
+        TEST_ASSERT(topology_cpu_node(cpus[i - 1]) <= topology_cpu_node(cpus[i]), "CPUs come node by node");
+    }
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
 int main(int argc, char *argv[])
 {
     printf("========================================\n");
@@ -893,6 +1727,19 @@ int main(int argc, char *argv[])
     test_stress();
     test_error_handling();
     test_memory_management();
+    test_spsc_ring();
+    test_spsc_threads();
+    test_batch_operations();
+    test_batch_threads();
+    test_owned_put();
+    test_wait_strategies();
+    test_try_and_timed();
+    test_overflow_policies();
+    test_telemetry();
+    test_messages();
+    test_message_pool();
+    test_inline_slots();
+    test_numa_node();
 
     /* Print summary */
     printf("\n========================================\n");
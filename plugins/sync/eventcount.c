@@ -0,0 +1,96 @@
+#include "eventcount.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static long futex(atomic_uint *word, int op, unsigned int value, const struct timespec *timeout)
+{
+    // FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC timeout, the bitset must match any waker
+    return syscall(SYS_futex, (unsigned int *)word, op, value, timeout, NULL,
+                   op == FUTEX_WAIT_BITSET_PRIVATE ? FUTEX_BITSET_MATCH_ANY : 0);
+}
+
+int eventcount_init(eventcount_t *ec)
+{
+    if (ec == NULL)
+    {
+        return -1;
+    }
+    atomic_init(&ec->epoch, 0);
+    atomic_init(&ec->waiters, 0);
+    return 0;
+}
+
+void eventcount_destroy(eventcount_t *ec)
+{
+    (void)ec; // Nothing to release, a futex is just a word in memory
+}
+
+unsigned int eventcount_prepare_wait(eventcount_t *ec)
+{
+    // Sequentially consistent: pairs with the fence in notify, so either the
+    // notifier sees us registered or we see the condition it published
+    atomic_fetch_add(&ec->waiters, 1);
+    return atomic_load(&ec->epoch);
+}
+
+void eventcount_cancel_wait(eventcount_t *ec)
+{
+    atomic_fetch_sub_explicit(&ec->waiters, 1, memory_order_relaxed);
+}
+
+int eventcount_wait(eventcount_t *ec, unsigned int key)
+{
+    return eventcount_wait_until(ec, key, NULL);
+}
+
+int eventcount_wait_until(eventcount_t *ec, unsigned int key, const struct timespec *deadline)
+{
+    if (ec == NULL)
+    {
+        return -1;
+    }
+
+    int result = 0;
+    while (atomic_load_explicit(&ec->epoch, memory_order_acquire) == key)
+    {
+        // EAGAIN: epoch already moved, EINTR: spurious, both re-check the loop
+        if (futex(&ec->epoch, FUTEX_WAIT_BITSET_PRIVATE, key, deadline) == 0 || errno == EAGAIN || errno == EINTR)
+        {
+            continue;
+        }
+        result = errno == ETIMEDOUT ? 1 : -1;
+        break;
+    }
+    atomic_fetch_sub_explicit(&ec->waiters, 1, memory_order_relaxed);
+    return result;
+}
+
+static void notify(eventcount_t *ec, int count)
+{
+    if (ec == NULL)
+    {
+        return;
+    }
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ec->waiters, memory_order_relaxed) == 0)
+    {
+        return; // Fast path: nobody sleeps, no syscall
+    }
+    atomic_fetch_add_explicit(&ec->epoch, 1, memory_order_release);
+    futex(&ec->epoch, FUTEX_WAKE_PRIVATE, (unsigned int)count, NULL);
+}
+
+void eventcount_notify(eventcount_t *ec)
+{
+    notify(ec, 1);
+}
+
+void eventcount_notify_all(eventcount_t *ec)
+{
+    notify(ec, INT_MAX);
+}
@@ -0,0 +1,91 @@
+#ifndef EVENTCOUNT_H_
+#define EVENTCOUNT_H_
+#include <stdatomic.h>
+#include <time.h>
+
+/**
+ * Futex based eventcount.
+ * Unlike monitor_t it keeps no mutex and no remembered state: a waiter
+ * registers itself with eventcount_prepare_wait(), re-checks its own
+ * condition and only then sleeps. A notifier that finds no registered
+ * waiter returns without a syscall, so signalling is nearly free when the
+ * other side is busy.
+ *
+ * Usage (waiter):
+ *     while (!condition)
+ *     {
+ *         unsigned int key = eventcount_prepare_wait(&ec);
+ *         if (condition)
+ *         {
+ *             eventcount_cancel_wait(&ec);
+ *             break;
+ *         }
+ *         eventcount_wait(&ec, key);
+ *     }
+ * Usage (notifier): make condition true, then eventcount_notify(&ec).
+ */
+typedef struct
+{
+    atomic_uint epoch;   /* Futex word, bumped by every notify that finds waiters */
+    atomic_uint waiters; /* Threads between prepare_wait and the end of wait/cancel */
+} eventcount_t;
+
+/**
+ * Initialize an eventcount
+ * @param ec Pointer to eventcount structure
+ * @return 0 on success, -1 on failure
+ */
+int eventcount_init(eventcount_t *ec);
+
+/**
+ * Destroy an eventcount (no waiter may still be registered)
+ * @param ec Pointer to eventcount structure
+ */
+void eventcount_destroy(eventcount_t *ec);
+
+/**
+ * Register the calling thread as a waiter.
+ * The caller must re-check its condition afterwards and then either call
+ * eventcount_wait() with the returned key or eventcount_cancel_wait().
+ * @param ec Pointer to eventcount structure
+ * @return Key to pass to eventcount_wait
+ */
+unsigned int eventcount_prepare_wait(eventcount_t *ec);
+
+/**
+ * Unregister a waiter whose condition became true after prepare_wait
+ * @param ec Pointer to eventcount structure
+ */
+void eventcount_cancel_wait(eventcount_t *ec);
+
+/**
+ * Sleep until the eventcount is notified after the matching prepare_wait.
+ * Returns immediately if a notify already happened in between.
+ * @param ec Pointer to eventcount structure
+ * @param key Value returned by eventcount_prepare_wait
+ * @return 0 on success, -1 on error
+ */
+int eventcount_wait(eventcount_t *ec, unsigned int key);
+
+/**
+ * Like eventcount_wait, but gives up at a deadline
+ * @param ec Pointer to eventcount structure
+ * @param key Value returned by eventcount_prepare_wait
+ * @param deadline Absolute CLOCK_MONOTONIC time, NULL waits forever
+ * @return 0 when notified, 1 on timeout, -1 on error
+ */
+int eventcount_wait_until(eventcount_t *ec, unsigned int key, const struct timespec *deadline);
+
+/**
+ * Wake one registered waiter. No syscall is made when nobody waits.
+ * @param ec Pointer to eventcount structure
+ */
+void eventcount_notify(eventcount_t *ec);
+
+/**
+ * Wake every registered waiter. No syscall is made when nobody waits.
+ * @param ec Pointer to eventcount structure
+ */
+void eventcount_notify_all(eventcount_t *ec);
+
+#endif
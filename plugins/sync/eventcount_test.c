@@ -0,0 +1,390 @@
+/**
+ * eventcount_test.c
+ * Test suite for the futex based eventcount, plus a ping-pong benchmark that
+ * compares it with monitor_t
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include "eventcount.h"
+#include "monitor.h"
+
+#define MAX_THREADS 8
+#define PING_PONG_ROUNDS 100000
+
+/* Test result tracking */
+typedef struct
+{
+    int passed;
+    int failed;
+    int total;
+} test_results_t;
+
+static test_results_t results = {0, 0, 0};
+
+/* Helper macros for test assertions */
+#define TEST_ASSERT(condition, message)          \
+    do                                           \
+    {                                            \
+        if (!(condition))                        \
+        {                                        \
+            printf("    FAILED: %s\n", message); \
+            results.failed++;                    \
+            results.total++;                     \
+            return 0;                            \
+        }                                        \
+    } while (0)
+
+#define TEST_ASSERT_EQUAL(a, b, message) TEST_ASSERT((a) == (b), message)
+
+/* Shared state for the waiter threads: a flag guarded by the eventcount */
+typedef struct
+{
+    eventcount_t *ec;
+    atomic_int flag;
+    atomic_int woken;
+} test_context_t;
+
+static long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* Waits with the documented prepare / re-check / wait loop until flag is set */
+static void *flag_waiter_thread(void *arg)
+{
+    test_context_t *ctx = (test_context_t *)arg;
+
+    while (!atomic_load(&ctx->flag))
+    {
+        unsigned int key = eventcount_prepare_wait(ctx->ec);
+        if (atomic_load(&ctx->flag))
+        {
+            eventcount_cancel_wait(ctx->ec);
+            break;
+        }
+        eventcount_wait(ctx->ec, key);
+    }
+    atomic_fetch_add(&ctx->woken, 1);
+    return NULL;
+}
+
+/* Test 1: Basic initialization and destruction */
+static int test_init_destroy(void)
+{
+    printf("\nTest 1: Basic initialization and destruction\n");
+
+    eventcount_t ec;
+    TEST_ASSERT_EQUAL(eventcount_init(&ec), 0, "Init should succeed");
+    TEST_ASSERT_EQUAL(atomic_load(&ec.waiters), 0u, "No waiters after init");
+    eventcount_destroy(&ec);
+
+    TEST_ASSERT_EQUAL(eventcount_init(NULL), -1, "Init with NULL should fail");
+    TEST_ASSERT_EQUAL(eventcount_wait(NULL, 0), -1, "Wait with NULL should fail");
+    eventcount_notify(NULL); /* Must not crash */
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 2: Notify without waiters takes the fast path */
+static int test_notify_without_waiters(void)
+{
+    printf("\nTest 2: Notify without waiters takes the fast path\n");
+
+    eventcount_t ec;
+    eventcount_init(&ec);
+
+    unsigned int before = atomic_load(&ec.epoch);
+    for (int i = 0; i < 1000; i++)
+    {
+        eventcount_notify(&ec);
+        eventcount_notify_all(&ec);
+    }
+    TEST_ASSERT_EQUAL(atomic_load(&ec.epoch), before, "Epoch should not move without waiters");
+
+    eventcount_destroy(&ec);
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 3: Prepare, cancel and a notify between prepare and wait */
+static int test_prepare_cancel(void)
+{
+    printf("\nTest 3: Prepare, cancel and notify before wait\n");
+
+    eventcount_t ec;
+    eventcount_init(&ec);
+
+    printf("    3.1: Prepare then cancel...\n");
+    eventcount_prepare_wait(&ec);
+    TEST_ASSERT_EQUAL(atomic_load(&ec.waiters), 1u, "Prepare should register a waiter");
+    eventcount_cancel_wait(&ec);
+    TEST_ASSERT_EQUAL(atomic_load(&ec.waiters), 0u, "Cancel should unregister the waiter");
+
+    printf("    3.2: Notify between prepare and wait...\n");
+    unsigned int key = eventcount_prepare_wait(&ec);
+    eventcount_notify(&ec);
+    long start = now_ns();
+    TEST_ASSERT_EQUAL(eventcount_wait(&ec, key), 0, "Wait should succeed");
+    TEST_ASSERT(now_ns() - start < 100000000L, "Wait should return at once after a notify");
+    TEST_ASSERT_EQUAL(atomic_load(&ec.waiters), 0u, "Wait should unregister the waiter");
+
+    eventcount_destroy(&ec);
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 4: A waiter blocks until notified */
+static int test_thread_blocking(void)
+{
+    printf("\nTest 4: A waiter blocks until notified\n");
+
+    eventcount_t ec;
+    test_context_t ctx;
+    pthread_t waiter;
+
+    eventcount_init(&ec);
+    ctx.ec = &ec;
+    atomic_init(&ctx.flag, 0);
+    atomic_init(&ctx.woken, 0);
+
+    pthread_create(&waiter, NULL, flag_waiter_thread, &ctx);
+    usleep(200000); /* 200ms */
+    TEST_ASSERT_EQUAL(atomic_load(&ctx.woken), 0, "Waiter should still be blocked");
+    TEST_ASSERT_EQUAL(atomic_load(&ec.waiters), 1u, "Waiter should be registered");
+
+    atomic_store(&ctx.flag, 1);
+    eventcount_notify(&ec);
+    pthread_join(waiter, NULL);
+
+    TEST_ASSERT_EQUAL(atomic_load(&ctx.woken), 1, "Waiter should have been woken");
+    TEST_ASSERT_EQUAL(atomic_load(&ec.waiters), 0u, "No waiters should be left");
+
+    eventcount_destroy(&ec);
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 5: notify_all wakes every waiter */
+static int test_notify_all(void)
+{
+    printf("\nTest 5: notify_all wakes every waiter\n");
+
+    eventcount_t ec;
+    test_context_t ctx;
+    pthread_t waiters[MAX_THREADS];
+
+    eventcount_init(&ec);
+    ctx.ec = &ec;
+    atomic_init(&ctx.flag, 0);
+    atomic_init(&ctx.woken, 0);
+
+    for (int i = 0; i < MAX_THREADS; i++)
+    {
+        pthread_create(&waiters[i], NULL, flag_waiter_thread, &ctx);
+    }
+    usleep(200000); /* 200ms */
+
+    atomic_store(&ctx.flag, 1);
+    eventcount_notify_all(&ec);
+    for (int i = 0; i < MAX_THREADS; i++)
+    {
+        pthread_join(waiters[i], NULL);
+    }
+
+    TEST_ASSERT_EQUAL(atomic_load(&ctx.woken), MAX_THREADS, "All waiters should have been woken");
+
+    eventcount_destroy(&ec);
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Ping-pong between two threads: turn flips 0 -> 1 -> 0 ... */
+typedef struct
+{
+    eventcount_t ec[2];
+    monitor_t monitor[2];
+    atomic_int turn;
+    int use_monitor;
+} ping_pong_t;
+
+static void ping_pong_side(ping_pong_t *pp, int me)
+{
+    int other = 1 - me;
+
+    for (int i = 0; i < PING_PONG_ROUNDS; i++)
+    {
+        if (pp->use_monitor)
+        {
+            while (atomic_load(&pp->turn) != me)
+            {
+                monitor_wait(&pp->monitor[me]);
+                monitor_reset(&pp->monitor[me]);
+            }
+            atomic_store(&pp->turn, other);
+            monitor_signal(&pp->monitor[other]);
+            continue;
+        }
+
+        while (atomic_load(&pp->turn) != me)
+        {
+            unsigned int key = eventcount_prepare_wait(&pp->ec[me]);
+            if (atomic_load(&pp->turn) == me)
+            {
+                eventcount_cancel_wait(&pp->ec[me]);
+                break;
+            }
+            eventcount_wait(&pp->ec[me], key);
+        }
+        atomic_store(&pp->turn, other);
+        eventcount_notify(&pp->ec[other]);
+    }
+}
+
+static void *ping_pong_thread(void *arg)
+{
+    ping_pong_side((ping_pong_t *)arg, 1);
+    return NULL;
+}
+
+static long run_ping_pong(int use_monitor)
+{
+    ping_pong_t pp;
+    pthread_t other;
+
+    for (int i = 0; i < 2; i++)
+    {
+        eventcount_init(&pp.ec[i]);
+        monitor_init(&pp.monitor[i]);
+    }
+    atomic_init(&pp.turn, 0);
+    pp.use_monitor = use_monitor;
+
+    long start = now_ns();
+    pthread_create(&other, NULL, ping_pong_thread, &pp);
+    ping_pong_side(&pp, 0);
+    pthread_join(other, NULL);
+    long elapsed = now_ns() - start;
+
+    for (int i = 0; i < 2; i++)
+    {
+        eventcount_destroy(&pp.ec[i]);
+        monitor_destroy(&pp.monitor[i]);
+    }
+    return elapsed;
+}
+
+/* Test 6: No lost wakeups over many handoffs, timed against monitor_t */
+static int test_ping_pong(void)
+{
+    printf("\nTest 6: Ping-pong handoffs (eventcount vs monitor)\n");
+
+    long ec_ns = run_ping_pong(0);
+    long monitor_ns = run_ping_pong(1);
+
+    /* Reaching this point at all means no handoff was lost */
+    printf("    eventcount: %.1f ns/handoff\n", (double)ec_ns / (2.0 * PING_PONG_ROUNDS));
+    printf("    monitor:    %.1f ns/handoff\n", (double)monitor_ns / (2.0 * PING_PONG_ROUNDS));
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 7: wait_until gives up at the deadline */
+static int test_wait_until(void)
+{
+    printf("\nTest 7: wait_until gives up at the deadline\n");
+
+    eventcount_t ec;
+    eventcount_init(&ec);
+
+    printf("    7.1: Nobody notifies...\n");
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    long start = now_ns();
+    deadline.tv_nsec += 100000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    unsigned int key = eventcount_prepare_wait(&ec);
+    TEST_ASSERT_EQUAL(eventcount_wait_until(&ec, key, &deadline), 1, "Wait should time out");
+    TEST_ASSERT(now_ns() - start >= 90000000L, "Wait should last until the deadline");
+    TEST_ASSERT_EQUAL(atomic_load(&ec.waiters), 0u, "A timed out wait should unregister the waiter");
+
+    printf("    7.2: Deadline already in the past...\n");
+    key = eventcount_prepare_wait(&ec);
+    TEST_ASSERT_EQUAL(eventcount_wait_until(&ec, key, &deadline), 1, "Expired deadline should time out at once");
+
+    printf("    7.3: Notified before the deadline...\n");
+    deadline.tv_sec += 5;
+    key = eventcount_prepare_wait(&ec);
+    eventcount_notify(&ec);
+    TEST_ASSERT_EQUAL(eventcount_wait_until(&ec, key, &deadline), 0, "Notified wait should succeed");
+
+    eventcount_destroy(&ec);
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Main test runner */
+int main(int argc, char *argv[])
+{
+    printf("========================================\n");
+    printf("Eventcount Test Suite\n");
+    printf("========================================\n");
+
+    test_init_destroy();
+    test_notify_without_waiters();
+    test_prepare_cancel();
+    test_thread_blocking();
+    test_notify_all();
+    test_ping_pong();
+    test_wait_until();
+
+    /* Print summary */
+    printf("\n========================================\n");
+    printf("Test Results Summary:\n");
+    printf("Total:  %d\n", results.total);
+    printf("Passed: %d\n", results.passed);
+    printf("Failed: %d\n", results.failed);
+
+    if (results.failed == 0)
+    {
+        printf("\nAll tests PASSED! ✓\n");
+    }
+    else
+    {
+        printf("\nSome tests FAILED! ✗\n");
+    }
+    printf("========================================\n");
+
+    return results.failed > 0 ? 1 : 0;
+}
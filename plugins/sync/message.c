@@ -0,0 +1,291 @@
+#define _GNU_SOURCE // sched_getcpu
+#include "message.h"
+#include "topology.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_MIN_SHIFT 4                                  // The smallest class holds 16 bytes
+#define POOL_CLASSES 9                                    // 16, 32, ... 4096 bytes
+#define POOL_MAX_SIZE ((size_t)1 << (POOL_MIN_SHIFT + POOL_CLASSES - 1))
+#define POOL_BATCH 64                                     // Buffers moved between a cache and the depot at once
+#define POOL_CACHE_MAX (2 * POOL_BATCH)                   // Buffers a thread keeps per class
+#define POOL_DEPOT_MAX 64                                 // Batches the depot keeps per class
+#define POOL_NODES 8                                      // Depots, one per NUMA node (modulo)
+
+// A free buffer. The first one of a depot batch also links the next batch
+typedef struct pool_block
+{
+    struct pool_block *next;
+    struct pool_block *next_batch;
+} pool_block_t;
+
+typedef struct
+{
+    pool_block_t *head;
+    int count;
+} pool_cache_t;
+
+static __thread pool_cache_t thread_cache[POOL_CLASSES];
+static __thread int thread_cache_registered;
+
+// Full batches of POOL_BATCH buffers, shared by the threads of a NUMA node
+static pthread_mutex_t depot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pool_block_t *depot[POOL_NODES][POOL_CLASSES];
+static int depot_batches[POOL_NODES][POOL_CLASSES];
+
+static atomic_ulong pool_mallocs;
+static atomic_ulong pool_frees;
+
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+
+// Smallest class that holds size bytes, -1 if none does
+static int class_for_size(size_t size)
+{
+    if (size > POOL_MAX_SIZE)
+    {
+        return -1;
+    }
+    if (size <= ((size_t)1 << POOL_MIN_SHIFT))
+    {
+        return 0;
+    }
+    return (int)(sizeof(unsigned long) * 8 - __builtin_clzl(size - 1)) - POOL_MIN_SHIFT;
+}
+
+// Largest class a buffer of cap bytes can serve, -1 if it is too small or
+// so large that keeping it for a small class would waste it
+static int class_for_cap(size_t cap)
+{
+    if (cap < ((size_t)1 << POOL_MIN_SHIFT) || cap >= 2 * POOL_MAX_SIZE)
+    {
+        return -1;
+    }
+    int class = (int)(sizeof(unsigned long) * 8 - 1 - __builtin_clzl(cap)) - POOL_MIN_SHIFT;
+    return class < POOL_CLASSES ? class : POOL_CLASSES - 1;
+}
+
+// Depot of the node the calling thread runs on
+static int depot_node(void)
+{
+    int node = topology_cpu_node(sched_getcpu());
+    return node > 0 ? node % POOL_NODES : 0;
+}
+
+static void free_chain(pool_block_t *block)
+{
+    while (block)
+    {
+        pool_block_t *next = block->next;
+        free(block);
+        atomic_fetch_add_explicit(&pool_frees, 1, memory_order_relaxed);
+        block = next;
+    }
+}
+
+// Takes the first POOL_BATCH buffers of a thread's cache to the depot
+static void spill_batch(pool_cache_t *cache, int class)
+{
+    pool_block_t *batch = cache->head;
+    pool_block_t *last = batch;
+    for (int i = 1; i < POOL_BATCH; i++)
+    {
+        last = last->next;
+    }
+    cache->head = last->next;
+    cache->count -= POOL_BATCH;
+    last->next = NULL;
+
+    int node = depot_node();
+    pthread_mutex_lock(&depot_lock);
+    int kept = depot_batches[node][class] < POOL_DEPOT_MAX;
+    if (kept)
+    {
+        batch->next_batch = depot[node][class];
+        depot[node][class] = batch;
+        depot_batches[node][class]++;
+    }
+    pthread_mutex_unlock(&depot_lock);
+
+    if (!kept)
+    {
+        free_chain(batch);
+    }
+}
+
+// Returns a finished thread's cache: full batches to the depot, the rest to free
+static void flush_thread_cache(void *unused)
+{
+    (void)unused;
+    for (int class = 0; class < POOL_CLASSES; class++)
+    {
+        pool_cache_t *cache = &thread_cache[class];
+        while (cache->count >= POOL_BATCH)
+        {
+            spill_batch(cache, class);
+        }
+        free_chain(cache->head);
+        cache->head = NULL;
+        cache->count = 0;
+    }
+}
+
+static void create_cache_key(void)
+{
+    pthread_key_create(&cache_key, flush_thread_cache);
+}
+
+// Makes sure the calling thread's cache is flushed when it exits
+static void register_thread_cache(void)
+{
+    pthread_once(&cache_key_once, create_cache_key);
+    pthread_setspecific(cache_key, thread_cache);
+    thread_cache_registered = 1;
+}
+
+char *message_buffer_alloc(size_t size, size_t *cap)
+{
+    int class = class_for_size(size);
+    if (class < 0)
+    {
+        *cap = size;
+        return malloc(size);
+    }
+
+    pool_cache_t *cache = &thread_cache[class];
+    if (cache->head == NULL)
+    {
+        if (!thread_cache_registered)
+        {
+            register_thread_cache();
+        }
+        // Our node's buffers first; a remote one still beats malloc
+        int node = depot_node();
+        pool_block_t *batch = NULL;
+        pthread_mutex_lock(&depot_lock);
+        for (int i = 0; i < POOL_NODES && batch == NULL; i++)
+        {
+            int from = (node + i) % POOL_NODES;
+            batch = depot[from][class];
+            if (batch)
+            {
+                depot[from][class] = batch->next_batch;
+                depot_batches[from][class]--;
+            }
+        }
+        pthread_mutex_unlock(&depot_lock);
+
+        if (batch == NULL)
+        {
+            atomic_fetch_add_explicit(&pool_mallocs, 1, memory_order_relaxed);
+            *cap = (size_t)1 << (class + POOL_MIN_SHIFT);
+            return malloc(*cap);
+        }
+        cache->head = batch;
+        cache->count = POOL_BATCH;
+    }
+
+    pool_block_t *block = cache->head;
+    cache->head = block->next;
+    cache->count--;
+    *cap = (size_t)1 << (class + POOL_MIN_SHIFT);
+    return (char *)block;
+}
+
+void message_buffer_free(char *data, size_t cap)
+{
+    if (data == NULL)
+    {
+        return;
+    }
+    int class = class_for_cap(cap);
+    if (class < 0)
+    {
+        free(data);
+        return;
+    }
+    if (!thread_cache_registered)
+    {
+        register_thread_cache();
+    }
+
+    pool_cache_t *cache = &thread_cache[class];
+    pool_block_t *block = (pool_block_t *)data;
+    block->next = cache->head;
+    cache->head = block;
+    if (++cache->count >= POOL_CACHE_MAX)
+    {
+        spill_batch(cache, class);
+    }
+}
+
+void message_pool_stats(message_pool_stats_t *stats)
+{
+    stats->mallocs = atomic_load_explicit(&pool_mallocs, memory_order_relaxed);
+    stats->frees = atomic_load_explicit(&pool_frees, memory_order_relaxed);
+}
+
+int message_copy(message_t *message, const char *str, size_t len)
+{
+    message->data = message_buffer_alloc(len + 1, &message->cap);
+    if (message->data == NULL)
+    {
+        return -1;
+    }
+    memcpy(message->data, str, len + 1);
+    message->len = len;
+    message->flags = 0;
+    return 0;
+}
+
+void message_adopt(message_t *message, char *str)
+{
+    message->data = str;
+    message->len = strlen(str);
+    message->cap = message->len + 1;
+    message->flags = 0;
+}
+
+int message_control(message_t *message, unsigned int flags)
+{
+    const char *marker = flags == MESSAGE_END ? "<END>" : flags == MESSAGE_FLUSH ? "<FLUSH>" : "<BARRIER>";
+    if (message_copy(message, marker, strlen(marker)) != 0)
+    {
+        return -1;
+    }
+    message->flags = flags;
+    return 0;
+}
+
+int message_end(message_t *message)
+{
+    return message_control(message, MESSAGE_END);
+}
+
+void message_replace_buffer(message_t *message, char *data, size_t len, size_t cap)
+{
+    if (message->data != data)
+    {
+        message_buffer_free(message->data, message->cap);
+        message->data = data;
+        message->cap = cap;
+    }
+    message->len = len;
+}
+
+void message_replace(message_t *message, char *data, size_t len)
+{
+    message_replace_buffer(message, data, len, message->data != data ? len + 1 : message->cap);
+}
+
+void message_release(message_t *message)
+{
+    message_buffer_free(message->data, message->cap);
+    message->data = NULL;
+    message->len = 0;
+    message->cap = 0;
+    message->flags = 0;
+}
@@ -0,0 +1,126 @@
+#ifndef MESSAGE_H_
+#define MESSAGE_H_
+#include <stddef.h>
+
+/* Control messages travel in the queue like data but are told apart by
+ * their flags, never by their text */
+#define MESSAGE_END 0x1u     /* End of stream, nothing follows this message */
+#define MESSAGE_FLUSH 0x2u   /* Hand on whatever is held back, now */
+#define MESSAGE_BARRIER 0x4u /* Point at which every stage snapshots its counters */
+#define MESSAGE_CONTROL (MESSAGE_END | MESSAGE_FLUSH | MESSAGE_BARRIER)
+
+/**
+ * A string that travels with its length, so no stage has to scan it to
+ * find out. data is heap allocated and NUL terminated at data[len]; whoever
+ * holds the message owns data.
+ */
+typedef struct
+{
+    char *data;         /* NUL terminated string */
+    size_t len;         /* strlen(data) */
+    size_t cap;         /* Bytes allocated for data, at least len + 1 */
+    unsigned int flags; /* MESSAGE_* */
+} message_t;
+
+/*
+ * Message pool. Message data comes from size classes of 16 to 4096 bytes,
+ * each thread keeping a cache of free buffers per class. A thread that
+ * frees more than it allocates (the end of a pipeline) hands its surplus to
+ * a shared depot in batches, where the threads that allocate (its start)
+ * pick them up, so a running pipeline stops calling malloc. There is a
+ * depot per NUMA node; a thread takes from its own node's first. Pool buffers
+ * are plain malloc blocks: code that only knows strings may free() them,
+ * and any malloc'd buffer may be handed to the pool.
+ *
+ * A host that exports these symbols (analyzer links with -rdynamic) makes
+ * every plugin it loads share its pool; otherwise each .so has its own.
+ */
+
+/**
+ * Counters of the pool's slow paths, summed over all threads
+ */
+typedef struct
+{
+    unsigned long mallocs; /* Buffers the pool had to malloc */
+    unsigned long frees;   /* Buffers it gave back to free */
+} message_pool_stats_t;
+
+/**
+ * Get a buffer from the pool
+ * @param size Bytes needed
+ * @param cap Set to the bytes the buffer holds, at least size
+ * @return The buffer, NULL if out of memory
+ */
+char *message_buffer_alloc(size_t size, size_t *cap);
+
+/**
+ * Give a buffer back to the pool
+ * @param data Buffer from message_buffer_alloc or malloc, may be NULL
+ * @param cap Bytes it holds (fewer is fine)
+ */
+void message_buffer_free(char *data, size_t cap);
+
+/**
+ * Read the pool's counters
+ * @param stats Filled in
+ */
+void message_pool_stats(message_pool_stats_t *stats);
+
+/**
+ * Build a message from a copy of a string
+ * @param message Message to fill
+ * @param str String to copy
+ * @param len strlen(str)
+ * @return 0 on success, -1 if out of memory
+ */
+int message_copy(message_t *message, const char *str, size_t len);
+
+/**
+ * Build a message around a heap string, which the message then owns
+ * @param message Message to fill
+ * @param str malloc'd string
+ */
+void message_adopt(message_t *message, char *str);
+
+/**
+ * Build a control message. Its data is the marker text ("<END>",
+ * "<FLUSH>" or "<BARRIER>") so string consumers of a queue still see it.
+ * @param message Message to fill
+ * @param flags One of MESSAGE_END, MESSAGE_FLUSH and MESSAGE_BARRIER
+ * @return 0 on success, -1 if out of memory
+ */
+int message_control(message_t *message, unsigned int flags);
+
+/**
+ * Build the end of stream message, message_control(message, MESSAGE_END)
+ * @param message Message to fill
+ * @return 0 on success, -1 if out of memory
+ */
+int message_end(message_t *message);
+
+/**
+ * Replace a message's data with a heap string of known length, freeing the
+ * old data unless it is the same buffer (rewritten in place)
+ * @param message Message to update
+ * @param data malloc'd string, now owned by the message
+ * @param len strlen(data)
+ */
+void message_replace(message_t *message, char *data, size_t len);
+
+/**
+ * message_replace for a buffer whose size is known, e.g. one from
+ * message_buffer_alloc, so that all of it goes back to the pool
+ * @param message Message to update
+ * @param data Buffer holding the new string, now owned by the message
+ * @param len strlen(data)
+ * @param cap Bytes data holds
+ */
+void message_replace_buffer(message_t *message, char *data, size_t len, size_t cap);
+
+/**
+ * Give a message's data back to the pool and clear it
+ * @param message Message to release
+ */
+void message_release(message_t *message);
+
+#endif
@@ -1,4 +1,5 @@
 #include "monitor.h"
+#include <errno.h>
 
 int monitor_init(monitor_t *monitor)
 {
@@ -12,11 +13,22 @@ int monitor_init(monitor_t *monitor)
         return -1;
     }
 
-    if (pthread_cond_init(&(monitor->condition), NULL) != 0)
+    // Timed waits take CLOCK_MONOTONIC deadlines so wall clock changes can't affect them
+    pthread_condattr_t attributes;
+    if (pthread_condattr_init(&attributes) != 0)
     {
         pthread_mutex_destroy(&(monitor->mutex));
         return -1;
     }
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+
+    if (pthread_cond_init(&(monitor->condition), &attributes) != 0)
+    {
+        pthread_condattr_destroy(&attributes);
+        pthread_mutex_destroy(&(monitor->mutex));
+        return -1;
+    }
+    pthread_condattr_destroy(&attributes);
 
     monitor->signaled = 0;
     return 0;
@@ -82,4 +94,44 @@ int monitor_wait(monitor_t *monitor)
     }
 
     return 0;
+}
+
+int monitor_wait_timed(monitor_t *monitor, const struct timespec *deadline)
+{
+    if (deadline == NULL)
+    {
+        return monitor_wait(monitor);
+    }
+
+    if (monitor == NULL)
+    {
+        return -1;
+    }
+
+    if (pthread_mutex_lock(&(monitor->mutex)) != 0)
+    {
+        return -1;
+    }
+
+    int result = 0;
+    while (monitor->signaled == 0)
+    {
+        int error = pthread_cond_timedwait(&(monitor->condition), &(monitor->mutex), deadline);
+        if (error == ETIMEDOUT)
+        {
+            result = monitor->signaled ? 0 : 1;
+            break;
+        }
+        if (error != 0)
+        {
+            result = -1;
+            break;
+        }
+    }
+    if (pthread_mutex_unlock(&(monitor->mutex)) != 0)
+    {
+        return -1;
+    }
+
+    return result;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef MONITOR_H_
 #define MONITOR_H_
 #include <pthread.h>
+#include <time.h>
 
 /**
  * Monitor structure that can remember its state
@@ -46,4 +47,12 @@ void monitor_reset(monitor_t *monitor);
  */
 int monitor_wait(monitor_t *monitor);
 
+/**
+ * Wait for a monitor to be signaled, giving up at a deadline
+ * @param monitor Pointer to monitor structure
+ * @param deadline Absolute CLOCK_MONOTONIC time, NULL waits forever
+ * @return 0 when signaled, 1 on timeout, -1 on error
+ */
+int monitor_wait_timed(monitor_t *monitor, const struct timespec *deadline);
+
 #endif
\ No newline at end of file
@@ -663,6 +663,63 @@ static int test_memory_management(void)
     return 1;
 }
 
+/* Thread that signals the monitor after a short delay */
+static void *delayed_signal_thread(void *arg)
+{
+    monitor_t *monitor = (monitor_t *)arg;
+    usleep(50000);
+    monitor_signal(monitor);
+    return NULL;
+}
+
+/* Test 12: Timed wait */
+static int test_timed_wait(void)
+{
+    printf("\nTest 12: Timed wait\n");
+
+    monitor_t monitor;
+    monitor_init(&monitor);
+
+    struct timespec start, end, deadline;
+
+    printf("    12.1: Deadline passes without a signal...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    deadline = start;
+    deadline.tv_nsec += 100000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    int result = monitor_wait_timed(&monitor, &deadline);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    TEST_ASSERT_EQUAL(result, 1, "Wait should time out when not signaled");
+    TEST_ASSERT(get_elapsed_ms(&start, &end) >= 90, "Wait should last until the deadline");
+
+    printf("    12.2: Signal arrives before the deadline...\n");
+    pthread_t signaler;
+    pthread_create(&signaler, NULL, delayed_signal_thread, &monitor);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    deadline = start;
+    deadline.tv_sec += TIMEOUT_SEC;
+    result = monitor_wait_timed(&monitor, &deadline);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_join(signaler, NULL);
+    TEST_ASSERT_EQUAL(result, 0, "Wait should succeed when signaled");
+    TEST_ASSERT(get_elapsed_ms(&start, &end) < TIMEOUT_SEC * 1000, "Wait should return before the deadline");
+
+    printf("    12.3: Already signaled and NULL handling...\n");
+    TEST_ASSERT_EQUAL(monitor_wait_timed(&monitor, &deadline), 0, "Signaled monitor should not wait");
+    TEST_ASSERT_EQUAL(monitor_wait_timed(NULL, &deadline), -1, "NULL monitor should fail");
+
+    monitor_destroy(&monitor);
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
 /* Main test runner */
 int main(int argc, char *argv[])
 {
@@ -685,6 +742,7 @@ int main(int argc, char *argv[])
     // test_stress();
     test_reset_with_waiters();
     test_memory_management();
+    test_timed_wait();
 
     /* Print summary */
     printf("\n========================================\n");
@@ -0,0 +1,356 @@
+#include "scheduler.h"
+#include "eventcount.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#define SCHEDULER_MAX_THREADS 256 // Worker threads, spares included
+
+// States of a task
+enum
+{
+    TASK_IDLE = 0,
+    TASK_QUEUED,  // In a deque
+    TASK_RUNNING, // On a worker
+    TASK_WOKEN    // Running, and woken since it started
+};
+
+// A worker thread and its deque of woken tasks. The owner works at the
+// bottom, thieves take from the top
+typedef struct
+{
+    pthread_mutex_t lock;
+    scheduler_task_t *top;
+    scheduler_task_t *bottom;
+    pthread_t thread;
+} scheduler_worker_t;
+
+static scheduler_worker_t workers[SCHEDULER_MAX_THREADS];
+static atomic_int thread_count;                                  // Entries of workers in use
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER; // Serializes starting workers
+static int target;                                               // Workers that may run tasks at once
+static atomic_int active;                                        // Workers running tasks, not blocked
+static atomic_int queued;                                        // Tasks in all deques
+static atomic_int running;
+static atomic_int stopping;
+static eventcount_t idle_event; // Idle workers wait here for a task and a free slot
+static atomic_uint next_deque;  // Deque a task woken outside the pool goes to
+static atomic_ulong runs;
+static atomic_ulong steals;
+
+// The worker the calling thread is, NULL outside the pool
+static __thread scheduler_worker_t *current_worker;
+
+// Adds a task at the bottom of a deque, where its owner takes it next, or at the top, behind everything else
+static void push(scheduler_worker_t *worker, scheduler_task_t *task, int at_bottom)
+{
+    pthread_mutex_lock(&worker->lock);
+    if (at_bottom)
+    {
+        task->prev = worker->bottom;
+        task->next = NULL;
+        if (worker->bottom)
+        {
+            worker->bottom->next = task;
+        }
+        else
+        {
+            worker->top = task;
+        }
+        worker->bottom = task;
+    }
+    else
+    {
+        task->prev = NULL;
+        task->next = worker->top;
+        if (worker->top)
+        {
+            worker->top->prev = task;
+        }
+        else
+        {
+            worker->bottom = task;
+        }
+        worker->top = task;
+    }
+    atomic_fetch_add(&queued, 1);
+    pthread_mutex_unlock(&worker->lock);
+    eventcount_notify(&idle_event);
+}
+
+// Takes the task at the bottom or the top of a deque, NULL if it is empty
+static scheduler_task_t *take(scheduler_worker_t *worker, int from_bottom)
+{
+    pthread_mutex_lock(&worker->lock);
+    scheduler_task_t *task = from_bottom ? worker->bottom : worker->top;
+    if (task)
+    {
+        if (task->prev)
+        {
+            task->prev->next = task->next;
+        }
+        else
+        {
+            worker->top = task->next;
+        }
+        if (task->next)
+        {
+            task->next->prev = task->prev;
+        }
+        else
+        {
+            worker->bottom = task->prev;
+        }
+        atomic_fetch_sub(&queued, 1);
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return task;
+}
+
+// The task woken last on our own deque, else the oldest of another worker's
+static scheduler_task_t *find_task(scheduler_worker_t *self)
+{
+    scheduler_task_t *task = take(self, 1);
+    if (task || atomic_load(&queued) == 0)
+    {
+        return task;
+    }
+    int count = atomic_load(&thread_count);
+    int start = (int)(self - workers);
+    for (int i = 1; i < count; i++)
+    {
+        task = take(&workers[(start + i) % count], 0);
+        if (task)
+        {
+            atomic_fetch_add_explicit(&steals, 1, memory_order_relaxed);
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static void run_task(scheduler_worker_t *self, scheduler_task_t *task)
+{
+    atomic_store(&task->state, TASK_RUNNING);
+    int again = task->run(task);
+    atomic_fetch_add_explicit(&runs, 1, memory_order_relaxed);
+
+    int state = TASK_RUNNING;
+    if (!again && atomic_compare_exchange_strong(&task->state, &state, TASK_IDLE))
+    {
+        return;
+    }
+    // Woken while it ran, or it has work left: it goes behind the tasks already queued here
+    atomic_store(&task->state, TASK_QUEUED);
+    push(self, task, 0);
+}
+
+// Takes a slot to run tasks in, if fewer than target workers hold one
+static int claim_slot(void)
+{
+    int current = atomic_load(&active);
+    while (current < target)
+    {
+        if (atomic_compare_exchange_weak(&active, &current, current + 1))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *worker_main(void *arg)
+{
+    scheduler_worker_t *self = arg;
+    current_worker = self;
+
+    while (!atomic_load(&stopping))
+    {
+        if (claim_slot())
+        {
+            // Keep the slot while there is work, unless workers that blocked came back meanwhile
+            scheduler_task_t *task;
+            while (atomic_load(&active) <= target && (task = find_task(self)) != NULL)
+            {
+                run_task(self, task);
+            }
+            atomic_fetch_sub(&active, 1);
+        }
+
+        unsigned int key = eventcount_prepare_wait(&idle_event);
+        if (atomic_load(&stopping) || (atomic_load(&queued) > 0 && atomic_load(&active) < target))
+        {
+            eventcount_cancel_wait(&idle_event);
+            continue;
+        }
+        eventcount_wait(&idle_event, key);
+    }
+    current_worker = NULL;
+    return NULL;
+}
+
+// Starts one more worker thread, returns -1 if it can't
+static int start_worker(void)
+{
+    int result = -1;
+    pthread_mutex_lock(&threads_lock);
+    int index = atomic_load(&thread_count);
+    if (index < SCHEDULER_MAX_THREADS)
+    {
+        scheduler_worker_t *worker = &workers[index];
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->top = NULL;
+        worker->bottom = NULL;
+        if (pthread_create(&worker->thread, NULL, worker_main, worker) == 0)
+        {
+            atomic_store(&thread_count, index + 1);
+            result = 0;
+        }
+        else
+        {
+            pthread_mutex_destroy(&worker->lock);
+        }
+    }
+    pthread_mutex_unlock(&threads_lock);
+    return result;
+}
+
+int scheduler_start(int count)
+{
+    if (atomic_load(&running))
+    {
+        return -1;
+    }
+    if (count <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        count = cpus > 0 ? (int)cpus : 1;
+    }
+    target = count < SCHEDULER_MAX_THREADS ? count : SCHEDULER_MAX_THREADS;
+    atomic_store(&active, 0);
+    atomic_store(&queued, 0);
+    atomic_store(&stopping, 0);
+    atomic_store(&runs, 0);
+    atomic_store(&steals, 0);
+    eventcount_init(&idle_event);
+
+    atomic_store(&running, 1);
+    for (int i = 0; i < target; i++)
+    {
+        if (start_worker() != 0)
+        {
+            scheduler_stop();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void scheduler_stop(void)
+{
+    if (!atomic_load(&running))
+    {
+        return;
+    }
+    atomic_store(&stopping, 1);
+    eventcount_notify_all(&idle_event);
+
+    int count = atomic_load(&thread_count);
+    for (int i = 0; i < count; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        pthread_mutex_destroy(&workers[i].lock);
+    }
+    atomic_store(&thread_count, 0);
+    eventcount_destroy(&idle_event);
+    atomic_store(&running, 0);
+}
+
+int scheduler_running(void)
+{
+    return atomic_load(&running);
+}
+
+void scheduler_task_init(scheduler_task_t *task, int (*run)(scheduler_task_t *task))
+{
+    task->run = run;
+    atomic_init(&task->state, TASK_IDLE);
+    task->prev = NULL;
+    task->next = NULL;
+}
+
+void scheduler_wake(scheduler_task_t *task)
+{
+    int state = atomic_load(&task->state);
+    for (;;)
+    {
+        if (state == TASK_QUEUED || state == TASK_WOKEN)
+        {
+            return; // It runs again anyway
+        }
+        int next = state == TASK_IDLE ? TASK_QUEUED : TASK_WOKEN;
+        if (atomic_compare_exchange_weak(&task->state, &state, next))
+        {
+            if (next == TASK_WOKEN)
+            {
+                return; // The worker running it queues it again when it returns
+            }
+            break;
+        }
+    }
+
+    scheduler_worker_t *worker = current_worker;
+    if (worker == NULL)
+    {
+        worker = &workers[atomic_fetch_add(&next_deque, 1) % (unsigned int)atomic_load(&thread_count)];
+    }
+    push(worker, task, 1);
+}
+
+void scheduler_task_quiesce(scheduler_task_t *task)
+{
+    while (atomic_load(&task->state) != TASK_IDLE)
+    {
+        sched_yield();
+    }
+}
+
+void scheduler_block_begin(void)
+{
+    if (current_worker == NULL)
+    {
+        return;
+    }
+    atomic_fetch_sub(&active, 1);
+    if (atomic_load(&queued) == 0)
+    {
+        return; // Whatever we wait for is running elsewhere, and will wake us
+    }
+    // Hand our slot to an idle worker, or a spare one if nobody idles
+    if (atomic_load(&idle_event.waiters) > 0)
+    {
+        eventcount_notify(&idle_event);
+    }
+    else
+    {
+        start_worker();
+    }
+}
+
+void scheduler_block_end(void)
+{
+    if (current_worker != NULL)
+    {
+        atomic_fetch_add(&active, 1);
+    }
+}
+
+void scheduler_stats(scheduler_stats_t *stats)
+{
+    stats->workers = target;
+    stats->threads = atomic_load(&thread_count);
+    stats->runs = atomic_load_explicit(&runs, memory_order_relaxed);
+    stats->steals = atomic_load_explicit(&steals, memory_order_relaxed);
+}
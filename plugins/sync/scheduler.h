@@ -0,0 +1,103 @@
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+#include <stdatomic.h>
+
+/*
+ * Work-stealing task scheduler. A fixed set of worker threads, one per CPU
+ * by default, runs tasks that are woken when they have work: a pipeline
+ * stage becomes a task woken by every put into its input queue, instead of
+ * a thread that sleeps on it. Each worker keeps a deque of woken tasks; it
+ * runs the one woken last (usually the stage its own output just went to)
+ * and an idle worker steals the oldest task of another.
+ *
+ * A task must not sleep, with one exception: a queue put that has to wait
+ * for room calls scheduler_block_begin()/scheduler_block_end() around its
+ * wait (the queue takes them as weak symbols, so it doesn't need the
+ * scheduler linked in), and the scheduler hands the worker's CPU to another worker
+ * meanwhile, starting a spare thread if none is idle. The consumer that
+ * frees the room is then never starved of a worker.
+ *
+ * A host that exports these symbols (analyzer links with -rdynamic) makes
+ * every plugin it loads share its scheduler; otherwise each .so has its own,
+ * which never runs.
+ */
+
+/**
+ * A unit of work. Embed it in the object it works on.
+ */
+typedef struct scheduler_task
+{
+    int (*run)(struct scheduler_task *task); /* Does a share of the work, returns 1 if some is left */
+    atomic_int state;                        /* Idle, queued, running, or woken while running */
+    struct scheduler_task *prev;             /* Links in the deque that holds it, while queued */
+    struct scheduler_task *next;
+} scheduler_task_t;
+
+/**
+ * Counters of the scheduler, see scheduler_stats
+ */
+typedef struct
+{
+    int workers;          /* Workers that may run tasks at once */
+    int threads;          /* Worker threads started, spares included */
+    unsigned long runs;   /* Task runs */
+    unsigned long steals; /* Tasks a worker took from another's deque */
+} scheduler_stats_t;
+
+/**
+ * Start the worker threads
+ * @param workers Tasks that may run at once, 0 for one per online CPU
+ * @return 0 on success, -1 on failure or if already started
+ */
+int scheduler_start(int workers);
+
+/**
+ * Stop and join the worker threads. Every task must be idle by now.
+ */
+void scheduler_stop(void);
+
+/**
+ * @return 1 between scheduler_start and scheduler_stop, 0 otherwise
+ */
+int scheduler_running(void);
+
+/**
+ * Prepare a task, idle until woken
+ * @param task Task to prepare
+ * @param run Called on a worker each time the task is scheduled
+ */
+void scheduler_task_init(scheduler_task_t *task, int (*run)(scheduler_task_t *task));
+
+/**
+ * Schedule a task to run. A task woken while it runs runs again afterwards,
+ * so work published before the wake is always seen. Never blocks.
+ * @param task Task to wake
+ */
+void scheduler_wake(scheduler_task_t *task);
+
+/**
+ * Wait until a task is neither queued nor running, e.g. before freeing it.
+ * Nothing may wake it any more.
+ * @param task Task to wait for
+ */
+void scheduler_task_quiesce(scheduler_task_t *task);
+
+/**
+ * Tell the scheduler the calling thread is about to sleep. A no-op outside
+ * a worker thread.
+ */
+void scheduler_block_begin(void);
+
+/**
+ * Tell the scheduler the calling thread woke up again, after
+ * scheduler_block_begin
+ */
+void scheduler_block_end(void);
+
+/**
+ * Read the scheduler's counters
+ * @param stats Filled in
+ */
+void scheduler_stats(scheduler_stats_t *stats);
+
+#endif
@@ -0,0 +1,289 @@
+/**
+ * scheduler_test.c
+ * Test suite for the work-stealing task scheduler
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include "scheduler.h"
+#include "consumer_producer.h"
+
+#define MANY_TASKS 1000
+#define CHAIN_ITEMS 100
+
+/* Test result tracking */
+typedef struct
+{
+    int passed;
+    int failed;
+    int total;
+} test_results_t;
+
+static test_results_t results = {0, 0, 0};
+
+/* Helper macros for test assertions */
+#define TEST_ASSERT(condition, message)          \
+    do                                           \
+    {                                            \
+        if (!(condition))                        \
+        {                                        \
+            printf("    FAILED: %s\n", message); \
+            results.failed++;                    \
+            results.total++;                     \
+            return 0;                            \
+        }                                        \
+    } while (0)
+
+#define TEST_ASSERT_EQUAL(a, b, message) TEST_ASSERT((a) == (b), message)
+
+/* A task that counts its runs and asks to run again while left > 0 */
+typedef struct
+{
+    scheduler_task_t task; /* First, so the task pointer is the counter's */
+    atomic_int runs;
+    atomic_int left;
+    int wake_self;
+} counter_task_t;
+
+static int counter_run(scheduler_task_t *task)
+{
+    counter_task_t *counter = (counter_task_t *)task;
+    atomic_fetch_add(&counter->runs, 1);
+    if (counter->wake_self)
+    {
+        counter->wake_self = 0;
+        scheduler_wake(task); /* Woken while running: must run once more */
+        return 0;
+    }
+    return atomic_fetch_sub(&counter->left, 1) > 1;
+}
+
+static void counter_init(counter_task_t *counter, int left)
+{
+    scheduler_task_init(&counter->task, counter_run);
+    atomic_init(&counter->runs, 0);
+    atomic_init(&counter->left, left);
+    counter->wake_self = 0;
+}
+
+/* Test 1: Start, stop and the counters */
+static int test_start_stop(void)
+{
+    printf("\nTest 1: Start, stop and the counters\n");
+
+    TEST_ASSERT_EQUAL(scheduler_running(), 0, "Not running before start");
+    TEST_ASSERT_EQUAL(scheduler_start(2), 0, "Start should succeed");
+    TEST_ASSERT_EQUAL(scheduler_running(), 1, "Running after start");
+    TEST_ASSERT_EQUAL(scheduler_start(2), -1, "Second start should fail");
+
+    scheduler_stats_t stats;
+    scheduler_stats(&stats);
+    TEST_ASSERT_EQUAL(stats.workers, 2, "Two workers");
+    TEST_ASSERT_EQUAL(stats.threads, 2, "Two threads");
+
+    scheduler_stop();
+    TEST_ASSERT_EQUAL(scheduler_running(), 0, "Not running after stop");
+    scheduler_stop(); /* Must not crash */
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 2: A wake runs the task, wakes while it is queued coalesce */
+static int test_wake_runs_task(void)
+{
+    printf("\nTest 2: Wake runs the task, queued wakes coalesce\n");
+
+    counter_task_t counter;
+    counter_init(&counter, 1);
+    scheduler_start(1);
+
+    scheduler_wake(&counter.task);
+    scheduler_task_quiesce(&counter.task);
+    TEST_ASSERT_EQUAL(atomic_load(&counter.runs), 1, "One wake, one run");
+
+    for (int i = 0; i < 100; i++)
+    {
+        scheduler_wake(&counter.task);
+    }
+    scheduler_task_quiesce(&counter.task);
+    int runs = atomic_load(&counter.runs);
+    TEST_ASSERT(runs >= 2 && runs <= 101, "Wakes run the task at most once each");
+
+    scheduler_stop();
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 3: A task with work left, or woken while it ran, runs again */
+static int test_run_again(void)
+{
+    printf("\nTest 3: A task with work left or woken while running runs again\n");
+
+    counter_task_t counter;
+    counter_init(&counter, 5);
+    scheduler_start(1);
+
+    scheduler_wake(&counter.task);
+    scheduler_task_quiesce(&counter.task);
+    TEST_ASSERT_EQUAL(atomic_load(&counter.runs), 5, "Runs until nothing is left");
+
+    counter_init(&counter, 1);
+    counter.wake_self = 1;
+    scheduler_wake(&counter.task);
+    scheduler_task_quiesce(&counter.task);
+    TEST_ASSERT_EQUAL(atomic_load(&counter.runs), 2, "A wake during the run adds a run");
+
+    scheduler_stop();
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 4: Many tasks on several workers all run exactly once */
+static int test_many_tasks(void)
+{
+    printf("\nTest 4: %d tasks on 4 workers run exactly once each\n", MANY_TASKS);
+
+    counter_task_t *counters = calloc(MANY_TASKS, sizeof(counter_task_t));
+    TEST_ASSERT(counters != NULL, "Allocation should succeed");
+    scheduler_start(4);
+
+    for (int i = 0; i < MANY_TASKS; i++)
+    {
+        counter_init(&counters[i], 1);
+        scheduler_wake(&counters[i].task);
+    }
+    int total = 0;
+    for (int i = 0; i < MANY_TASKS; i++)
+    {
+        scheduler_task_quiesce(&counters[i].task);
+        total += atomic_load(&counters[i].runs);
+    }
+    scheduler_stop();
+    free(counters);
+    TEST_ASSERT_EQUAL(total, MANY_TASKS, "Every task ran once");
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* A producer task that puts more than the queue holds, and the consumer task of that queue */
+typedef struct
+{
+    scheduler_task_t producer;
+    scheduler_task_t consumer;
+    consumer_producer_t queue;
+    atomic_int received;
+} chain_t;
+
+static int producer_run(scheduler_task_t *task)
+{
+    chain_t *chain = (chain_t *)((char *)task - offsetof(chain_t, producer));
+    for (int i = 0; i < CHAIN_ITEMS; i++)
+    {
+        consumer_producer_put(&chain->queue, "item"); /* Blocks while the queue is full */
+        scheduler_wake(&chain->consumer);
+    }
+    return 0;
+}
+
+static int consumer_run(scheduler_task_t *task)
+{
+    chain_t *chain = (chain_t *)((char *)task - offsetof(chain_t, consumer));
+    message_t messages[8];
+    int count;
+    while ((count = consumer_producer_try_get_messages(&chain->queue, messages, 8)) > 0)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            message_release(&messages[i]);
+        }
+        atomic_fetch_add(&chain->received, count);
+    }
+    return 0;
+}
+
+/* Test 5: A task blocked on a full queue hands its worker over to the consumer */
+static int test_blocking_put(void)
+{
+    printf("\nTest 5: A put blocked on a full queue doesn't starve its consumer\n");
+
+    chain_t chain;
+    TEST_ASSERT(consumer_producer_init_mode(&chain.queue, 2, CONSUMER_PRODUCER_SPSC) == NULL, "Queue init");
+    scheduler_task_init(&chain.producer, producer_run);
+    scheduler_task_init(&chain.consumer, consumer_run);
+    atomic_init(&chain.received, 0);
+    scheduler_start(1);
+
+    scheduler_wake(&chain.producer);
+    scheduler_task_quiesce(&chain.producer);
+    while (atomic_load(&chain.received) < CHAIN_ITEMS)
+    {
+        scheduler_wake(&chain.consumer);
+        scheduler_task_quiesce(&chain.consumer);
+    }
+
+    scheduler_stats_t stats;
+    scheduler_stats(&stats);
+    scheduler_stop();
+    consumer_producer_destroy(&chain.queue);
+
+    TEST_ASSERT_EQUAL(atomic_load(&chain.received), CHAIN_ITEMS, "Every item arrived");
+    TEST_ASSERT(stats.threads >= 2, "A spare worker took over while the producer waited");
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Main test runner */
+int main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    printf("========================================\n");
+    printf("Scheduler Test Suite\n");
+    printf("========================================\n");
+
+    test_start_stop();
+    test_wake_runs_task();
+    test_run_again();
+    test_many_tasks();
+    test_blocking_put();
+
+    /* Print summary */
+    printf("\n========================================\n");
+    printf("Test Results Summary:\n");
+    printf("Total:  %d\n", results.total);
+    printf("Passed: %d\n", results.passed);
+    printf("Failed: %d\n", results.failed);
+
+    if (results.failed == 0)
+    {
+        printf("\nAll tests PASSED! ✓\n");
+    }
+    else
+    {
+        printf("\nSome tests FAILED! ✗\n");
+    }
+    printf("========================================\n");
+
+    return results.failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,253 @@
+#include "timer_wheel.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t cond_once = PTHREAD_ONCE_INIT;
+static pthread_cond_t changed;                            // The thread waits here, on CLOCK_MONOTONIC
+static pthread_cond_t fired = PTHREAD_COND_INITIALIZER;   // Broadcast after every fire
+static timer_wheel_timer_t *buckets[TIMER_WHEEL_SLOTS];
+static unsigned long occupied[TIMER_WHEEL_SLOTS / 64];    // A bit per bucket that holds a timer
+static unsigned long next_tick;                           // First tick whose bucket wasn't retired yet
+static unsigned long wake_ns;                             // When the thread wakes, 0 while it is awake
+static timer_wheel_timer_t *firing;                       // Timer whose fire runs right now
+static int armed_count;
+static int started;
+static int stopping;
+static pthread_t thread;
+
+unsigned long timer_wheel_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)now.tv_sec * 1000000000UL + (unsigned long)now.tv_nsec;
+}
+
+static void init_cond(void)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&changed, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static void unlink_timer(timer_wheel_timer_t *timer)
+{
+    if (timer->prev)
+    {
+        timer->prev->next = timer->next;
+    }
+    else
+    {
+        buckets[timer->slot] = timer->next;
+    }
+    if (timer->next)
+    {
+        timer->next->prev = timer->prev;
+    }
+    if (!buckets[timer->slot])
+    {
+        occupied[timer->slot / 64] &= ~(1UL << (timer->slot % 64));
+    }
+    timer->armed = 0;
+    armed_count--;
+}
+
+static void link_timer(timer_wheel_timer_t *timer, unsigned int slot)
+{
+    timer->slot = slot;
+    timer->prev = NULL;
+    timer->next = buckets[slot];
+    if (timer->next)
+    {
+        timer->next->prev = timer;
+    }
+    buckets[slot] = timer;
+    occupied[slot / 64] |= 1UL << (slot % 64);
+    timer->armed = 1;
+    armed_count++;
+}
+
+// Fires the timers of a bucket that are due by now, with the lock dropped around each fire
+static void fire_due(unsigned int slot, unsigned long now)
+{
+    timer_wheel_timer_t *timer = buckets[slot];
+    while (timer)
+    {
+        if (timer->due_ns > now)
+        {
+            timer = timer->next; // Due in a later turn of the wheel
+            continue;
+        }
+        unlink_timer(timer);
+        firing = timer;
+        pthread_mutex_unlock(&lock);
+        timer->fire(timer);
+        pthread_mutex_lock(&lock);
+        firing = NULL;
+        pthread_cond_broadcast(&fired);
+        timer = buckets[slot]; // The bucket may have changed meanwhile
+    }
+}
+
+// Time the thread has to wake: the earliest timer due in the first occupied
+// bucket that holds one for this turn of the wheel. The buckets before it are
+// empty, and the ones after it are due later. ULONG_MAX if none is armed.
+static unsigned long next_wake(void)
+{
+    if (armed_count == 0)
+    {
+        return ULONG_MAX;
+    }
+    unsigned long tick = next_tick;
+    while (tick < next_tick + TIMER_WHEEL_SLOTS)
+    {
+        unsigned int slot = (unsigned int)(tick % TIMER_WHEEL_SLOTS);
+        unsigned long bits = occupied[slot / 64] >> (slot % 64);
+        if (bits == 0)
+        {
+            tick += 64 - slot % 64; // Nothing in the rest of this word
+            continue;
+        }
+        tick += (unsigned long)__builtin_ctzl(bits);
+        if (tick >= next_tick + TIMER_WHEEL_SLOTS)
+        {
+            break;
+        }
+        // Timers of later turns share the bucket, they are due a turn or more after its end
+        unsigned long end = (tick + 1) * TIMER_WHEEL_TICK_NS;
+        unsigned long earliest = ULONG_MAX;
+        for (timer_wheel_timer_t *timer = buckets[tick % TIMER_WHEEL_SLOTS]; timer; timer = timer->next)
+        {
+            if (timer->due_ns < end && timer->due_ns < earliest)
+            {
+                earliest = timer->due_ns;
+            }
+        }
+        if (earliest != ULONG_MAX)
+        {
+            return earliest;
+        }
+        tick++;
+    }
+    // Only timers of later turns: look again once the wheel went round
+    return (next_tick + TIMER_WHEEL_SLOTS) * TIMER_WHEEL_TICK_NS;
+}
+
+static void *wheel_main(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&lock);
+    while (!stopping)
+    {
+        unsigned long now = timer_wheel_now_ns();
+        unsigned long now_tick = now / TIMER_WHEEL_TICK_NS;
+        if (now_tick >= next_tick)
+        {
+            // Each bucket once, however long we slept
+            unsigned long last =
+                now_tick - next_tick >= TIMER_WHEEL_SLOTS ? next_tick + TIMER_WHEEL_SLOTS - 1 : now_tick;
+            for (unsigned long tick = next_tick; tick <= last; tick++)
+            {
+                fire_due((unsigned int)(tick % TIMER_WHEEL_SLOTS), now);
+            }
+            // The bucket of this tick stays until the tick is over, it may hold timers due later in it
+            next_tick = now_tick;
+        }
+
+        // Sleep until the next timer is due; scheduling an earlier one wakes us
+        wake_ns = next_wake();
+        if (wake_ns == ULONG_MAX)
+        {
+            pthread_cond_wait(&changed, &lock);
+        }
+        else
+        {
+            struct timespec deadline = {(time_t)(wake_ns / 1000000000UL), (long)(wake_ns % 1000000000UL)};
+            pthread_cond_timedwait(&changed, &lock, &deadline);
+        }
+        wake_ns = 0;
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+void timer_wheel_timer_init(timer_wheel_timer_t *timer, void (*fire)(timer_wheel_timer_t *timer))
+{
+    timer->fire = fire;
+    timer->due_ns = 0;
+    timer->armed = 0;
+    timer->slot = 0;
+    timer->prev = NULL;
+    timer->next = NULL;
+}
+
+int timer_wheel_schedule(timer_wheel_timer_t *timer, unsigned long due_ns)
+{
+    pthread_mutex_lock(&lock);
+    if (!started)
+    {
+        pthread_once(&cond_once, init_cond);
+        stopping = 0;
+        wake_ns = 0;
+        next_tick = timer_wheel_now_ns() / TIMER_WHEEL_TICK_NS;
+        if (pthread_create(&thread, NULL, wheel_main, NULL) != 0)
+        {
+            pthread_mutex_unlock(&lock);
+            return -1;
+        }
+        started = 1;
+    }
+
+    if (timer->armed)
+    {
+        unlink_timer(timer);
+    }
+    // A bucket the thread already passed would only come round again a turn later
+    unsigned long tick = due_ns / TIMER_WHEEL_TICK_NS;
+    timer->due_ns = due_ns;
+    link_timer(timer, (unsigned int)((tick > next_tick ? tick : next_tick) % TIMER_WHEEL_SLOTS));
+
+    if (wake_ns != 0 && due_ns < wake_ns)
+    {
+        pthread_cond_signal(&changed);
+    }
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+void timer_wheel_cancel(timer_wheel_timer_t *timer)
+{
+    pthread_mutex_lock(&lock);
+    if (timer->armed)
+    {
+        unlink_timer(timer);
+    }
+    while (firing == timer)
+    {
+        pthread_cond_wait(&fired, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void timer_wheel_stop(void)
+{
+    pthread_mutex_lock(&lock);
+    if (!started)
+    {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    stopping = 1;
+    pthread_cond_signal(&changed);
+    pthread_mutex_unlock(&lock);
+
+    pthread_join(thread, NULL);
+
+    pthread_mutex_lock(&lock);
+    started = 0;
+    pthread_mutex_unlock(&lock);
+}
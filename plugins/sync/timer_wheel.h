@@ -0,0 +1,64 @@
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#define TIMER_WHEEL_SLOTS 512         /* Buckets of the wheel, one tick each */
+#define TIMER_WHEEL_TICK_NS 1000000UL /* 1ms, the resolution of a timer */
+
+/*
+ * Timer wheel. One thread, started on the first schedule, fires every timer
+ * of the process: a timer due in t ticks hangs in bucket (now + t) %
+ * TIMER_WHEEL_SLOTS, and the thread sleeps until the earliest one is due
+ * instead of waking every tick. Something that would otherwise sleep
+ * (a delaying plugin stage) arms a timer and returns; the timer wakes it.
+ *
+ * A host that exports these symbols (analyzer links with -rdynamic) makes
+ * every plugin it loads share its wheel and its thread.
+ */
+
+/**
+ * A timer. Embed it in the object it wakes.
+ */
+typedef struct timer_wheel_timer
+{
+    void (*fire)(struct timer_wheel_timer *timer); /* Runs on the wheel's thread once due, must not block */
+    unsigned long due_ns;                          /* CLOCK_MONOTONIC time it is due at */
+    int armed;                                     /* In a bucket, guarded by the wheel's lock */
+    unsigned int slot;                             /* The bucket, while armed */
+    struct timer_wheel_timer *prev;                /* Links in its bucket, while armed */
+    struct timer_wheel_timer *next;
+} timer_wheel_timer_t;
+
+/**
+ * Prepare a timer, not armed
+ * @param timer Timer to prepare
+ * @param fire Called when it is due
+ */
+void timer_wheel_timer_init(timer_wheel_timer_t *timer, void (*fire)(timer_wheel_timer_t *timer));
+
+/**
+ * Arm a timer, or move it if it is armed already. A time in the past fires it right away.
+ * @param timer Timer to arm
+ * @param due_ns CLOCK_MONOTONIC time to fire at, see timer_wheel_now_ns
+ * @return 0 on success, -1 if the wheel's thread can't be started
+ */
+int timer_wheel_schedule(timer_wheel_timer_t *timer, unsigned long due_ns);
+
+/**
+ * Disarm a timer. Returns once it is neither armed nor firing, so the
+ * object it is in may be freed. Must not be called from its own fire.
+ * @param timer Timer to disarm
+ */
+void timer_wheel_cancel(timer_wheel_timer_t *timer);
+
+/**
+ * Stop and join the wheel's thread. Timers still armed never fire; the
+ * next schedule starts the thread again.
+ */
+void timer_wheel_stop(void);
+
+/**
+ * @return The current CLOCK_MONOTONIC time in nanoseconds
+ */
+unsigned long timer_wheel_now_ns(void);
+
+#endif
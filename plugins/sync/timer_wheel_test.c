@@ -0,0 +1,258 @@
+/**
+ * timer_wheel_test.c
+ * Test suite for the timer wheel
+ */
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "timer_wheel.h"
+
+#define MANY_TIMERS 200
+#define MS 1000000UL
+
+/* Test result tracking */
+typedef struct
+{
+    int passed;
+    int failed;
+    int total;
+} test_results_t;
+
+static test_results_t results = {0, 0, 0};
+
+/* Helper macros for test assertions */
+#define TEST_ASSERT(condition, message)          \
+    do                                           \
+    {                                            \
+        if (!(condition))                        \
+        {                                        \
+            printf("    FAILED: %s\n", message); \
+            results.failed++;                    \
+            results.total++;                     \
+            return 0;                            \
+        }                                        \
+    } while (0)
+
+#define TEST_ASSERT_EQUAL(a, b, message) TEST_ASSERT((a) == (b), message)
+
+/* A timer that records when it fired and in which order */
+typedef struct
+{
+    timer_wheel_timer_t timer; /* First, so the timer pointer is the probe's */
+    atomic_int fires;
+    unsigned long fired_ns;
+    int order;
+} probe_t;
+
+static atomic_int fire_order;
+
+static void probe_fire(timer_wheel_timer_t *timer)
+{
+    probe_t *probe = (probe_t *)timer;
+    probe->fired_ns = timer_wheel_now_ns();
+    probe->order = atomic_fetch_add(&fire_order, 1);
+    atomic_fetch_add(&probe->fires, 1);
+}
+
+static void probe_init(probe_t *probe)
+{
+    timer_wheel_timer_init(&probe->timer, probe_fire);
+    atomic_init(&probe->fires, 0);
+    probe->fired_ns = 0;
+    probe->order = -1;
+}
+
+/* Waits up to a second for a probe to fire */
+static int wait_fired(probe_t *probe, int fires)
+{
+    for (int i = 0; i < 1000 && atomic_load(&probe->fires) < fires; i++)
+    {
+        usleep(1000);
+    }
+    return atomic_load(&probe->fires) >= fires;
+}
+
+/* Test 1: A timer fires once, not before it is due */
+static int test_fires_when_due(void)
+{
+    printf("\nTest 1: A timer fires once, not before it is due\n");
+
+    probe_t probe;
+    probe_init(&probe);
+    unsigned long due = timer_wheel_now_ns() + 20 * MS;
+    TEST_ASSERT_EQUAL(timer_wheel_schedule(&probe.timer, due), 0, "Schedule should succeed");
+    TEST_ASSERT(wait_fired(&probe, 1), "The timer fired");
+    TEST_ASSERT(probe.fired_ns >= due, "Not before it was due");
+    usleep(30000);
+    TEST_ASSERT_EQUAL(atomic_load(&probe.fires), 1, "Only once");
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 2: Timers fire in the order they are due, past ones right away */
+static int test_order(void)
+{
+    printf("\nTest 2: Timers fire in due order, past ones right away\n");
+
+    probe_t late, early, past;
+    probe_init(&late);
+    probe_init(&early);
+    probe_init(&past);
+    atomic_store(&fire_order, 0);
+    unsigned long now = timer_wheel_now_ns();
+    timer_wheel_schedule(&late.timer, now + 40 * MS);
+    timer_wheel_schedule(&early.timer, now + 10 * MS);
+    timer_wheel_schedule(&past.timer, now - 10 * MS);
+    TEST_ASSERT(wait_fired(&late, 1), "The last timer fired");
+    TEST_ASSERT_EQUAL(past.order, 0, "The past timer fired first");
+    TEST_ASSERT_EQUAL(early.order, 1, "The early timer fired second");
+    TEST_ASSERT_EQUAL(late.order, 2, "The late timer fired last");
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 3: A cancelled timer never fires, a moved one fires at its new time */
+static int test_cancel_and_move(void)
+{
+    printf("\nTest 3: Cancel and reschedule\n");
+
+    probe_t cancelled, moved;
+    probe_init(&cancelled);
+    probe_init(&moved);
+    unsigned long now = timer_wheel_now_ns();
+    timer_wheel_schedule(&cancelled.timer, now + 10 * MS);
+    timer_wheel_schedule(&moved.timer, now + 10 * MS);
+    timer_wheel_cancel(&cancelled.timer);
+    timer_wheel_schedule(&moved.timer, now + 50 * MS);
+    TEST_ASSERT(wait_fired(&moved, 1), "The moved timer fired");
+    TEST_ASSERT(moved.fired_ns >= now + 50 * MS, "At its new time");
+    TEST_ASSERT_EQUAL(atomic_load(&moved.fires), 1, "Once");
+    TEST_ASSERT_EQUAL(atomic_load(&cancelled.fires), 0, "The cancelled timer never fired");
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 4: Many timers spread over more than a turn of the wheel all fire */
+static int test_many_timers(void)
+{
+    printf("\nTest 4: %d timers over more than a turn of the wheel\n", MANY_TIMERS);
+
+    probe_t *probes = calloc(MANY_TIMERS, sizeof(probe_t));
+    TEST_ASSERT(probes != NULL, "Allocation should succeed");
+    unsigned long now = timer_wheel_now_ns();
+    for (int i = 0; i < MANY_TIMERS; i++)
+    {
+        probe_init(&probes[i]);
+        /* Every few ms, the last ones beyond TIMER_WHEEL_SLOTS ticks */
+        timer_wheel_schedule(&probes[i].timer, now + (unsigned long)i * 3 * TIMER_WHEEL_TICK_NS);
+    }
+    int fired = 1;
+    for (int i = 0; i < MANY_TIMERS; i++)
+    {
+        fired &= wait_fired(&probes[i], 1);
+    }
+    int early = 0;
+    for (int i = 0; i < MANY_TIMERS; i++)
+    {
+        early |= probes[i].fired_ns < now + (unsigned long)i * 3 * TIMER_WHEEL_TICK_NS;
+    }
+    free(probes);
+    TEST_ASSERT(fired, "Every timer fired");
+    TEST_ASSERT(!early, "None before it was due");
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 5: A timer due later in the tick of one that fired still fires on time */
+static int test_same_tick(void)
+{
+    printf("\nTest 5: Two timers due in one tick\n");
+
+    probe_t first, second;
+    probe_init(&first);
+    probe_init(&second);
+    /* Both inside the next tick, 0.1ms and 0.9ms into it */
+    unsigned long tick = (timer_wheel_now_ns() / TIMER_WHEEL_TICK_NS + 2) * TIMER_WHEEL_TICK_NS;
+    timer_wheel_schedule(&first.timer, tick + TIMER_WHEEL_TICK_NS / 10);
+    timer_wheel_schedule(&second.timer, tick + TIMER_WHEEL_TICK_NS * 9 / 10);
+    TEST_ASSERT(wait_fired(&first, 1), "The first timer fired");
+    TEST_ASSERT(wait_fired(&second, 1), "The second timer fired");
+    TEST_ASSERT(second.fired_ns >= tick + TIMER_WHEEL_TICK_NS * 9 / 10, "Not before it was due");
+    TEST_ASSERT(second.fired_ns < tick + 20 * MS, "Not a turn of the wheel late");
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 6: Stop joins the thread, the next schedule starts it again */
+static int test_stop_restart(void)
+{
+    printf("\nTest 6: Stop and restart\n");
+
+    probe_t probe;
+    probe_init(&probe);
+    timer_wheel_stop();
+    timer_wheel_stop(); /* Must not crash */
+    TEST_ASSERT_EQUAL(timer_wheel_schedule(&probe.timer, timer_wheel_now_ns() + MS), 0, "Schedule restarts it");
+    TEST_ASSERT(wait_fired(&probe, 1), "The timer fired after the restart");
+    timer_wheel_stop();
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Main test runner */
+int main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    printf("========================================\n");
+    printf("Timer Wheel Test Suite\n");
+    printf("========================================\n");
+
+    test_fires_when_due();
+    test_order();
+    test_cancel_and_move();
+    test_many_timers();
+    test_same_tick();
+    test_stop_restart();
+
+    /* Print summary */
+    printf("\n========================================\n");
+    printf("Test Results Summary:\n");
+    printf("Total:  %d\n", results.total);
+    printf("Passed: %d\n", results.passed);
+    printf("Failed: %d\n", results.failed);
+
+    if (results.failed == 0)
+    {
+        printf("\nAll tests PASSED! ✓\n");
+    }
+    else
+    {
+        printf("\nSome tests FAILED! ✗\n");
+    }
+    printf("========================================\n");
+
+    return results.failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE // syscall
+#include "topology.h"
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define TOPOLOGY_LINE_LENGTH 4096
+
+// Where a CPU sits, the keys topology_cpu_order sorts by
+typedef struct
+{
+    int node;
+    int package;
+    int core;
+    int cpu;
+} cpu_place_t;
+
+static pthread_once_t load_once = PTHREAD_ONCE_INIT;
+static short cpu_nodes[TOPOLOGY_MAX_CPUS]; // -1 where unknown
+static int node_count;
+
+// Reads the first line of a sysfs file, returns -1 if it can't
+static int read_line(const char *path, char *line, size_t size)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        return -1;
+    }
+    int result = fgets(line, (int)size, file) ? 0 : -1;
+    fclose(file);
+    return result;
+}
+
+// Reads a sysfs file holding one number, returns -1 if it can't
+static int read_number(const char *path)
+{
+    char line[64];
+    if (read_line(path, line, sizeof(line)) != 0)
+    {
+        return -1;
+    }
+    return atoi(line);
+}
+
+// Marks the CPUs of a list such as "0-3,8-11" in present, returns -1 if it isn't one
+static int parse_cpu_list(const char *text, unsigned char *present)
+{
+    const char *cursor = text;
+    while (*cursor != '\0' && *cursor != '\n')
+    {
+        char *end;
+        long first = strtol(cursor, &end, 10);
+        long last = first;
+        if (end == cursor)
+        {
+            return -1;
+        }
+        if (*end == '-')
+        {
+            cursor = end + 1;
+            last = strtol(cursor, &end, 10);
+            if (end == cursor)
+            {
+                return -1;
+            }
+        }
+        for (long cpu = first < 0 ? 0 : first; cpu <= last && cpu < TOPOLOGY_MAX_CPUS; cpu++)
+        {
+            present[cpu] = 1;
+        }
+        cursor = *end == ',' ? end + 1 : end;
+    }
+    return 0;
+}
+
+static void load(void)
+{
+    for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; cpu++)
+    {
+        cpu_nodes[cpu] = -1;
+    }
+    // Node numbers may have gaps, look at every one
+    for (int node = 0; node < TOPOLOGY_MAX_NODES; node++)
+    {
+        char path[128];
+        char line[TOPOLOGY_LINE_LENGTH];
+        unsigned char present[TOPOLOGY_MAX_CPUS] = {0};
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (read_line(path, line, sizeof(line)) != 0 || parse_cpu_list(line, present) != 0)
+        {
+            continue;
+        }
+        for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; cpu++)
+        {
+            if (present[cpu])
+            {
+                cpu_nodes[cpu] = (short)node;
+            }
+        }
+        node_count++;
+    }
+}
+
+static int compare_places(const void *a, const void *b)
+{
+    const cpu_place_t *x = a;
+    const cpu_place_t *y = b;
+    if (x->node != y->node)
+    {
+        return x->node - y->node;
+    }
+    if (x->package != y->package)
+    {
+        return x->package - y->package;
+    }
+    if (x->core != y->core)
+    {
+        return x->core - y->core;
+    }
+    return x->cpu - y->cpu;
+}
+
+int topology_cpu_order(int *cpus, int max)
+{
+    pthread_once(&load_once, load);
+
+    unsigned char present[TOPOLOGY_MAX_CPUS] = {0};
+    char line[TOPOLOGY_LINE_LENGTH];
+    if (read_line("/sys/devices/system/cpu/online", line, sizeof(line)) != 0 || parse_cpu_list(line, present) != 0)
+    {
+        // No sysfs: the CPUs as numbered
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long cpu = 0; cpu < online && cpu < TOPOLOGY_MAX_CPUS; cpu++)
+        {
+            present[cpu] = 1;
+        }
+    }
+
+    cpu_place_t *places = malloc(TOPOLOGY_MAX_CPUS * sizeof(cpu_place_t));
+    int count = 0;
+    for (int cpu = 0; places && cpu < TOPOLOGY_MAX_CPUS; cpu++)
+    {
+        if (!present[cpu])
+        {
+            continue;
+        }
+        char path[128];
+        cpu_place_t *place = &places[count++];
+        place->node = cpu_nodes[cpu];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        place->package = read_number(path);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        place->core = read_number(path);
+        place->cpu = cpu;
+    }
+    if (count == 0)
+    {
+        free(places);
+        if (max > 0)
+        {
+            cpus[0] = 0;
+        }
+        return 1;
+    }
+
+    qsort(places, count, sizeof(cpu_place_t), compare_places);
+    if (count > max)
+    {
+        count = max;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        cpus[i] = places[i].cpu;
+    }
+    free(places);
+    return count;
+}
+
+int topology_cpu_node(int cpu)
+{
+    pthread_once(&load_once, load);
+    return cpu >= 0 && cpu < TOPOLOGY_MAX_CPUS ? cpu_nodes[cpu] : -1;
+}
+
+int topology_node_count(void)
+{
+    pthread_once(&load_once, load);
+    return node_count;
+}
+
+void *topology_alloc_pages(size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return aligned_alloc(page, (size + page - 1) & ~(page - 1));
+}
+
+int topology_bind(void *memory, size_t size, int node)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (!memory || node < 0 || node >= TOPOLOGY_MAX_NODES || ((uintptr_t)memory & (page - 1)) != 0)
+    {
+        return -1;
+    }
+    // The kernel reads maxnode - 1 bits of the mask, give it one to spare
+    const int bits = (int)(sizeof(unsigned long) * 8);
+    unsigned long mask[TOPOLOGY_MAX_NODES / (sizeof(unsigned long) * 8) + 1] = {0};
+    mask[node / bits] = 1UL << (node % bits);
+    long result = syscall(SYS_mbind, memory, (size + page - 1) & ~(page - 1), MPOL_PREFERRED, mask,
+                          (unsigned long)TOPOLOGY_MAX_NODES + 1, MPOL_MF_MOVE);
+    return result == 0 ? 0 : -1;
+}
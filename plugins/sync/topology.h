@@ -0,0 +1,54 @@
+#ifndef TOPOLOGY_H_
+#define TOPOLOGY_H_
+#include <stddef.h>
+
+#define TOPOLOGY_MAX_CPUS 1024 /* CPUs numbered beyond this are left alone */
+#define TOPOLOGY_MAX_NODES 64  /* NUMA nodes looked for, and bindable with one mask word */
+
+/*
+ * CPU and NUMA layout of the machine, as sysfs describes it
+ * (/sys/devices/system/cpu and /sys/devices/system/node). Read once, on
+ * first use. A kernel without NUMA support shows no nodes: every CPU is then
+ * on node -1 and nothing is ever bound.
+ */
+
+/**
+ * List the online CPUs so that neighbours in the list share as much as
+ * possible: node by node, within a node package by package, within a
+ * package core by core, with the hardware threads of a core next to each other
+ * @param cpus Filled with CPU numbers
+ * @param max Entries cpus holds
+ * @return Number of CPUs listed, at least 1
+ */
+int topology_cpu_order(int *cpus, int max);
+
+/**
+ * @param cpu CPU number
+ * @return NUMA node of the CPU, -1 if unknown
+ */
+int topology_cpu_node(int cpu);
+
+/**
+ * @return Number of NUMA nodes, 0 if the kernel shows none
+ */
+int topology_node_count(void);
+
+/**
+ * Allocate memory that starts on a page and fills whole pages, so
+ * topology_bind can move it without moving anything else. Release with free().
+ * @param size Bytes needed
+ * @return The memory, not zeroed, NULL if out of memory
+ */
+void *topology_alloc_pages(size_t size);
+
+/**
+ * Prefer a NUMA node for memory from topology_alloc_pages: pages touched
+ * from now on come from it, pages already touched move there
+ * @param memory Memory from topology_alloc_pages
+ * @param size Bytes asked for when it was allocated
+ * @param node NUMA node
+ * @return 0 on success, -1 on failure
+ */
+int topology_bind(void *memory, size_t size, int node);
+
+#endif
@@ -26,6 +26,37 @@ const char *plugin_transform(const char *input)
     return output;
 }
 
+// Types one character per step, so the stage waits between them without sleeping
+long plugin_transform_paced(void *state, message_t *message, unsigned int step)
+{
+    (void)state;
+    if (step == 0)
+    {
+        printf("[typewriter] ");
+    }
+    else
+    {
+        putchar(message->data[step - 1]);
+    }
+    if (step == message->len)
+    {
+        putchar('\n');
+    }
+    fflush(stdout);
+    return step == message->len ? 0 : DELAY;
+}
+
+const plugin_capabilities_t *plugin_capabilities(void)
+{
+    // Sleeps between characters, which must not interleave with another line's
+    static const plugin_capabilities_t capabilities = {
+        PLUGIN_CAP_STATELESS | PLUGIN_CAP_LENGTH_PRESERVING | PLUGIN_CAP_OBSERVER | PLUGIN_CAP_BLOCKING |
+            PLUGIN_CAP_PACED,
+        PLUGIN_COST_EXPENSIVE,
+    };
+    return &capabilities;
+}
+
 __attribute__((visibility("default")))
 const char *
 plugin_init(int queue_size)
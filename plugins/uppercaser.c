@@ -2,6 +2,123 @@
 #include "plugin_sdk.h"
 #include <string.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UPPERCASER_X86 1
+#endif
+
+// Uppercases len bytes of input into output, which may be the same buffer
+typedef void (*upcase_kernel_t)(const char *input, char *output, size_t len);
+
+static void upcase_scalar(const char *input, char *output, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = input[i];
+        output[i] = (c <= 'z' && c >= 'a') ? (char)(c - 'a' + 'A') : c;
+    }
+}
+
+#ifdef UPPERCASER_X86
+// The SSE2 and AVX2 kernels add 0x80 - 'a', which moves 'a'..'z' and only them to
+// the 26 lowest signed bytes, so one signed compare finds them; their 0x20
+// bit is then cleared. The scalar loop does what is left over.
+
+__attribute__((target("sse2"))) static void upcase_sse2(const char *input, char *output, size_t len)
+{
+    const __m128i shift = _mm_set1_epi8((char)(0x80 - 'a'));
+    const __m128i limit = _mm_set1_epi8((char)(-128 + 26));
+    const __m128i bit = _mm_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(input + i));
+        __m128i lower = _mm_cmpgt_epi8(limit, _mm_add_epi8(v, shift));
+        _mm_storeu_si128((__m128i *)(output + i), _mm_sub_epi8(v, _mm_and_si128(lower, bit)));
+    }
+    upcase_scalar(input + i, output + i, len - i);
+}
+
+__attribute__((target("avx2"))) static void upcase_avx2(const char *input, char *output, size_t len)
+{
+    const __m256i shift = _mm256_set1_epi8((char)(0x80 - 'a'));
+    const __m256i limit = _mm256_set1_epi8((char)(-128 + 26));
+    const __m256i bit = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(input + i));
+        __m256i lower = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(v, shift));
+        _mm256_storeu_si256((__m256i *)(output + i), _mm256_sub_epi8(v, _mm256_and_si256(lower, bit)));
+    }
+    upcase_scalar(input + i, output + i, len - i);
+}
+
+// AVX-512 compares into a mask and subtracts under it; the tail is a masked load and store
+__attribute__((target("avx512f,avx512bw"))) static void upcase_avx512(const char *input, char *output, size_t len)
+{
+    const __m512i a = _mm512_set1_epi8('a');
+    const __m512i letters = _mm512_set1_epi8(26);
+    const __m512i bit = _mm512_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64)
+    {
+        __m512i v = _mm512_loadu_si512(input + i);
+        __mmask64 lower = _mm512_cmplt_epu8_mask(_mm512_sub_epi8(v, a), letters);
+        _mm512_storeu_si512(output + i, _mm512_mask_sub_epi8(v, lower, v, bit));
+    }
+    if (i < len)
+    {
+        __mmask64 bytes = ((__mmask64)1 << (len - i)) - 1;
+        __m512i v = _mm512_maskz_loadu_epi8(bytes, input + i);
+        __mmask64 lower = _mm512_cmplt_epu8_mask(_mm512_sub_epi8(v, a), letters);
+        _mm512_mask_storeu_epi8(output + i, bytes, _mm512_mask_sub_epi8(v, lower, v, bit));
+    }
+}
+#endif
+
+// The best kernel the CPU runs, picked once the plugin is loaded
+static upcase_kernel_t upcase = upcase_scalar;
+
+__attribute__((constructor)) static void pick_kernel(void)
+{
+#ifdef UPPERCASER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw"))
+    {
+        upcase = upcase_avx512;
+    }
+    else if (__builtin_cpu_supports("avx2"))
+    {
+        upcase = upcase_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        upcase = upcase_sse2;
+    }
+#endif
+}
+
+int plugin_transform_inplace(char *buf, size_t len)
+{
+    upcase(buf, buf, len);
+    return 0;
+}
+
+long plugin_transform_batch(const char *input, const size_t *offsets, int count, char *output, size_t capacity,
+                            size_t *output_offsets)
+{
+    // Lines keep their length, so the whole batch is one run of bytes
+    size_t total = offsets[count];
+    if (total > capacity)
+    {
+        return (long)total;
+    }
+    upcase(input, output, total);
+    memcpy(output_offsets, offsets, (count + 1) * sizeof(size_t));
+    return (long)total;
+}
+
 const char *plugin_transform(const char *input)
 {
     char *output = strdup(input);
@@ -9,20 +126,23 @@ const char *plugin_transform(const char *input)
     {
         return NULL;
     }
-
-    for (int i = 0; output[i]; i++)
-    {
-        if (output[i] <= 'z' && output[i] >= 'a')
-        {
-            output[i] = (output[i] - 'a') + 'A';
-        }
-    }
+    plugin_transform_inplace(output, strlen(output));
     return output;
 }
 
+const plugin_capabilities_t *plugin_capabilities(void)
+{
+    static const plugin_capabilities_t capabilities = {
+        PLUGIN_CAP_STATELESS | PLUGIN_CAP_THREAD_SAFE | PLUGIN_CAP_LENGTH_PRESERVING | PLUGIN_CAP_INPLACE |
+                     PLUGIN_CAP_BATCH,
+        PLUGIN_COST_CHEAP,
+    };
+    return &capabilities;
+}
+
 __attribute__((visibility("default")))
 const char *
 plugin_init(int queue_size)
 {
     return common_plugin_init(plugin_transform, "uppercaser", queue_size);
-}
\ No newline at end of file
+}
@@ -0,0 +1,218 @@
+/**
+ * uppercaser_test.c
+ * Cross-checks the uppercaser's vector kernels against its scalar loop on
+ * random input, and with "bench" times each kernel on long lines:
+ *   gcc -O2 -o uppercaser_test plugins/uppercaser_test.c && ./uppercaser_test [bench]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "uppercaser.c"
+
+#define CHECK_ROUNDS 20000
+#define CHECK_MAX_LENGTH 5000
+#define BENCH_LINE 4096
+#define BENCH_BYTES (1UL << 30)
+
+/* The kernels are all the test needs of the plugin */
+const char *common_plugin_init(const char *(*process_function)(const char *), const char *name, int queue_size)
+{
+    (void)process_function;
+    (void)name;
+    (void)queue_size;
+    return NULL;
+}
+
+/* Test result tracking */
+typedef struct
+{
+    int passed;
+    int failed;
+    int total;
+} test_results_t;
+
+static test_results_t results = {0, 0, 0};
+
+/* Helper macros for test assertions */
+#define TEST_ASSERT(condition, message)          \
+    do                                           \
+    {                                            \
+        if (!(condition))                        \
+        {                                        \
+            printf("    FAILED: %s\n", message); \
+            results.failed++;                    \
+            results.total++;                     \
+            return 0;                            \
+        }                                        \
+    } while (0)
+
+typedef struct
+{
+    const char *name;
+    upcase_kernel_t kernel;
+    int supported;
+} kernel_entry_t;
+
+static kernel_entry_t kernels[4];
+static int kernel_count;
+
+static void list_kernels(void)
+{
+    kernels[kernel_count++] = (kernel_entry_t){"scalar", upcase_scalar, 1};
+#ifdef UPPERCASER_X86
+    __builtin_cpu_init();
+    kernels[kernel_count++] = (kernel_entry_t){"sse2", upcase_sse2, __builtin_cpu_supports("sse2")};
+    kernels[kernel_count++] = (kernel_entry_t){"avx2", upcase_avx2, __builtin_cpu_supports("avx2")};
+    kernels[kernel_count++] = (kernel_entry_t){"avx512", upcase_avx512, __builtin_cpu_supports("avx512bw")};
+#endif
+}
+
+/* Test 1: Every kernel the CPU runs matches the scalar loop */
+static int test_cross_check(void)
+{
+    printf("\nTest 1: %d random lines, every byte value, unaligned, each kernel against scalar\n", CHECK_ROUNDS);
+
+    char *input = malloc(CHECK_MAX_LENGTH + 64);
+    char *expected = malloc(CHECK_MAX_LENGTH + 64);
+    char *actual = malloc(CHECK_MAX_LENGTH + 64);
+    TEST_ASSERT(input && expected && actual, "Allocation should succeed");
+    srand(1);
+    int mismatch = 0;
+    for (int round = 0; round < CHECK_ROUNDS && !mismatch; round++)
+    {
+        size_t len = (size_t)rand() % (round < CHECK_ROUNDS / 2 ? 200 : CHECK_MAX_LENGTH);
+        size_t offset = (size_t)rand() % 64;
+        for (size_t i = 0; i < len; i++)
+        {
+            /* Mostly letters around the edges of a-z, some of any value */
+            input[offset + i] = rand() % 4 ? (char)('Z' + rand() % 40) : (char)rand();
+        }
+        upcase_scalar(input + offset, expected, len);
+        for (int k = 1; k < kernel_count; k++)
+        {
+            if (!kernels[k].supported)
+            {
+                continue;
+            }
+            memset(actual, 0x55, CHECK_MAX_LENGTH + 64);
+            kernels[k].kernel(input + offset, actual + offset, len);
+            if (memcmp(actual + offset, expected, len) != 0 || actual[offset + len] != 0x55 ||
+                (offset > 0 && actual[offset - 1] != 0x55))
+            {
+                printf("    %s differs at length %zu, offset %zu\n", kernels[k].name, len, offset);
+                mismatch = 1;
+            }
+        }
+    }
+    free(input);
+    free(expected);
+    free(actual);
+    TEST_ASSERT(!mismatch, "Kernels write what the scalar loop writes, and nothing beyond");
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Test 2: The plugin's entry points use the picked kernel */
+static int test_entry_points(void)
+{
+    printf("\nTest 2: Entry points\n");
+
+    char line[] = "Hello, World! abc-xyz {az} `";
+    plugin_transform_inplace(line, strlen(line));
+    TEST_ASSERT(strcmp(line, "HELLO, WORLD! ABC-XYZ {AZ} `") == 0, "In place");
+
+    const char *input = "abcd"; /* "ab", "cd" and "" */
+    size_t offsets[] = {0, 2, 4, 4};
+    char output[8];
+    size_t output_offsets[4];
+    TEST_ASSERT(plugin_transform_batch(input, offsets, 3, output, sizeof(output), output_offsets) == 4, "Batch");
+    TEST_ASSERT(memcmp(output, "ABCD", 4) == 0 && output_offsets[3] == 4, "Batch output");
+
+    char *copy = (char *)plugin_transform("mixed Case");
+    TEST_ASSERT(copy && strcmp(copy, "MIXED CASE") == 0, "Copy");
+    free(copy);
+
+    printf("    PASSED\n");
+    results.passed++;
+    results.total++;
+    return 1;
+}
+
+/* Times each kernel the CPU runs over BENCH_BYTES of BENCH_LINE byte lines */
+static void bench(void)
+{
+    char *line = malloc(BENCH_LINE);
+    if (!line)
+    {
+        return;
+    }
+    for (size_t i = 0; i < BENCH_LINE; i++)
+    {
+        line[i] = (char)(' ' + rand() % 95);
+    }
+    printf("\nBenchmark: %d byte lines, in place\n", BENCH_LINE);
+    double scalar_rate = 0;
+    for (int k = 0; k < kernel_count; k++)
+    {
+        if (!kernels[k].supported)
+        {
+            printf("  %-8s not supported\n", kernels[k].name);
+            continue;
+        }
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (unsigned long done = 0; done < BENCH_BYTES; done += BENCH_LINE)
+        {
+            kernels[k].kernel(line, line, BENCH_LINE);
+            line[done % BENCH_LINE] |= 0x20; /* Keep some work for the next round */
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+        double rate = (double)BENCH_BYTES / seconds / 1e9;
+        scalar_rate = k == 0 ? rate : scalar_rate;
+        printf("  %-8s %6.2f GB/s  %5.1fx%s\n", kernels[k].name, rate, rate / scalar_rate,
+               kernels[k].kernel == upcase ? "  (picked)" : "");
+    }
+    free(line);
+}
+
+/* Main test runner */
+int main(int argc, char *argv[])
+{
+    printf("========================================\n");
+    printf("Uppercaser Kernel Test Suite\n");
+    printf("========================================\n");
+
+    list_kernels();
+    test_cross_check();
+    test_entry_points();
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        bench();
+    }
+
+    /* Print summary */
+    printf("\n========================================\n");
+    printf("Test Results Summary:\n");
+    printf("Total:  %d\n", results.total);
+    printf("Passed: %d\n", results.passed);
+    printf("Failed: %d\n", results.failed);
+
+    if (results.failed == 0)
+    {
+        printf("\nAll tests PASSED! ✓\n");
+    }
+    else
+    {
+        printf("\nSome tests FAILED! ✗\n");
+    }
+    printf("========================================\n");
+
+    return results.failed > 0 ? 1 : 0;
+}
@@ -449,4 +449,300 @@ if [ "$LINE_COUNT" -eq "2" ]; then
 else
     print_error "1024 char line followed by another: FAIL (Expected 2 lines, got $LINE_COUNT)"
     exit 1
-fi
\ No newline at end of file
+fi
+print_status "Test #42: Pipeline from a config file"
+CONFIG_FILE=$(mktemp)
+cat > "$CONFIG_FILE" <<'CONFIG'
+# per-stage queues and options
+uppercaser queue=2 wait=spin spin=100 batch=1
+rotator    queue=64 overflow=block
+logger     queue=8 wait=adaptive   # trailing comment
+CONFIG
+ACTUAL=$(echo -e "hello\nworld\n<END>" | ./output/analyzer --config "$CONFIG_FILE" | grep "\[logger\]")
+EXPECTED=$(echo -e "[logger] OHELL\n[logger] DWORL")
+if [ "$ACTUAL" == "$EXPECTED" ]; then
+    print_status "Pipeline from a config file: PASS"
+else
+    print_error "Pipeline from a config file: FAIL (Expected '$EXPECTED', got '$ACTUAL')"
+    rm -f "$CONFIG_FILE"
+    exit 1
+fi
+
+print_status "Test #43: Config file errors are reported with their line"
+echo -e "uppercaser queue=4\nlogger queue=0" > "$CONFIG_FILE"
+ERROR_OUTPUT=$(echo "<END>" | ./output/analyzer --config "$CONFIG_FILE" 2>&1 || true)
+if echo "$ERROR_OUTPUT" | grep -q "Error:.*:2: queue must be a positive integer"; then
+    print_status "Config file errors: PASS"
+else
+    print_error "Config file errors: FAIL (Expected line 2 queue error, got '$ERROR_OUTPUT')"
+    rm -f "$CONFIG_FILE"
+    exit 1
+fi
+
+print_status "Test #44: Unknown plugin option in config file"
+echo "logger queue=4 colour=blue" > "$CONFIG_FILE"
+ERROR_OUTPUT=$(echo "<END>" | ./output/analyzer --config "$CONFIG_FILE" 2>&1 || true)
+rm -f "$CONFIG_FILE"
+if echo "$ERROR_OUTPUT" | grep -q "Error: \[logger\] colour=blue: Unknown option"; then
+    print_status "Unknown plugin option: PASS"
+else
+    print_error "Unknown plugin option: FAIL (Expected unknown option error, got '$ERROR_OUTPUT')"
+    exit 1
+fi
+
+print_status "Test #45: Queue stats at shutdown"
+STATS_OUTPUT=$(echo -e "one\ntwo\n<END>" | ./output/analyzer --stats 10 uppercaser logger 2>&1 >/dev/null)
+if echo "$STATS_OUTPUT" | grep -q "uppercaser .*in=3 out=3 depth=0" && echo "$STATS_OUTPUT" | grep -q "logger .*in=3 out=3"; then
+    print_status "Queue stats at shutdown: PASS"
+else
+    print_error "Queue stats at shutdown: FAIL (got '$STATS_OUTPUT')"
+    exit 1
+fi
+
+print_status "Test #46: Same plugin twice in one chain"
+ACTUAL=$(echo -e "hello\n<END>" | ./output/analyzer 10 rotator rotator logger rotator logger | grep "\[logger\]")
+EXPECTED=$(echo -e "[logger] lohel\n[logger] llohe")
+if [ "$ACTUAL" == "$EXPECTED" ]; then
+    print_status "Same plugin twice in one chain: PASS"
+else
+    print_error "Same plugin twice in one chain: FAIL (Expected '$EXPECTED', got '$ACTUAL')"
+    exit 1
+fi
+
+print_status "Test #47: Replicated stage keeps input order"
+CONFIG_FILE=$(mktemp)
+echo -e "flipper queue=4 replicas=4 batch=3\nlogger queue=8" > "$CONFIG_FILE"
+INPUT=$(seq 1 500 | sed 's/^/ab/'; echo "<END>")
+ACTUAL=$(echo "$INPUT" | ./output/analyzer --config "$CONFIG_FILE" | grep "\[logger\]")
+EXPECTED=$(seq 1 500 | sed 's/^/ab/' | rev | sed 's/^/[logger] /')
+if [ "$ACTUAL" == "$EXPECTED" ]; then
+    print_status "Replicated stage keeps input order: PASS"
+else
+    print_error "Replicated stage keeps input order: FAIL (outputs out of order or missing)"
+    rm -f "$CONFIG_FILE"
+    exit 1
+fi
+
+print_status "Test #48: Unordered replicated stage"
+echo -e "uppercaser queue=4 replicas=3 order=unordered\nlogger queue=8" > "$CONFIG_FILE"
+ACTUAL=$(echo "$INPUT" | ./output/analyzer --config "$CONFIG_FILE" | grep "\[logger\]" | sort)
+EXPECTED=$(seq 1 500 | sed 's/^/[logger] AB/' | sort)
+rm -f "$CONFIG_FILE"
+if [ "$ACTUAL" == "$EXPECTED" ]; then
+    print_status "Unordered replicated stage: PASS"
+else
+    print_error "Unordered replicated stage: FAIL (outputs missing or duplicated)"
+    exit 1
+fi
+
+print_status "Test #49: Fused stages give the same output"
+INPUT=$(echo -e "hello\nworld\nabc\n<END>")
+ACTUAL=$(echo "$INPUT" | ./output/analyzer --fuse 10 uppercaser rotator flipper logger | grep "\[logger\]")
+EXPECTED=$(echo "$INPUT" | ./output/analyzer 10 uppercaser rotator flipper logger | grep "\[logger\]")
+if [ -n "$ACTUAL" ] && [ "$ACTUAL" == "$EXPECTED" ]; then
+    print_status "Fused stages give the same output: PASS"
+else
+    print_error "Fused stages give the same output: FAIL (Expected '$EXPECTED', got '$ACTUAL')"
+    exit 1
+fi
+
+print_status "Test #50: fuse=yes in a config file"
+CONFIG_FILE=$(mktemp)
+echo -e "uppercaser queue=4\nrotator queue=4 fuse=yes\nlogger queue=4" > "$CONFIG_FILE"
+STATS_OUTPUT=$(echo "$INPUT" | ./output/analyzer --stats --config "$CONFIG_FILE" 2>&1 >/dev/null)
+rm -f "$CONFIG_FILE"
+if echo "$STATS_OUTPUT" | grep -q "rotator .*fused into uppercaser calls=3" && echo "$STATS_OUTPUT" | grep -q "logger .*in=4 out=4"; then
+    print_status "fuse=yes in a config file: PASS"
+else
+    print_error "fuse=yes in a config file: FAIL (got '$STATS_OUTPUT')"
+    exit 1
+fi
+
+print_status "Test #51: In-place transforms on short strings"
+ACTUAL=$(echo -e "\na\nab\n<END>" | ./output/analyzer --fuse 10 rotator flipper uppercaser logger | grep "\[logger\]")
+EXPECTED=$(echo -e "[logger] \n[logger] A\n[logger] AB")
+if [ "$ACTUAL" == "$EXPECTED" ]; then
+    print_status "In-place transforms on short strings: PASS"
+else
+    print_error "In-place transforms on short strings: FAIL (Expected '$EXPECTED', got '$ACTUAL')"
+    exit 1
+fi
+
+print_status "Test #52: Control lines never reach the plugins"
+ACTUAL=$(echo -e "abc\n>DNE<\n<FLUSH>\nxyz\n<BARRIER>\n<END>" | ./output/analyzer 10 flipper uppercaser logger | grep "\[logger\]")
+EXPECTED=$(echo -e "[logger] CBA\n[logger] <END>\n[logger] ZYX")
+if [ "$ACTUAL" == "$EXPECTED" ]; then
+    print_status "Control lines never reach the plugins: PASS"
+else
+    print_error "Control lines never reach the plugins: FAIL (Expected '$EXPECTED', got '$ACTUAL')"
+    exit 1
+fi
+
+print_status "Test #53: Barrier stats snapshot"
+CONFIG_FILE=$(mktemp)
+echo -e "uppercaser queue=4 replicas=3\nlogger queue=4" > "$CONFIG_FILE"
+ACTUAL=$(echo -e "a\nb\nc\n<BARRIER>\nd\n<END>" | ./output/analyzer --stats --config "$CONFIG_FILE" 2>&1 >/dev/null \
+    | grep -A2 "^Barrier 1:" | awk 'NR > 1 {print $1, $2, $3}')
+EXPECTED=$(echo -e "uppercaser in=4 out=4\nlogger in=4 out=4")
+rm -f "$CONFIG_FILE"
+if [ "$ACTUAL" == "$EXPECTED" ]; then
+    print_status "Barrier stats snapshot: PASS"
+else
+    print_error "Barrier stats snapshot: FAIL (Expected '$EXPECTED', got '$ACTUAL')"
+    exit 1
+fi
+
+print_status "Test #54: Inline queue slots"
+CONFIG_FILE=$(mktemp)
+echo -e "uppercaser queue=4 inline=16\nflipper queue=4 replicas=2 inline=64\nexpander queue=4 inline=64\nlogger queue=4 inline=64" > "$CONFIG_FILE"
+INPUT=$( (seq 1 300 | sed 's/^/ab/'; echo "a line that is much longer than sixteen bytes and than sixty-four bytes too"; echo "<END>") )
+ACTUAL=$(echo "$INPUT" | ./output/analyzer --config "$CONFIG_FILE" | grep "\[logger\]")
+EXPECTED=$(echo "$INPUT" | ./output/analyzer 4 uppercaser flipper expander logger | grep "\[logger\]")
+rm -f "$CONFIG_FILE"
+if [ -n "$ACTUAL" ] && [ "$ACTUAL" == "$EXPECTED" ]; then
+    print_status "Inline queue slots: PASS"
+else
+    print_error "Inline queue slots: FAIL (outputs differ from the run without inline slots)"
+    exit 1
+fi
+
+print_status "Test #55: Replicas refused for a plugin that isn't thread safe"
+CONFIG_FILE=$(mktemp)
+echo -e "uppercaser queue=4\nlogger queue=4 replicas=2" > "$CONFIG_FILE"
+ERROR_OUTPUT=$(echo "<END>" | ./output/analyzer --config "$CONFIG_FILE" 2>&1 || true)
+rm -f "$CONFIG_FILE"
+if echo "$ERROR_OUTPUT" | grep -q "\[logger\] replicas=2: Plugin isn't stateless and thread safe"; then
+    print_status "Replicas refused for a plugin that isn't thread safe: PASS"
+else
+    print_error "Replicas refused for a plugin that isn't thread safe: FAIL (got '$ERROR_OUTPUT')"
+    exit 1
+fi
+
+print_status "Test #56: --fuse leaves a blocking stage on its own thread"
+CONFIG_FILE=$(mktemp)
+echo -e "uppercaser queue=4 replicas=auto\ntypewriter queue=4\nlogger queue=4" > "$CONFIG_FILE"
+STATS_OUTPUT=$(echo -e "a\n<END>" | ./output/analyzer --stats --fuse --config "$CONFIG_FILE" 2>&1 >/dev/null)
+rm -f "$CONFIG_FILE"
+if echo "$STATS_OUTPUT" | grep -q "typewriter .*in=2 out=2" && echo "$STATS_OUTPUT" | grep -q "logger .*in=2 out=2"; then
+    print_status "--fuse leaves a blocking stage on its own thread: PASS"
+else
+    print_error "--fuse leaves a blocking stage on its own thread: FAIL (got '$STATS_OUTPUT')"
+    exit 1
+fi
+
+print_status "Test #57: Built-in plugins run without their .so files"
+./build.sh static > /dev/null
+STATIC_DIR=$(mktemp -d)
+cp ./output/analyzer "$STATIC_DIR/"
+EXPECTED="[logger] OHELL"
+ACTUAL=$(cd "$STATIC_DIR" && echo -e "hello\n<END>" | ./analyzer --fuse 10 uppercaser rotator logger | grep "\[logger\]")
+MISSING_OUTPUT=$(cd "$STATIC_DIR" && echo "<END>" | ./analyzer 10 uppercaser sleeper 2>&1 || true)
+rm -rf "$STATIC_DIR"
+./build.sh > /dev/null
+if [ "$ACTUAL" == "$EXPECTED" ] && echo "$MISSING_OUTPUT" | grep -q "Failed to load plugin output/sleeper.so"; then
+    print_status "Built-in plugins run without their .so files: PASS"
+else
+    print_error "Built-in plugins run without their .so files: FAIL (got '$ACTUAL', '$MISSING_OUTPUT')"
+    exit 1
+fi
+
+print_status "Test #58: --pool runs the stages as tasks with the same output"
+EXPECTED=$( (seq 1 500 | sed 's/$/ab/'; echo "<END>") | ./output/analyzer 2 uppercaser rotator flipper expander logger | grep "\[logger\]")
+ACTUAL=$( (seq 1 500 | sed 's/$/ab/'; echo "<END>") | ./output/analyzer --pool 2 uppercaser rotator flipper expander logger | grep "\[logger\]")
+STATS_OUTPUT=$(echo -e "a\n<END>" | ./output/analyzer --pool --stats 2 uppercaser logger 2>&1 >/dev/null)
+if [ -n "$ACTUAL" ] && [ "$ACTUAL" == "$EXPECTED" ] && echo "$STATS_OUTPUT" | grep -q "Scheduler: workers="; then
+    print_status "--pool runs the stages as tasks with the same output: PASS"
+else
+    print_error "--pool runs the stages as tasks with the same output: FAIL"
+    exit 1
+fi
+
+print_status "Test #59: --place pins the stage threads without changing the output"
+INPUT=$(seq 1 300 | sed 's/$/ab/')
+EXPECTED=$(echo -e "$INPUT\n<END>" | ./output/analyzer 4 uppercaser rotator flipper logger | grep "\[logger\]")
+ACTUAL=$(echo -e "$INPUT\n<END>" | ./output/analyzer --place 4 uppercaser rotator flipper logger | grep "\[logger\]")
+STATS_OUTPUT=$(echo -e "a\n<END>" | ./output/analyzer --place --stats 4 uppercaser rotator flipper logger 2>&1 >/dev/null)
+if [ -n "$ACTUAL" ] && [ "$ACTUAL" == "$EXPECTED" ] && [ "$(echo "$STATS_OUTPUT" | grep -c "^Placement: ")" -eq 4 ]; then
+    print_status "--place pins the stage threads without changing the output: PASS"
+else
+    print_error "--place pins the stage threads without changing the output: FAIL"
+    exit 1
+fi
+
+print_status "Test #60: A paced stage overlaps the lines it holds, in order"
+CONFIG_FILE=$(mktemp)
+echo -e "typewriter queue=8 inflight=5\nlogger queue=8" > "$CONFIG_FILE"
+INPUT="abcdefghij\nklmnopqrst\nuvwxyzabcd\nefghijklmn\nopqrstuvwx\n<END>"
+EXPECTED=$(echo -e "$INPUT" | grep -v "<END>" | sed 's/^/[logger] /')
+START=$(date +%s%N)
+ACTUAL=$(echo -e "$INPUT" | ./output/analyzer --pool --config "$CONFIG_FILE" | grep "\[logger\]")
+ELAPSED_MS=$(( ($(date +%s%N) - START) / 1000000 ))
+echo -e "uppercaser queue=8 inflight=5\nlogger queue=8" > "$CONFIG_FILE"
+ERROR_OUTPUT=$(echo "<END>" | ./output/analyzer --config "$CONFIG_FILE" 2>&1 || true)
+rm -f "$CONFIG_FILE"
+# One after the other the five lines would take 5s
+if [ "$ACTUAL" == "$EXPECTED" ] && [ "$ELAPSED_MS" -lt 3000 ] &&
+    echo "$ERROR_OUTPUT" | grep -q "\[uppercaser\] inflight=5: Option needs plugin_transform_paced"; then
+    print_status "A paced stage overlaps the lines it holds, in order: PASS"
+else
+    print_error "A paced stage overlaps the lines it holds, in order: FAIL (${ELAPSED_MS}ms, got '$ERROR_OUTPUT')"
+    exit 1
+fi
+
+print_status "Test #61: ratelimiter paces lines to its budget and drops over it"
+CONFIG_FILE=$(mktemp)
+echo -e "ratelimiter queue=4 rate=20\nlogger queue=4" > "$CONFIG_FILE"
+EXPECTED=$(seq 1 11 | sed 's/^/[logger] /')
+START=$(date +%s%N)
+ACTUAL=$( (seq 1 11; echo "<END>") | ./output/analyzer --pool --config "$CONFIG_FILE" | grep "\[logger\]")
+ELAPSED_MS=$(( ($(date +%s%N) - START) / 1000000 ))
+# Several lines due in every 1ms tick of the timer wheel
+echo -e "ratelimiter queue=64 rate=2000 mode=delay inflight=64\nlogger queue=64" > "$CONFIG_FILE"
+DELAY_EXPECTED=$(seq 1 400 | sed 's/^/[logger] /')
+START=$(date +%s%N)
+DELAY_ACTUAL=$( (seq 1 400; echo "<END>") | ./output/analyzer --pool --config "$CONFIG_FILE" | grep "\[logger\]")
+DELAY_MS=$(( ($(date +%s%N) - START) / 1000000 ))
+echo -e "ratelimiter queue=64 rate=1 burst=3 mode=drop\nlogger queue=64" > "$CONFIG_FILE"
+DROP_COUNT=$( (seq 1 50; echo "<END>") | ./output/analyzer --config "$CONFIG_FILE" | grep -c "\[logger\]")
+# Each stage has a budget of its own: the second keeps the 3 lines the first let through
+echo -e "ratelimiter queue=64 rate=1 burst=3 mode=drop\nratelimiter queue=64 rate=1 burst=3 mode=drop\nlogger queue=64" > "$CONFIG_FILE"
+TWO_STAGE_COUNT=$( (seq 1 50; echo "<END>") | ./output/analyzer --config "$CONFIG_FILE" | grep -c "\[logger\]")
+rm -f "$CONFIG_FILE"
+# 10 lines beyond the first at 20 per second take half a second, 399 at 2000 per second a fifth
+if [ "$ACTUAL" == "$EXPECTED" ] && [ "$ELAPSED_MS" -ge 450 ] && [ "$ELAPSED_MS" -lt 1500 ] &&
+    [ "$DELAY_ACTUAL" == "$DELAY_EXPECTED" ] && [ "$DELAY_MS" -ge 190 ] && [ "$DELAY_MS" -lt 1500 ] &&
+    [ "$DROP_COUNT" -eq 3 ] && [ "$TWO_STAGE_COUNT" -eq 3 ]; then
+    print_status "ratelimiter paces lines to its budget and drops over it: PASS"
+else
+    print_error "ratelimiter paces lines to its budget and drops over it: FAIL (${ELAPSED_MS}ms, ${DELAY_MS}ms, $DROP_COUNT and $TWO_STAGE_COUNT lines kept)"
+    exit 1
+fi
+
+print_status "Test #62: uppercaser's vector kernels match its scalar loop"
+TEST_BINARY=$(mktemp)
+if gcc -O2 -o "$TEST_BINARY" plugins/uppercaser_test.c && "$TEST_BINARY" > /dev/null; then
+    rm -f "$TEST_BINARY"
+    print_status "uppercaser's vector kernels match its scalar loop: PASS"
+else
+    rm -f "$TEST_BINARY"
+    print_error "uppercaser's vector kernels match its scalar loop: FAIL"
+    exit 1
+fi
+
+print_status "Test #63: window must be a number no wider than the workers' queues"
+CONFIG_FILE=$(mktemp)
+echo -e "flipper queue=64 replicas=2 window=abc\nlogger queue=8" > "$CONFIG_FILE"
+NOT_NUMBER=$(echo "<END>" | ./output/analyzer --config "$CONFIG_FILE" 2>&1 || true)
+echo -e "flipper queue=64 replicas=2 window=1000000000\nlogger queue=8" > "$CONFIG_FILE"
+TOO_WIDE=$(echo "<END>" | ./output/analyzer --config "$CONFIG_FILE" 2>&1 || true)
+echo -e "flipper queue=64 replicas=2 window=256\nlogger queue=8" > "$CONFIG_FILE"
+ACTUAL=$(echo -e "hello\n<END>" | ./output/analyzer --config "$CONFIG_FILE" | grep "\[logger\]")
+rm -f "$CONFIG_FILE"
+if echo "$NOT_NUMBER" | grep -q "window=abc: Reorder window must be a positive integer" &&
+    echo "$TOO_WIDE" | grep -q "window=1000000000: Reorder window must be at most" &&
+    [ "$ACTUAL" == "[logger] olleh" ]; then
+    print_status "window must be a number no wider than the workers' queues: PASS"
+else
+    print_error "window must be a number no wider than the workers' queues: FAIL"
+    exit 1
+fi